@@ -0,0 +1,106 @@
+#ifndef __clean_jobs_H__
+#define __clean_jobs_H__
+
+#include <stdbool.h>
+#include <rvc_api.h>
+
+#include "room_map.h"
+
+#define CLEAN_JOBS_MAX	64
+
+typedef enum {
+	CLEAN_JOBS_ERROR_NONE = 0,
+	CLEAN_JOBS_ERROR_INVALID_PARAMETER = -1,
+	CLEAN_JOBS_ERROR_OUT_OF_MEMORY = -2,
+	CLEAN_JOBS_ERROR_NO_DATA = -3,
+	CLEAN_JOBS_ERROR_IO = -4,
+	CLEAN_JOBS_ERROR_FULL = -5,
+} clean_jobs_error_e;
+
+typedef enum {
+	CLEAN_JOB_PENDING,
+	CLEAN_JOB_ACTIVE,	// Started, resumes at @a lane
+	CLEAN_JOB_DONE,
+} clean_job_state_e;
+
+/**
+ * @brief Cleaning job of one room. Jobs run in queue order.
+ * @details Room ids change whenever the map is segmented again, so a job
+ * remembers its room by the room centroid and is bound to the current id by
+ * clean_jobs_sync().
+ */
+typedef struct {
+	int room;						// Id in the current room map, 0 while unbound
+	float room_x, room_y;			// Room centroid when last bound
+	float area;
+	bool suction_set;				// The user chose a suction for this room
+	rvc_suction_state_e suction;	// Lowest suction allowed when @a suction_set
+	clean_job_state_e state;
+	int lane;						// Next lane to clean
+	int lane_count;
+} clean_job_s;
+
+/**
+ * @brief Ordered per-room cleaning jobs.
+ * @remarks Not thread safe; the queue belongs to the thread driving the robot.
+ */
+typedef struct clean_jobs_s *clean_jobs_h;
+
+int clean_jobs_create(clean_jobs_h *jobs);
+
+void clean_jobs_destroy(clean_jobs_h jobs);
+
+/**
+ * @brief Replaces the queue with the one saved at @a path.
+ * @return CLEAN_JOBS_ERROR_NO_DATA if there is no valid saved queue
+ */
+int clean_jobs_load(clean_jobs_h jobs, const char *path);
+
+/**
+ * @brief Saves the queue to @a path through a temporary file and a rename, so a
+ * crash leaves either the old or the new queue behind.
+ */
+int clean_jobs_save(clean_jobs_h jobs, const char *path);
+
+/**
+ * @brief Binds the jobs to the rooms of @a map.
+ * @details A job takes the room its saved centroid falls in; jobs whose room is
+ * gone, or taken by an earlier job, are dropped. Rooms without a job get a new
+ * pending one, appended in nearest neighbor order starting from the last queued
+ * room, or from (@a start_x, @a start_y) for an empty queue. The lane count of
+ * each job is refreshed for lanes @a lane_spacing apart.
+ */
+int clean_jobs_sync(clean_jobs_h jobs, room_map_h map, float start_x, float start_y, float lane_spacing);
+
+int clean_jobs_count(clean_jobs_h jobs);
+
+clean_job_s *clean_jobs_get(clean_jobs_h jobs, int index);
+
+/**
+ * @brief Returns the index of the job to run next: the first active or pending
+ * one in queue order, or -1 when all are done.
+ */
+int clean_jobs_next(clean_jobs_h jobs);
+
+/**
+ * @brief Moves the job at @a from to position @a to, shifting the ones between.
+ */
+int clean_jobs_move(clean_jobs_h jobs, int from, int to);
+
+/**
+ * @brief Sets the lowest suction allowed for the job of @a room.
+ */
+int clean_jobs_set_suction(clean_jobs_h jobs, int room, rvc_suction_state_e suction);
+
+/**
+ * @brief Records that the lanes before @a lane of job @a index are clean.
+ * @details The job becomes active, or done once @a lane reaches its lane count.
+ */
+int clean_jobs_advance(clean_jobs_h jobs, int index, int lane);
+
+/**
+ * @brief Makes every job pending again from its first lane, for a new cleaning cycle.
+ */
+void clean_jobs_reset(clean_jobs_h jobs);
+
+#endif /* __clean_jobs_H__ */
@@ -0,0 +1,154 @@
+#ifndef __clean_runner_H__
+#define __clean_runner_H__
+
+#include <stdbool.h>
+
+#include "occupancy_grid.h"
+#include "hazard_index.h"
+#include "motion_planner.h"
+#include "energy_planner.h"
+#include "clean_jobs.h"
+
+typedef enum {
+	CLEAN_RUNNER_ERROR_NONE = 0,
+	CLEAN_RUNNER_ERROR_INVALID_PARAMETER = -1,
+	CLEAN_RUNNER_ERROR_OUT_OF_MEMORY = -2,
+	CLEAN_RUNNER_ERROR_FULL = -3,
+} clean_runner_error_e;
+
+/**
+ * @brief Runner settings. Lengths are in rvc_get_pose() units.
+ */
+typedef struct {
+	float lane_spacing;				// Lane pitch, the width cleaned in one pass
+	float body_radius;				// Lane ends are pulled in by this much so the bumper stops short of the wall
+	unsigned int drive_period_us;	// Control period of the lane follower
+	unsigned int plan_budget_us;	// Motion planning time per control period
+	float drive_tolerance;			// Distance at which a waypoint counts as reached
+	float drive_timeout_margin;		// Seconds allowed on top of 3x the nominal travel time
+	float dock_tolerance;			// Distance from the dock pose within which the robot can be on the dock
+	unsigned int explore_time_ms;	// Built-in auto cleaning before the map is segmented again
+	float resume_charge;			// Estimated charge at which the robot leaves the dock again
+	unsigned int poll_us;			// Poll period while waiting for exploration or a recharge
+} clean_runner_config_s;
+
+/**
+ * @brief What the runner works with. The handles stay owned by the caller.
+ */
+typedef struct {
+	occupancy_grid_h grid;			// Map the rooms are segmented from
+	hazard_index_h hazards;			// Steered around, may be NULL
+	motion_planner_h planner;
+	energy_planner_h energy;
+	clean_jobs_h jobs;
+	const char *jobs_path;			// Where the queue is saved after every lane, NULL to keep it in memory only
+	float dock_x, dock_y;
+} clean_runner_env_s;
+
+/**
+ * @brief Time and pose sources.
+ * @details NULL @a now_us and @a sleep_us select CLOCK_MONOTONIC and usleep(). A
+ * simulator can supply its own virtual clock to run the cleaning logic without
+ * waiting. @a get_pose is required.
+ */
+typedef struct {
+	unsigned long long (*now_us)(void *data);
+	void (*sleep_us)(unsigned int us, void *data);
+	void (*get_pose)(float *x, float *y, float *q, void *data);
+	void *data;
+} clean_runner_ops_s;
+
+typedef enum {
+	CLEAN_RUNNER_IDLE,			// Away from the dock, not cleaning
+	CLEAN_RUNNER_CLEANING,		// Driving a room or exploring
+	CLEAN_RUNNER_RETURNING,		// Sent home with RVC_MODE_SET_DOCKING
+	CLEAN_RUNNER_DOCKED,
+} clean_runner_state_e;
+
+typedef enum {
+	CLEAN_RUNNER_DRIVE_REACHED,
+	CLEAN_RUNNER_DRIVE_BLOCKED,	// Contact or timeout, the waypoint is given up
+	CLEAN_RUNNER_DRIVE_ABORTED,	// Stopped or sent home, the job is interrupted
+} clean_runner_drive_e;
+
+typedef enum {
+	CLEAN_RUNNER_EDIT_SUCTION,	// Lowest suction of the room, an rvc_suction_state_e
+	CLEAN_RUNNER_EDIT_MOVE,		// Queue position of the room
+} clean_runner_edit_e;
+
+/**
+ * @brief Drives the per-room cleaning jobs with the motion planner.
+ * @details The runner belongs to one cleaning thread; the functions that report
+ * events may be called from any thread.
+ */
+typedef struct clean_runner_s *clean_runner_h;
+
+void clean_runner_config_default(clean_runner_config_s *config);
+
+/**
+ * @brief Creates a runner for a robot sitting on its dock.
+ */
+int clean_runner_create(const clean_runner_config_s *config, const clean_runner_env_s *env, const clean_runner_ops_s *ops, clean_runner_h *runner);
+
+void clean_runner_destroy(clean_runner_h runner);
+
+/**
+ * @brief Runs the room queue until every room is done or clean_runner_stop() is called.
+ * @details Segments the map into rooms and cleans them in queue order: suction and
+ * speed of each room come from the energy planner, raised to the room's own
+ * suction setting, and the queue is planned again before every room. While
+ * nothing is mapped the built-in auto cleaning explores for explore_time_ms.
+ * Once the next room does not fit in the charge, or the robot is sent home, the
+ * runner waits on the dock until the charge reaches resume_charge and continues.
+ * The robot is sent home at the end.
+ */
+int clean_runner_run(clean_runner_h runner);
+
+/**
+ * @brief Steers to (x, y) at up to @a speed.
+ * @details Every control period the motion planner picks the next rvc_set_lin_ang()
+ * command, steering around the mapped obstacles and hazards.
+ * @return A clean_runner_drive_e
+ */
+int clean_runner_drive_to(clean_runner_h runner, float x, float y, float speed);
+
+/**
+ * @brief Makes clean_runner_run() and clean_runner_drive_to() return.
+ */
+void clean_runner_stop(clean_runner_h runner);
+
+/**
+ * @brief Reports a bumper or cliff contact, which gives up the current waypoint.
+ */
+void clean_runner_contact(clean_runner_h runner);
+
+/**
+ * @brief Sends the robot home with RVC_MODE_SET_DOCKING, interrupting the current job.
+ * @return false if it already was on its way
+ */
+bool clean_runner_send_home(clean_runner_h runner);
+
+/**
+ * @brief Reports the end of a docking run, seen as a mode change away from docking.
+ * @details The robot counts as docked only if it is also within dock_tolerance of
+ * the dock. A run that ended elsewhere, e.g. cancelled, is started again.
+ * @return true if the robot was sent home and has only now arrived
+ */
+bool clean_runner_arrived(clean_runner_h runner);
+
+/**
+ * @brief Reports a rising battery level, in case the end of the docking run was missed.
+ * @details Like clean_runner_arrived(), it counts only within dock_tolerance of the dock.
+ */
+void clean_runner_charging(clean_runner_h runner);
+
+clean_runner_state_e clean_runner_get_state(clean_runner_h runner);
+
+/**
+ * @brief Queues an edit of the job of the room containing (x, y).
+ * @details Room ids change with every segmentation, so the room is named by a
+ * point in it. The runner applies the edit before it starts the next room.
+ */
+int clean_runner_edit(clean_runner_h runner, clean_runner_edit_e type, float x, float y, int value);
+
+#endif /* __clean_runner_H__ */
@@ -0,0 +1,113 @@
+#ifndef __energy_planner_H__
+#define __energy_planner_H__
+
+#include <stdbool.h>
+#include <rvc_api.h>
+
+typedef enum {
+	ENERGY_PLANNER_ERROR_NONE = 0,
+	ENERGY_PLANNER_ERROR_INVALID_PARAMETER = -1,
+	ENERGY_PLANNER_ERROR_OUT_OF_MEMORY = -2,
+	ENERGY_PLANNER_ERROR_NO_DATA = -3,
+} energy_planner_error_e;
+
+/**
+ * @brief Planner settings. Distances and speeds are in rvc_get_pose() units.
+ * @details Drain rates are fractions of a full charge per second (or per unit of
+ * distance) and seed the learned model until real battery readings replace them.
+ * The drain model is linear in speed, so the charge per area only falls as the
+ * robot speeds up; each suction therefore cleans at the fastest speed it still
+ * picks up well at rather than at a speed chosen per region.
+ */
+typedef struct {
+	int batt_levels;				// Number of rvc_batt_level_e steps, lowest first
+	float swath_width;				// Width cleaned in one pass
+	float speed[3];					// Cleaning speed per suction: silent, normal, turbo
+	float dock_speed;				// Speed used to return to the dock
+	float reserve_margin;			// Safety factor on the energy needed to dock, e.g. 0.5 for +50 %
+	float prior_suction_drain[3];	// Initial drain per second: silent, normal, turbo
+	float prior_motion_drain;		// Initial drain per unit of distance
+	float prior_idle_drain;			// Initial drain per second parked away from the dock
+	float forgetting;				// RLS forgetting factor, 0.9..1
+} energy_planner_config_s;
+
+/**
+ * @brief One region to clean, in cleaning order.
+ * @details @a dock_distance is the path length from the region back to the dock.
+ */
+typedef struct {
+	float area;
+	rvc_suction_state_e min_suction;
+	float dock_distance;
+} energy_region_s;
+
+/**
+ * @brief Suction and speed chosen for a region and the charge it is expected to use.
+ */
+typedef struct {
+	rvc_suction_state_e suction;
+	float speed;
+	float energy;
+	bool affordable;
+} energy_choice_s;
+
+typedef struct energy_planner_s *energy_planner_h;
+
+void energy_planner_config_default(energy_planner_config_s *config);
+
+int energy_planner_create(const energy_planner_config_s *config, energy_planner_h *planner);
+
+void energy_planner_destroy(energy_planner_h planner);
+
+/**
+ * @brief Accounts @a dt seconds spent with @a suction while moving at @a speed.
+ * @details Call periodically while the robot is cleaning away from the dock.
+ */
+int energy_planner_observe_motion(energy_planner_h planner, float dt, rvc_suction_state_e suction, float speed);
+
+/**
+ * @brief Accounts @a dt seconds parked or paused away from the dock, suction off.
+ * @details Time on the dock is not accounted at all; charging restarts the interval.
+ */
+int energy_planner_observe_idle(energy_planner_h planner, float dt);
+
+/**
+ * @brief Feeds a battery level reading, e.g. from the rvc_batt_callback.
+ * @details Each step down closes an interval whose drain (one level) is regressed
+ * against the time and distance spent in each suction state during it. A step up
+ * means the robot is charging and restarts the interval.
+ */
+int energy_planner_observe_level(energy_planner_h planner, rvc_batt_level_e level);
+
+/**
+ * @brief Predicted drain per second for @a suction at @a speed.
+ */
+float energy_planner_get_drain(energy_planner_h planner, rvc_suction_state_e suction, float speed);
+
+/**
+ * @brief Estimated charge fraction: the last level boundary minus the predicted drain since.
+ */
+float energy_planner_get_charge(energy_planner_h planner);
+
+/**
+ * @brief Charge needed to drive @a dock_distance back to the dock, including the reserve margin.
+ */
+float energy_planner_get_dock_reserve(energy_planner_h planner, float dock_distance);
+
+/**
+ * @brief Returns true when the estimated charge no longer covers the trip to the dock.
+ */
+bool energy_planner_should_dock(energy_planner_h planner, float dock_distance);
+
+/**
+ * @brief Chooses suction for each region, cleaned at that suction's configured speed.
+ * @details Every region first gets the suction at or above its minimum with the
+ * lowest energy per area, which maximizes the area covered per charge. Regions are then funded in
+ * order from the charge left above the dock reserve of each region; regions past
+ * the first one that does not fit are marked unaffordable. Leftover charge upgrades
+ * suction in order, since stronger suction cleans better at the same coverage.
+ * @param[out] affordable Number of leading regions that fit in the budget
+ */
+int energy_planner_plan(energy_planner_h planner, const energy_region_s *regions, int count, energy_choice_s *choices, int *affordable);
+
+#endif /* __energy_planner_H__ */
@@ -0,0 +1,23 @@
+#ifndef __file_util_H__
+#define __file_util_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Helpers shared by the modules that keep state in files (map_store, clean_jobs).
+ * Internal to the service, not part of its interface.
+ */
+
+/**
+ * @brief CRC-32 (IEEE 802.3, reflected) of @a len bytes at @a data.
+ */
+uint32_t file_crc32(const void *data, size_t len);
+
+/**
+ * @brief Flushes the directory holding @a path, making a rename() into it durable.
+ * @return 0 on success, -1 on failure
+ */
+int file_fsync_dir(const char *path);
+
+#endif /* __file_util_H__ */
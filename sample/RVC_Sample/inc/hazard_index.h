@@ -0,0 +1,108 @@
+#ifndef __hazard_index_H__
+#define __hazard_index_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Kinds of hazard contact recorded in the index.
+ * @details Values are bit flags so that queries can select several kinds at once.
+ */
+typedef enum {
+	HAZARD_TYPE_BUMPER = 0x01,
+	HAZARD_TYPE_CLIFF  = 0x02,
+	HAZARD_TYPE_LIFT   = 0x04,
+	HAZARD_TYPE_MAGNET = 0x08,
+	HAZARD_TYPE_ALL    = 0x0f,
+} hazard_type_e;
+
+typedef enum {
+	HAZARD_INDEX_ERROR_NONE = 0,
+	HAZARD_INDEX_ERROR_INVALID_PARAMETER = -1,
+	HAZARD_INDEX_ERROR_OUT_OF_MEMORY = -2,
+	HAZARD_INDEX_ERROR_FULL = -3,
+	HAZARD_INDEX_ERROR_NO_DATA = -4,
+} hazard_index_error_e;
+
+/**
+ * @brief One hazard location.
+ * @details Coordinates are in the same frame and unit as rvc_get_pose().
+ * Contacts of the same type that land close to an existing entry are merged
+ * into it, so @a hits counts how often the spot has been re-observed.
+ */
+typedef struct {
+	float x;
+	float y;
+	unsigned char type;		// hazard_type_e
+	unsigned char sensor;	// Bit mask of the sensors that fired (bit 0: left, 1: center, 2: right)
+	unsigned short hits;
+	unsigned int last_seen;	// Caller supplied time stamp of the latest contact
+} hazard_s;
+
+typedef struct hazard_index_s *hazard_index_h;
+
+/**
+ * @brief Returns the number of bytes needed to hold an index of @a capacity entries.
+ * @details The index keeps all of its state (header, hash buckets and entries) in
+ * one contiguous, pointer free block, so the block may be placed in any memory,
+ * including a file mapping. See hazard_index_attach().
+ */
+size_t hazard_index_block_size(unsigned int capacity);
+
+/**
+ * @brief Creates an index that owns its own block.
+ * @param[in] cell_size Edge length of a grid cell, also used as the merge distance
+ * @param[in] capacity Maximum number of distinct hazard entries
+ * @param[out] index The new index
+ */
+int hazard_index_create(float cell_size, unsigned int capacity, hazard_index_h *index);
+
+/**
+ * @brief Wraps a caller owned block of hazard_index_block_size() bytes.
+ * @details If @a init is true the block is formatted as an empty index, otherwise
+ * it must already hold an index of the same capacity (e.g. one loaded from disk).
+ * The block must outlive the returned handle. Only the block header is validated;
+ * see hazard_index_recover() for blocks that may not have been written back cleanly.
+ */
+int hazard_index_attach(void *block, size_t size, float cell_size, unsigned int capacity, bool init, hazard_index_h *index);
+
+void hazard_index_destroy(hazard_index_h index);
+
+/**
+ * @brief Truncates an attached index to its first @a count entries and relinks the hash chains.
+ * @details Used after an unclean shutdown of a persisted block, where entries past
+ * the last durable count may be torn. Must be called before any other access.
+ */
+int hazard_index_recover(hazard_index_h index, unsigned int count);
+
+/**
+ * @brief Records a hazard contact at (x, y), merging it with a nearby entry of the same type.
+ */
+int hazard_index_insert(hazard_index_h index, hazard_type_e type, unsigned char sensor, float x, float y, unsigned int stamp);
+
+/**
+ * @brief Finds the closest hazard matching @a type_mask within @a max_radius of (x, y).
+ * @return HAZARD_INDEX_ERROR_NO_DATA if there is none
+ */
+int hazard_index_nearest(hazard_index_h index, float x, float y, float max_radius, unsigned int type_mask, hazard_s *hazard, float *distance);
+
+/**
+ * @brief Copies up to @a max_count hazards within @a radius of (x, y) into @a hazards.
+ * @param[out] count Number of matching hazards, which may exceed @a max_count
+ */
+int hazard_index_query_radius(hazard_index_h index, float x, float y, float radius, unsigned int type_mask, hazard_s *hazards, unsigned int max_count, unsigned int *count);
+
+/**
+ * @brief Checks for a hazard in the corridor swept by driving @a range along heading @a q.
+ * @details The corridor starts at (x, y) and is @a half_width wide on each side of the heading.
+ */
+int hazard_index_check_heading(hazard_index_h index, float x, float y, float q, float range, float half_width, unsigned int type_mask, bool *found);
+
+unsigned int hazard_index_count(hazard_index_h index);
+
+/**
+ * @brief Visits every hazard in insertion order. Stops early if @a cb returns false.
+ */
+int hazard_index_foreach(hazard_index_h index, bool (*cb)(const hazard_s *hazard, void *user_data), void *user_data);
+
+#endif /* __hazard_index_H__ */
@@ -0,0 +1,72 @@
+#ifndef __map_store_H__
+#define __map_store_H__
+
+#include <stdbool.h>
+
+#include "hazard_index.h"
+#include "occupancy_grid.h"
+
+typedef enum {
+	MAP_STORE_ERROR_NONE = 0,
+	MAP_STORE_ERROR_INVALID_PARAMETER = -1,
+	MAP_STORE_ERROR_OUT_OF_MEMORY = -2,
+	MAP_STORE_ERROR_IO = -3,
+} map_store_error_e;
+
+/**
+ * @brief Geometry of the persisted map.
+ * @details A file written with a different geometry or format version is discarded
+ * and a fresh map is created in its place.
+ */
+typedef struct {
+	unsigned int grid_width;
+	unsigned int grid_height;
+	float grid_resolution;
+	unsigned int hazard_capacity;
+	float hazard_cell_size;
+} map_store_config_s;
+
+typedef struct map_store_s *map_store_h;
+
+/**
+ * @brief Opens or creates the map file at @a path and maps it into memory.
+ * @details The occupancy grid and hazard index are used in place inside the
+ * mapping, so opening costs the same regardless of how much has been mapped.
+ * If the previous session did not close the store cleanly, hazard entries
+ * written after the last checkpoint are dropped.
+ * @param[out] restored true if existing map data was loaded
+ * @return MAP_STORE_ERROR_IO if the file exists but cannot be opened or mapped;
+ * it is left untouched so a later open can still restore it
+ */
+int map_store_open(const char *path, const map_store_config_s *config, map_store_h *store, bool *restored);
+
+/**
+ * @brief Checkpoints and unmaps the store, marking the file as cleanly closed.
+ * @details The grid and hazard handles obtained from the store become invalid.
+ */
+void map_store_close(map_store_h store);
+
+occupancy_grid_h map_store_get_grid(map_store_h store);
+
+hazard_index_h map_store_get_hazards(map_store_h store);
+
+/**
+ * @brief Sets the dock pose. It becomes durable at the next checkpoint.
+ */
+int map_store_set_dock(map_store_h store, float x, float y, float q);
+
+/**
+ * @brief Gets the dock pose.
+ * @return MAP_STORE_ERROR_INVALID_PARAMETER if no dock has been recorded
+ */
+int map_store_get_dock(map_store_h store, float *x, float *y, float *q);
+
+/**
+ * @brief Makes all changes since the previous checkpoint durable.
+ * @details Only pages dirtied since the last checkpoint are written back, then
+ * the alternate header slot is written with the new generation. A crash at any
+ * point leaves the previous header slot intact.
+ */
+int map_store_checkpoint(map_store_h store);
+
+#endif /* __map_store_H__ */
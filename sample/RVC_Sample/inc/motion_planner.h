@@ -0,0 +1,85 @@
+#ifndef __motion_planner_H__
+#define __motion_planner_H__
+
+#include <stdbool.h>
+
+#include "occupancy_grid.h"
+#include "hazard_index.h"
+
+typedef enum {
+	MOTION_PLANNER_ERROR_NONE = 0,
+	MOTION_PLANNER_ERROR_INVALID_PARAMETER = -1,
+	MOTION_PLANNER_ERROR_OUT_OF_MEMORY = -2,
+	MOTION_PLANNER_ERROR_THREAD = -3,
+} motion_planner_error_e;
+
+/**
+ * @brief Planner settings. Lengths are in rvc_get_pose() units, times in seconds.
+ */
+typedef struct {
+	int threads;				// Pool workers besides the calling thread, -1 for one per spare CPU
+	int max_candidates;			// Candidates per plan when time allows
+	int batch;					// Candidates a worker takes at a time
+	float horizon;				// Time each candidate is simulated ahead
+	float sim_step;
+	float max_lin;				// Forward speed range
+	float max_ang;				// Turn rate range, both ways
+	float lin_acc;				// Ramp from the current command to a candidate
+	float ang_acc;
+	float robot_radius;
+	float clearance_range;		// Clearance beyond this earns nothing more
+	float window;				// Half size of the local clearance map
+	float w_progress;			// Score weights
+	float w_heading;
+	float w_clearance;
+	float w_speed;
+} motion_planner_config_s;
+
+/**
+ * @brief Situation to plan for.
+ */
+typedef struct {
+	float x, y, q;				// Current pose
+	float lin, ang;				// Command in effect
+	float goal_x, goal_y;
+	float max_lin;				// Speed limit of this plan, 0 for the configured one
+	occupancy_grid_h grid;		// Occupied cells are obstacles, may be NULL
+	hazard_index_h hazards;		// Bumper and cliff hazards are obstacles, may be NULL
+} motion_query_s;
+
+typedef struct {
+	float lin, ang;				// Command to send with rvc_set_lin_ang()
+	float score;
+	bool valid;					// false if every candidate evaluated collides
+	unsigned int evaluated;		// Candidates simulated before the deadline
+	unsigned int steals;		// Candidate ranges taken from another worker
+} motion_plan_s;
+
+typedef struct motion_planner_s *motion_planner_h;
+
+void motion_planner_config_default(motion_planner_config_s *config);
+
+/**
+ * @brief Creates the planner and starts its worker threads.
+ */
+int motion_planner_create(const motion_planner_config_s *config, motion_planner_h *planner);
+
+void motion_planner_destroy(motion_planner_h planner);
+
+/**
+ * @brief Picks the best motion toward the goal found within @a budget_us.
+ * @details Candidates are constant (lin, ang) targets reached at the configured
+ * accelerations. Each is simulated over the horizon against a clearance map of
+ * the neighborhood, built once per call, and scored for progress to the goal,
+ * final heading, clearance and speed; any candidate that touches an obstacle is
+ * discarded. The calling thread and the pool split the candidate sequence into
+ * ranges, and a worker that runs out steals half of the largest range left. The
+ * sequence starts with the current command, a stop and a turn toward the goal,
+ * then covers the command space evenly, so stopping early still leaves a
+ * sensible choice. The call returns at the deadline with the best candidate
+ * so far, however many of the workers got CPU time.
+ * @remarks Not reentrant; plan from one thread.
+ */
+int motion_planner_plan(motion_planner_h planner, const motion_query_s *query, unsigned int budget_us, motion_plan_s *plan);
+
+#endif /* __motion_planner_H__ */
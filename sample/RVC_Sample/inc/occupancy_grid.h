@@ -0,0 +1,80 @@
+#ifndef __occupancy_grid_H__
+#define __occupancy_grid_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief State of one grid cell.
+ */
+typedef enum {
+	OCCUPANCY_UNKNOWN = 0,
+	OCCUPANCY_FREE = 1,		// The robot has driven over the cell
+	OCCUPANCY_OCCUPIED = 2,	// A bumper or cliff contact was recorded in the cell
+} occupancy_state_e;
+
+typedef enum {
+	OCCUPANCY_GRID_ERROR_NONE = 0,
+	OCCUPANCY_GRID_ERROR_INVALID_PARAMETER = -1,
+	OCCUPANCY_GRID_ERROR_OUT_OF_MEMORY = -2,
+	OCCUPANCY_GRID_ERROR_OUT_OF_RANGE = -3,
+} occupancy_grid_error_e;
+
+/**
+ * @brief Occupancy grid of the floor.
+ * @details Cells may be marked from the rvc callback threads while other threads
+ * read them; an internal read-write lock keeps the two apart.
+ */
+typedef struct occupancy_grid_s *occupancy_grid_h;
+
+/**
+ * @brief Returns the number of bytes needed for a @a width x @a height grid.
+ * @details Like the hazard index, the grid keeps its header and cells in one
+ * pointer free block that may live in a file mapping.
+ */
+size_t occupancy_grid_block_size(unsigned int width, unsigned int height);
+
+/**
+ * @brief Creates a grid centered on the pose origin.
+ * @param[in] resolution Cell edge length in rvc_get_pose() units
+ */
+int occupancy_grid_create(unsigned int width, unsigned int height, float resolution, occupancy_grid_h *grid);
+
+/**
+ * @brief Wraps a caller owned block, formatting it first if @a init is true.
+ */
+int occupancy_grid_attach(void *block, size_t size, unsigned int width, unsigned int height, float resolution, bool init, occupancy_grid_h *grid);
+
+void occupancy_grid_destroy(occupancy_grid_h grid);
+
+int occupancy_grid_get_size(occupancy_grid_h grid, unsigned int *width, unsigned int *height, float *resolution);
+
+/**
+ * @brief Converts a pose coordinate to cell coordinates.
+ * @return OCCUPANCY_GRID_ERROR_OUT_OF_RANGE if the point is outside the grid
+ */
+int occupancy_grid_world_to_cell(occupancy_grid_h grid, float x, float y, int *cx, int *cy);
+
+/**
+ * @brief Returns the world coordinate of the center of cell (cx, cy).
+ */
+void occupancy_grid_cell_to_world(occupancy_grid_h grid, int cx, int cy, float *x, float *y);
+
+occupancy_state_e occupancy_grid_get(occupancy_grid_h grid, int cx, int cy);
+
+/**
+ * @brief Copies the @a width x @a height cells from (cx, cy) into @a cells, row major.
+ * @details Bulk readers get one consistent snapshot while the callbacks keep
+ * marking cells. Cells outside the grid read as OCCUPANCY_UNKNOWN.
+ */
+int occupancy_grid_copy(occupancy_grid_h grid, int cx, int cy, unsigned int width, unsigned int height, unsigned char *cells);
+
+/**
+ * @brief Marks every unknown cell within @a radius of (x, y) as free.
+ * @details Occupied cells are left alone so a recorded contact is not erased by driving past it.
+ */
+int occupancy_grid_mark_free(occupancy_grid_h grid, float x, float y, float radius);
+
+int occupancy_grid_mark_occupied(occupancy_grid_h grid, float x, float y);
+
+#endif /* __occupancy_grid_H__ */
@@ -0,0 +1,108 @@
+#ifndef __pose_graph_H__
+#define __pose_graph_H__
+
+#include <stdbool.h>
+
+typedef enum {
+	POSE_GRAPH_ERROR_NONE = 0,
+	POSE_GRAPH_ERROR_INVALID_PARAMETER = -1,
+	POSE_GRAPH_ERROR_OUT_OF_MEMORY = -2,
+	POSE_GRAPH_ERROR_FULL = -3,
+} pose_graph_error_e;
+
+/**
+ * @brief Landmarks the robot can recognize when it meets them again.
+ */
+typedef enum {
+	POSE_GRAPH_LANDMARK_MAGNET,		// Magnet strip crossing, a point on the strip
+	POSE_GRAPH_LANDMARK_BUMPER,		// Bumper contact with a fixed obstacle
+	POSE_GRAPH_LANDMARK_TYPE_MAX,
+} pose_graph_landmark_e;
+
+/**
+ * @brief Graph settings. Lengths are in rvc_get_pose() units, angles in radians.
+ * @details Odometry between two keyframes is trusted to sigma = base + per unit of
+ * travel, so long legs give way first when a landmark disagrees with them.
+ */
+typedef struct {
+	float keyframe_distance;		// Travel that starts a new keyframe
+	float keyframe_angle;			// Rotation that starts a new keyframe
+	float odom_sigma_xy;			// Translation noise per keyframe
+	float odom_sigma_xy_per_dist;	// ... plus this fraction of the travel
+	float odom_sigma_q;				// Heading noise per keyframe
+	float odom_sigma_q_per_dist;	// ... plus this much per unit of travel
+	float odom_sigma_q_per_rot;		// ... plus this fraction of the rotation
+	float dock_sigma_xy;			// Pose noise when sitting on the dock
+	float dock_sigma_q;
+	float landmark_sigma[POSE_GRAPH_LANDMARK_TYPE_MAX];
+	float landmark_radius[POSE_GRAPH_LANDMARK_TYPE_MAX];	// Observations this close to a landmark are taken as that landmark
+	float huber;					// Landmark residuals beyond this many sigmas are down weighted
+	int max_nodes;					// Older keyframes are thinned out beyond this
+	int max_landmarks;
+	int max_observations;
+} pose_graph_config_s;
+
+typedef struct {
+	unsigned int nodes;
+	unsigned int landmarks;
+	unsigned int observations;
+	unsigned int dropped;			// Inputs lost to a full queue or graph
+	unsigned int iterations;		// Solver iterations run in total
+	float error;					// Weighted squared error after the last step
+	float correction;				// Distance the newest keyframe was moved from raw odometry
+} pose_graph_stats_s;
+
+typedef struct pose_graph_s *pose_graph_h;
+
+void pose_graph_config_default(pose_graph_config_s *config);
+
+int pose_graph_create(const pose_graph_config_s *config, pose_graph_h *graph);
+
+void pose_graph_destroy(pose_graph_h graph);
+
+/**
+ * @brief Sets the dock pose that pose_graph_observe_dock() pins the robot to.
+ */
+int pose_graph_set_dock(pose_graph_h graph, float x, float y, float q);
+
+/**
+ * @brief Feeds a raw odometry pose, e.g. from the rvc_pose_callback.
+ * @details Only queues the pose; it is added to the graph by the next
+ * pose_graph_optimize(). Safe to call from any thread.
+ */
+int pose_graph_add_pose(pose_graph_h graph, float x, float y, float q);
+
+/**
+ * @brief Records that the robot sees a landmark of @a type at the latest pose.
+ * @param[in] offset_x Position of the sensor in the robot frame, x ahead
+ * @param[in] offset_y Position of the sensor in the robot frame, y to the left
+ */
+int pose_graph_observe(pose_graph_h graph, pose_graph_landmark_e type, float offset_x, float offset_y);
+
+/**
+ * @brief Records that the robot sits on the dock at the latest pose.
+ */
+int pose_graph_observe_dock(pose_graph_h graph);
+
+/**
+ * @brief Adds the queued inputs to the graph and improves the estimate for at
+ * most @a budget_us microseconds.
+ * @details Each Gauss-Newton step solves the sparse normal equations with
+ * conjugate gradients, preconditioned by an exact solve of the odometry chain.
+ * The iterations stop at the budget and the partial step is still applied, so
+ * a large correction converges over several calls. The new correction is then
+ * published for pose_graph_correct().
+ * @remarks Call from one thread only, e.g. a periodic timer.
+ */
+int pose_graph_optimize(pose_graph_h graph, unsigned int budget_us);
+
+/**
+ * @brief Maps a raw odometry pose to the corrected one in place.
+ * @details Lock free: the correction of the newest keyframe is published under a
+ * sequence counter, so readers never wait for the solver.
+ */
+void pose_graph_correct(pose_graph_h graph, float *x, float *y, float *q);
+
+int pose_graph_get_stats(pose_graph_h graph, pose_graph_stats_s *stats);
+
+#endif /* __pose_graph_H__ */
@@ -0,0 +1,77 @@
+#ifndef __room_map_H__
+#define __room_map_H__
+
+#include <stdbool.h>
+
+#include "occupancy_grid.h"
+
+typedef enum {
+	ROOM_MAP_ERROR_NONE = 0,
+	ROOM_MAP_ERROR_INVALID_PARAMETER = -1,
+	ROOM_MAP_ERROR_OUT_OF_MEMORY = -2,
+	ROOM_MAP_ERROR_NO_DATA = -3,
+} room_map_error_e;
+
+/**
+ * @brief Segmentation settings. Lengths are in rvc_get_pose() units.
+ */
+typedef struct {
+	float door_width;		// Openings up to this wide separate rooms
+	float min_room_area;	// Smaller regions are merged into their largest neighbor
+	int threads;			// Worker threads for the distance transform and labeling, 0 for one per CPU
+} room_map_config_s;
+
+/**
+ * @brief One room. Cell coordinates refer to the occupancy grid it was built from.
+ */
+typedef struct {
+	int id;					// Label in room_map_labels(), starting at 1
+	unsigned int cells;
+	float area;
+	float x, y;				// Centroid in pose coordinates
+	int min_cx, min_cy;		// Bounding box in cells, inclusive
+	int max_cx, max_cy;
+} room_s;
+
+typedef struct room_map_s *room_map_h;
+
+void room_map_config_default(room_map_config_s *config);
+
+/**
+ * @brief Segments the free space of @a grid into rooms.
+ * @details Free cells are labeled by a marker based watershed over the Euclidean
+ * distance to the nearest non-free cell. Markers are the connected areas farther
+ * than door_width / 2 from any wall, so they split at doorways; the flood then
+ * gives every free cell to the marker it is reached from first along the ridge of
+ * the distance map. Free areas too narrow for any marker become rooms of their own.
+ * The distance transform and the marker labeling are split over horizontal tiles
+ * run by @a config threads.
+ * @return ROOM_MAP_ERROR_NO_DATA if the grid has no free cells
+ */
+int room_map_build(occupancy_grid_h grid, const room_map_config_s *config, room_map_h *map);
+
+void room_map_destroy(room_map_h map);
+
+int room_map_get_rooms(room_map_h map, const room_s **rooms, int *count);
+
+const room_s *room_map_get_room(room_map_h map, int id);
+
+/** Returns the room at (x, y), or 0 if the point is not in any room. */
+int room_map_room_at(room_map_h map, float x, float y);
+
+/** Returns the row major label array, 0 for cells outside all rooms. */
+const unsigned short *room_map_labels(room_map_h map, unsigned int *width, unsigned int *height);
+
+/**
+ * @brief Returns lane @a lane of a boustrophedon sweep over room @a id.
+ * @details Lanes run along x, @a spacing apart, starting at the low y edge of the
+ * room. Each lane spans the first to the last cell of the room on its row; odd
+ * lanes are reversed so consecutive lanes join up.
+ * @return false once @a lane is past the last lane of the room
+ */
+bool room_map_get_lane(room_map_h map, int id, float spacing, int lane, float *x0, float *y0, float *x1, float *y1);
+
+/** Number of lanes room_map_get_lane() yields for room @a id. */
+int room_map_lane_count(room_map_h map, int id, float spacing);
+
+#endif /* __room_map_H__ */
@@ -0,0 +1,153 @@
+/**
+ * @file	rvc_log.h
+ * @brief	Asynchronous logger with deferred formatting
+ *
+ * A log call stores a pointer to its static call site (level, format string and
+ * argument types) and the raw argument values in a ring owned by the calling
+ * thread. Nothing is formatted and no lock or system call is taken on that path.
+ * A background thread drains the rings, formats the messages and hands them to
+ * the sink: dlog in the service, stdout or a file elsewhere.
+ *
+ * Levels above RVC_LOG_LEVEL are removed at compile time, so debug logging
+ * costs nothing in a release build:
+ * @code
+ * #define RVC_LOG_LEVEL RVC_LOG_LEVEL_DEBUG	// before including rvc_log.h
+ * RVC_LOG_D("pose %.1f %.1f", x, y);
+ * @endcode
+ *
+ * Arguments may be integers, floating point values, pointers or strings, up to
+ * RVC_LOG_MAX_ARGS of them. Strings are copied (up to RVC_LOG_MAX_STRING bytes)
+ * since they may be gone by the time the message is formatted. '*' widths are
+ * not supported. A full ring drops the message and the drop is reported later.
+ *
+ * Outside the service, e.g. for userApp.c, build with -IRVC_Sample/inc and
+ * RVC_Sample/src/rvc_log.c.
+ */
+
+#ifndef __rvc_log_H__
+#define __rvc_log_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RVC_LOG_MAX_ARGS	8
+#define RVC_LOG_MAX_STRING	64
+
+#define RVC_LOG_LEVEL_ERROR		1
+#define RVC_LOG_LEVEL_WARN		2
+#define RVC_LOG_LEVEL_INFO		3
+#define RVC_LOG_LEVEL_DEBUG		4
+
+#ifndef RVC_LOG_LEVEL
+#define RVC_LOG_LEVEL	RVC_LOG_LEVEL_INFO
+#endif
+
+typedef enum {
+	RVC_LOG_ERROR_NONE = 0,
+	RVC_LOG_ERROR_INVALID_PARAMETER = -1,
+	RVC_LOG_ERROR_OUT_OF_MEMORY = -2,
+	RVC_LOG_ERROR_ALREADY_RUNNING = -3,
+	RVC_LOG_ERROR_THREAD = -4,
+} rvc_log_error_e;
+
+typedef enum {
+	RVC_LOG_ARG_INT,
+	RVC_LOG_ARG_UINT,
+	RVC_LOG_ARG_LONG,
+	RVC_LOG_ARG_ULONG,
+	RVC_LOG_ARG_LLONG,
+	RVC_LOG_ARG_ULLONG,
+	RVC_LOG_ARG_DOUBLE,
+	RVC_LOG_ARG_STRING,
+	RVC_LOG_ARG_POINTER,
+} rvc_log_arg_e;
+
+/** One log statement. Instances are static, so the address identifies the message. */
+typedef struct {
+	int level;
+	const char *file;
+	int line;
+	const char *format;
+	int arg_count;
+	unsigned char arg_types[RVC_LOG_MAX_ARGS];
+} rvc_log_site_s;
+
+/**
+ * @brief Receives formatted messages on the logger thread.
+ * @param[in] t_ns CLOCK_MONOTONIC time of the log call
+ */
+typedef void (*rvc_log_sink_cb)(int level, uint64_t t_ns, const char *message, void *user_data);
+
+typedef struct {
+	rvc_log_sink_cb sink;		// NULL for rvc_log_sink_stream() on stdout
+	void *sink_data;
+	unsigned int ring_size;		// Bytes per thread, a power of two
+	unsigned int poll_ms;		// Logger thread sleep when all rings are empty
+} rvc_log_config_s;
+
+void rvc_log_config_default(rvc_log_config_s *config);
+
+/** Starts the logger thread. Messages logged before this are dropped. */
+int rvc_log_init(const rvc_log_config_s *config);
+
+/** Formats everything still queued, then stops the logger thread. */
+void rvc_log_shutdown(void);
+
+/** Waits until every message logged before the call has reached the sink. */
+void rvc_log_flush(void);
+
+/** Sink writing "[seconds] L message" lines to the FILE * in @a user_data, or stdout. */
+void rvc_log_sink_stream(int level, uint64_t t_ns, const char *message, void *user_data);
+
+/** Queues one record. Use the RVC_LOG_* macros instead. */
+void rvc_log_write(const rvc_log_site_s *site, ...);
+
+/*
+ * Argument type detection
+ */
+
+#define _RVC_LOG_TYPE(x) _Generic((x), \
+	_Bool: RVC_LOG_ARG_INT, char: RVC_LOG_ARG_INT, signed char: RVC_LOG_ARG_INT, \
+	unsigned char: RVC_LOG_ARG_INT, short: RVC_LOG_ARG_INT, unsigned short: RVC_LOG_ARG_INT, \
+	int: RVC_LOG_ARG_INT, unsigned int: RVC_LOG_ARG_UINT, \
+	long: RVC_LOG_ARG_LONG, unsigned long: RVC_LOG_ARG_ULONG, \
+	long long: RVC_LOG_ARG_LLONG, unsigned long long: RVC_LOG_ARG_ULLONG, \
+	float: RVC_LOG_ARG_DOUBLE, double: RVC_LOG_ARG_DOUBLE, \
+	char *: RVC_LOG_ARG_STRING, const char *: RVC_LOG_ARG_STRING, \
+	default: RVC_LOG_ARG_POINTER)
+
+#define _RVC_LOG_NARGS(...)		_RVC_LOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define _RVC_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...)	n
+
+#define _RVC_LOG_CAT(a, b)		_RVC_LOG_CAT_(a, b)
+#define _RVC_LOG_CAT_(a, b)		a##b
+
+#define _RVC_LOG_T0()					0
+#define _RVC_LOG_T1(a)					_RVC_LOG_TYPE(a)
+#define _RVC_LOG_T2(a, ...)				_RVC_LOG_TYPE(a), _RVC_LOG_T1(__VA_ARGS__)
+#define _RVC_LOG_T3(a, ...)				_RVC_LOG_TYPE(a), _RVC_LOG_T2(__VA_ARGS__)
+#define _RVC_LOG_T4(a, ...)				_RVC_LOG_TYPE(a), _RVC_LOG_T3(__VA_ARGS__)
+#define _RVC_LOG_T5(a, ...)				_RVC_LOG_TYPE(a), _RVC_LOG_T4(__VA_ARGS__)
+#define _RVC_LOG_T6(a, ...)				_RVC_LOG_TYPE(a), _RVC_LOG_T5(__VA_ARGS__)
+#define _RVC_LOG_T7(a, ...)				_RVC_LOG_TYPE(a), _RVC_LOG_T6(__VA_ARGS__)
+#define _RVC_LOG_T8(a, ...)				_RVC_LOG_TYPE(a), _RVC_LOG_T7(__VA_ARGS__)
+#define _RVC_LOG_TYPES(...)		_RVC_LOG_CAT(_RVC_LOG_T, _RVC_LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#define RVC_LOG(level, format, ...) \
+	do { \
+		if ((level) <= RVC_LOG_LEVEL) \
+		{ \
+			static const rvc_log_site_s _rvc_log_site = { \
+				(level), __FILE__, __LINE__, (format), _RVC_LOG_NARGS(__VA_ARGS__), \
+				{ _RVC_LOG_TYPES(__VA_ARGS__) } \
+			}; \
+			rvc_log_write(&_rvc_log_site, ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+#define RVC_LOG_E(format, ...)	RVC_LOG(RVC_LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#define RVC_LOG_W(format, ...)	RVC_LOG(RVC_LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define RVC_LOG_I(format, ...)	RVC_LOG(RVC_LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define RVC_LOG_D(format, ...)	RVC_LOG(RVC_LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+
+#endif /* __rvc_log_H__ */
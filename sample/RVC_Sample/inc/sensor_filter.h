@@ -0,0 +1,84 @@
+#ifndef __sensor_filter_H__
+#define __sensor_filter_H__
+
+#include <stdbool.h>
+
+#define SENSOR_FILTER_MAX_RATE	16
+
+typedef enum {
+	SENSOR_FILTER_BUMPER,
+	SENSOR_FILTER_CLIFF,
+	SENSOR_FILTER_LIFT,
+	SENSOR_FILTER_MAGNET,
+	SENSOR_FILTER_TYPE_MAX,
+} sensor_filter_type_e;
+
+typedef enum {
+	SENSOR_FILTER_ERROR_NONE = 0,
+	SENSOR_FILTER_ERROR_INVALID_PARAMETER = -1,
+	SENSOR_FILTER_ERROR_OUT_OF_MEMORY = -2,
+} sensor_filter_error_e;
+
+/**
+ * @brief Filter settings of one sensor type, applied to each of its sensors separately.
+ * @details A sensor that turns active is reported at once. Only its release is
+ * delayed: the raw signal must stay clear for @a release_ms (hysteresis), and the
+ * sensor is reported active for at least @a min_active_ms (dwell). Chatter inside
+ * those windows is absorbed. If a sensor is reported active @a rate_cap times within
+ * @a rate_window_ms it is in a storm and its release needs @a storm_release_ms of
+ * quiet instead, which caps the reported edges without ever delaying a hazard.
+ */
+typedef struct {
+	unsigned int release_ms;
+	unsigned int min_active_ms;
+	unsigned int rate_cap;			// 0 disables the storm detection, at most SENSOR_FILTER_MAX_RATE
+	unsigned int rate_window_ms;
+	unsigned int storm_release_ms;
+} sensor_filter_params_s;
+
+typedef struct {
+	sensor_filter_params_s params[SENSOR_FILTER_TYPE_MAX];
+} sensor_filter_config_s;
+
+typedef struct {
+	unsigned int events;		// Raw callbacks fed in
+	unsigned int reported;		// Filtered changes passed on
+	unsigned int absorbed;		// Raw callbacks that changed nothing downstream
+	unsigned int storms;		// Times a sensor entered the storm state
+} sensor_filter_stats_s;
+
+/**
+ * @brief Receives the filtered state of a sensor type.
+ * @param[in] active Bit mask of the sensors reported active (bit 0: left, 1: center, 2: right)
+ * @param[in] rising Sensors among @a active that have just turned active
+ * @remarks Called with the filter locked, so that changes arrive in order. It must
+ * not call back into the filter.
+ */
+typedef void (*sensor_filter_cb)(sensor_filter_type_e type, unsigned char active, unsigned char rising, void *user_data);
+
+typedef struct sensor_filter_s *sensor_filter_h;
+
+void sensor_filter_config_default(sensor_filter_config_s *config);
+
+int sensor_filter_create(const sensor_filter_config_s *config, sensor_filter_cb callback, void *user_data, sensor_filter_h *filter);
+
+void sensor_filter_destroy(sensor_filter_h filter);
+
+/**
+ * @brief Feeds a raw sensor callback.
+ * @details The filter callback runs from this call when the filtered state changes.
+ * @param[in] raw Bit mask of the sensors currently active
+ * @param[in] now_ms Monotonic time in milliseconds
+ */
+int sensor_filter_input(sensor_filter_h filter, sensor_filter_type_e type, unsigned char raw, unsigned long long now_ms);
+
+/**
+ * @brief Reports the releases that have become due.
+ * @details A release is only confirmed after a quiet period, with no raw callback to
+ * trigger it, so this must be called periodically, e.g. every 50 ms.
+ */
+int sensor_filter_tick(sensor_filter_h filter, unsigned long long now_ms);
+
+int sensor_filter_get_stats(sensor_filter_h filter, sensor_filter_type_e type, sensor_filter_stats_s *stats);
+
+#endif /* __sensor_filter_H__ */
@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "clean_jobs.h"
+#include "file_util.h"
+
+#define CLEAN_JOBS_MAGIC	0x424f4a52u	// "RJOB"
+#define CLEAN_JOBS_VERSION	1u
+
+/*
+ * File layout: a header followed by @a count job records, both little endian as
+ * written by the robot. The CRC covers the records.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t crc;
+} jobs_header_s;
+
+typedef struct {
+	float room_x;
+	float room_y;
+	float area;
+	uint32_t suction_set;
+	int32_t suction;
+	uint32_t state;
+	int32_t lane;
+	int32_t lane_count;
+} job_record_s;
+
+struct clean_jobs_s {
+	clean_job_s jobs[CLEAN_JOBS_MAX];
+	int count;
+};
+
+int clean_jobs_create(clean_jobs_h *jobs)
+{
+	if (!jobs)
+		return CLEAN_JOBS_ERROR_INVALID_PARAMETER;
+
+	*jobs = calloc(1, sizeof(struct clean_jobs_s));
+	if (!*jobs)
+		return CLEAN_JOBS_ERROR_OUT_OF_MEMORY;
+
+	return CLEAN_JOBS_ERROR_NONE;
+}
+
+void clean_jobs_destroy(clean_jobs_h jobs)
+{
+	free(jobs);
+}
+
+int clean_jobs_load(clean_jobs_h jobs, const char *path)
+{
+	job_record_s records[CLEAN_JOBS_MAX];
+	jobs_header_s header;
+	FILE *fp;
+	bool valid;
+	uint32_t i;
+
+	if (!jobs || !path)
+		return CLEAN_JOBS_ERROR_INVALID_PARAMETER;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return CLEAN_JOBS_ERROR_NO_DATA;
+
+	valid = fread(&header, sizeof(header), 1, fp) == 1
+		&& header.magic == CLEAN_JOBS_MAGIC && header.version == CLEAN_JOBS_VERSION
+		&& header.count <= CLEAN_JOBS_MAX
+		&& fread(records, sizeof(records[0]), header.count, fp) == header.count
+		&& header.crc == file_crc32(records, header.count * sizeof(records[0]));
+	fclose(fp);
+
+	if (!valid)
+		return CLEAN_JOBS_ERROR_NO_DATA;
+
+	memset(jobs, 0, sizeof(*jobs));
+	for (i = 0; i < header.count; i++)
+	{
+		clean_job_s *job = &jobs->jobs[i];
+		const job_record_s *r = &records[i];
+
+		job->room_x = r->room_x;
+		job->room_y = r->room_y;
+		job->area = r->area;
+		job->suction_set = r->suction_set != 0;
+		job->suction = (rvc_suction_state_e)r->suction;
+		job->state = r->state <= CLEAN_JOB_DONE ? (clean_job_state_e)r->state : CLEAN_JOB_PENDING;
+		job->lane = r->lane > 0 ? r->lane : 0;
+		job->lane_count = r->lane_count;
+	}
+	jobs->count = header.count;
+
+	return CLEAN_JOBS_ERROR_NONE;
+}
+
+int clean_jobs_save(clean_jobs_h jobs, const char *path)
+{
+	job_record_s records[CLEAN_JOBS_MAX];
+	jobs_header_s header;
+	char tmp[512];
+	size_t size;
+	int fd, i, ret = CLEAN_JOBS_ERROR_IO;
+
+	if (!jobs || !path)
+		return CLEAN_JOBS_ERROR_INVALID_PARAMETER;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return CLEAN_JOBS_ERROR_INVALID_PARAMETER;
+
+	memset(records, 0, sizeof(records));
+	for (i = 0; i < jobs->count; i++)
+	{
+		const clean_job_s *job = &jobs->jobs[i];
+		job_record_s *r = &records[i];
+
+		r->room_x = job->room_x;
+		r->room_y = job->room_y;
+		r->area = job->area;
+		r->suction_set = job->suction_set;
+		r->suction = job->suction;
+		r->state = job->state;
+		r->lane = job->lane;
+		r->lane_count = job->lane_count;
+	}
+
+	size = jobs->count * sizeof(records[0]);
+	header.magic = CLEAN_JOBS_MAGIC;
+	header.version = CLEAN_JOBS_VERSION;
+	header.count = jobs->count;
+	header.crc = file_crc32(records, size);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return CLEAN_JOBS_ERROR_IO;
+
+	if (write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+		&& write(fd, records, size) == (ssize_t)size
+		&& fsync(fd) == 0)
+		ret = CLEAN_JOBS_ERROR_NONE;
+	close(fd);
+
+	if (ret == CLEAN_JOBS_ERROR_NONE && (rename(tmp, path) != 0 || file_fsync_dir(path) != 0))
+		ret = CLEAN_JOBS_ERROR_IO;
+	if (ret != CLEAN_JOBS_ERROR_NONE)
+		unlink(tmp);
+
+	return ret;
+}
+
+/*
+ * Finds the room of a saved job: the room its centroid lies in, or else the
+ * nearest free room whose centroid is within half the job's room size, since the
+ * centroid of a non convex room can fall outside it.
+ */
+static int
+_find_room(room_map_h map, const clean_job_s *job, const bool *taken)
+{
+	const room_s *rooms;
+	float best_d, limit = 0.5f * sqrtf(job->area);
+	int count, best = 0, i;
+	int id = room_map_room_at(map, job->room_x, job->room_y);
+
+	if (id && !taken[id])
+		return id;
+
+	room_map_get_rooms(map, &rooms, &count);
+	best_d = limit;
+	for (i = 0; i < count; i++)
+	{
+		float d = hypotf(rooms[i].x - job->room_x, rooms[i].y - job->room_y);
+
+		if (!taken[rooms[i].id] && d < best_d)
+		{
+			best = rooms[i].id;
+			best_d = d;
+		}
+	}
+
+	return best;
+}
+
+static void
+_bind(clean_job_s *job, const room_s *room, room_map_h map, float lane_spacing)
+{
+	job->room = room->id;
+	job->room_x = room->x;
+	job->room_y = room->y;
+	job->area = room->area;
+	job->lane_count = room_map_lane_count(map, room->id, lane_spacing);
+
+	if (job->lane >= job->lane_count && job->state != CLEAN_JOB_DONE)
+	{
+		// The room shrank under the resume point.
+		job->lane = job->lane_count;
+		job->state = CLEAN_JOB_DONE;
+	}
+}
+
+int clean_jobs_sync(clean_jobs_h jobs, room_map_h map, float start_x, float start_y, float lane_spacing)
+{
+	const room_s *rooms;
+	bool *taken;
+	float x = start_x, y = start_y;
+	int count, kept = 0, i, ret = CLEAN_JOBS_ERROR_NONE;
+
+	if (!jobs || !map || lane_spacing <= 0.f)
+		return CLEAN_JOBS_ERROR_INVALID_PARAMETER;
+
+	room_map_get_rooms(map, &rooms, &count);
+	taken = calloc(count + 1, sizeof(bool));
+	if (!taken)
+		return CLEAN_JOBS_ERROR_OUT_OF_MEMORY;
+
+	for (i = 0; i < jobs->count; i++)
+	{
+		clean_job_s job = jobs->jobs[i];
+		int id = _find_room(map, &job, taken);
+
+		if (!id)
+			continue;
+
+		taken[id] = true;
+		_bind(&job, room_map_get_room(map, id), map, lane_spacing);
+		jobs->jobs[kept++] = job;
+	}
+	jobs->count = kept;
+
+	if (kept > 0)
+	{
+		x = jobs->jobs[kept - 1].room_x;
+		y = jobs->jobs[kept - 1].room_y;
+	}
+
+	// New rooms, nearest first from wherever the queue leaves the robot.
+	for (;;)
+	{
+		clean_job_s *job;
+		float best_d = INFINITY;
+		int best = -1;
+
+		for (i = 0; i < count; i++)
+		{
+			float d = hypotf(rooms[i].x - x, rooms[i].y - y);
+
+			if (!taken[rooms[i].id] && d < best_d)
+			{
+				best = i;
+				best_d = d;
+			}
+		}
+		if (best < 0)
+			break;
+
+		if (jobs->count == CLEAN_JOBS_MAX)
+		{
+			ret = CLEAN_JOBS_ERROR_FULL;
+			break;
+		}
+
+		taken[rooms[best].id] = true;
+		job = &jobs->jobs[jobs->count++];
+		memset(job, 0, sizeof(*job));
+		job->state = CLEAN_JOB_PENDING;
+		_bind(job, &rooms[best], map, lane_spacing);
+		x = rooms[best].x;
+		y = rooms[best].y;
+	}
+
+	free(taken);
+
+	return ret;
+}
+
+int clean_jobs_count(clean_jobs_h jobs)
+{
+	return jobs ? jobs->count : 0;
+}
+
+clean_job_s *clean_jobs_get(clean_jobs_h jobs, int index)
+{
+	if (!jobs || index < 0 || index >= jobs->count)
+		return NULL;
+
+	return &jobs->jobs[index];
+}
+
+int clean_jobs_next(clean_jobs_h jobs)
+{
+	int i;
+
+	if (!jobs)
+		return -1;
+
+	for (i = 0; i < jobs->count; i++)
+	{
+		if (jobs->jobs[i].state != CLEAN_JOB_DONE)
+			return i;
+	}
+
+	return -1;
+}
+
+int clean_jobs_move(clean_jobs_h jobs, int from, int to)
+{
+	clean_job_s job;
+
+	if (!jobs || from < 0 || from >= jobs->count || to < 0 || to >= jobs->count)
+		return CLEAN_JOBS_ERROR_INVALID_PARAMETER;
+
+	job = jobs->jobs[from];
+	if (from < to)
+		memmove(&jobs->jobs[from], &jobs->jobs[from + 1], (to - from) * sizeof(job));
+	else
+		memmove(&jobs->jobs[to + 1], &jobs->jobs[to], (from - to) * sizeof(job));
+	jobs->jobs[to] = job;
+
+	return CLEAN_JOBS_ERROR_NONE;
+}
+
+int clean_jobs_set_suction(clean_jobs_h jobs, int room, rvc_suction_state_e suction)
+{
+	int i;
+
+	if (!jobs || room <= 0)
+		return CLEAN_JOBS_ERROR_INVALID_PARAMETER;
+
+	for (i = 0; i < jobs->count; i++)
+	{
+		if (jobs->jobs[i].room == room)
+		{
+			jobs->jobs[i].suction_set = true;
+			jobs->jobs[i].suction = suction;
+			return CLEAN_JOBS_ERROR_NONE;
+		}
+	}
+
+	return CLEAN_JOBS_ERROR_NO_DATA;
+}
+
+int clean_jobs_advance(clean_jobs_h jobs, int index, int lane)
+{
+	clean_job_s *job = clean_jobs_get(jobs, index);
+
+	if (!job || lane < 0)
+		return CLEAN_JOBS_ERROR_INVALID_PARAMETER;
+
+	job->lane = lane;
+	job->state = lane >= job->lane_count ? CLEAN_JOB_DONE : CLEAN_JOB_ACTIVE;
+
+	return CLEAN_JOBS_ERROR_NONE;
+}
+
+void clean_jobs_reset(clean_jobs_h jobs)
+{
+	int i;
+
+	if (!jobs)
+		return;
+
+	for (i = 0; i < jobs->count; i++)
+	{
+		jobs->jobs[i].state = CLEAN_JOB_PENDING;
+		jobs->jobs[i].lane = 0;
+	}
+}
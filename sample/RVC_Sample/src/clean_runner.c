@@ -0,0 +1,564 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <rvc_api.h>
+
+#include "pthread.h"
+
+#include "rvc_log.h"
+#include "room_map.h"
+#include "clean_runner.h"
+
+#define EDITS_MAX	16		// Queue edits waiting for the runner
+
+typedef enum {
+	JOBS_EXPLORE,	// Nothing mapped yet, the built-in auto cleaning is exploring
+	JOBS_RECHARGE,	// Rooms are left for after the next charge
+	JOBS_DONE,
+} jobs_result_e;
+
+typedef struct {
+	clean_runner_edit_e type;
+	float x, y;
+	int value;
+} edit_s;
+
+struct clean_runner_s {
+	clean_runner_config_s config;
+	clean_runner_env_s env;
+	clean_runner_ops_s ops;
+
+	// Flags shared with the callback threads, accessed with __atomic builtins
+	bool returning;		// Sent home with RVC_MODE_SET_DOCKING
+	bool redock;		// The docking run ended away from the dock
+	bool docked;
+	bool cleaning;		// Driving or exploring
+	bool contact;
+	bool stop;
+
+	pthread_mutex_t edit_lock;
+	edit_s edits[EDITS_MAX];
+	int edit_count;
+};
+
+void clean_runner_config_default(clean_runner_config_s *config)
+{
+	config->lane_spacing = 250.f;
+	config->body_radius = 170.f;
+	config->drive_period_us = 50000;
+	config->plan_budget_us = 20000;
+	config->drive_tolerance = 60.f;
+	config->drive_timeout_margin = 10.f;
+	config->dock_tolerance = 400.f;
+	config->explore_time_ms = 60000;
+	config->resume_charge = 0.8f;	// Top battery band of four
+	config->poll_us = 1000000;
+}
+
+static unsigned long long
+_clock_now_us(void *data)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void
+_clock_sleep_us(unsigned int us, void *data)
+{
+	usleep(us);
+}
+
+int clean_runner_create(const clean_runner_config_s *config, const clean_runner_env_s *env, const clean_runner_ops_s *ops, clean_runner_h *runner)
+{
+	struct clean_runner_s *r;
+
+	if (!config || !env || !ops || !runner || !ops->get_pose || !env->grid || !env->planner || !env->energy || !env->jobs
+			|| config->lane_spacing <= 0.f || config->drive_period_us == 0 || config->poll_us == 0)
+		return CLEAN_RUNNER_ERROR_INVALID_PARAMETER;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return CLEAN_RUNNER_ERROR_OUT_OF_MEMORY;
+
+	r->config = *config;
+	r->env = *env;
+	r->ops = *ops;
+	if (!r->ops.now_us || !r->ops.sleep_us)
+	{
+		r->ops.now_us = _clock_now_us;
+		r->ops.sleep_us = _clock_sleep_us;
+	}
+	r->docked = true;
+	pthread_mutex_init(&r->edit_lock, NULL);
+
+	*runner = r;
+
+	return CLEAN_RUNNER_ERROR_NONE;
+}
+
+void clean_runner_destroy(clean_runner_h runner)
+{
+	if (!runner)
+		return;
+
+	pthread_mutex_destroy(&runner->edit_lock);
+	free(runner);
+}
+
+void clean_runner_stop(clean_runner_h runner)
+{
+	if (runner)
+		__atomic_store_n(&runner->stop, true, __ATOMIC_RELEASE);
+}
+
+void clean_runner_contact(clean_runner_h runner)
+{
+	if (runner)
+		__atomic_store_n(&runner->contact, true, __ATOMIC_RELEASE);
+}
+
+bool clean_runner_send_home(clean_runner_h runner)
+{
+	if (!runner || __atomic_exchange_n(&runner->returning, true, __ATOMIC_ACQ_REL))
+		return false;
+
+	__atomic_store_n(&runner->redock, false, __ATOMIC_RELEASE);
+	rvc_set_mode(RVC_MODE_SET_DOCKING);
+
+	return true;
+}
+
+static bool
+_at_dock(struct clean_runner_s *r)
+{
+	float x, y, q;
+
+	r->ops.get_pose(&x, &y, &q, r->ops.data);
+
+	return hypotf(x - r->env.dock_x, y - r->env.dock_y) <= r->config.dock_tolerance;
+}
+
+bool clean_runner_arrived(clean_runner_h runner)
+{
+	if (!runner || !__atomic_load_n(&runner->returning, __ATOMIC_ACQUIRE))
+		return false;
+
+	if (!_at_dock(runner))
+	{
+		__atomic_store_n(&runner->redock, true, __ATOMIC_RELEASE);
+		return false;
+	}
+
+	return !__atomic_exchange_n(&runner->docked, true, __ATOMIC_ACQ_REL);
+}
+
+void clean_runner_charging(clean_runner_h runner)
+{
+	if (runner && __atomic_load_n(&runner->returning, __ATOMIC_ACQUIRE) && _at_dock(runner))
+		__atomic_store_n(&runner->docked, true, __ATOMIC_RELEASE);
+}
+
+clean_runner_state_e clean_runner_get_state(clean_runner_h runner)
+{
+	if (!runner || __atomic_load_n(&runner->docked, __ATOMIC_ACQUIRE))
+		return CLEAN_RUNNER_DOCKED;
+	if (__atomic_load_n(&runner->returning, __ATOMIC_ACQUIRE))
+		return CLEAN_RUNNER_RETURNING;
+	if (__atomic_load_n(&runner->cleaning, __ATOMIC_ACQUIRE))
+		return CLEAN_RUNNER_CLEANING;
+
+	return CLEAN_RUNNER_IDLE;
+}
+
+int clean_runner_edit(clean_runner_h runner, clean_runner_edit_e type, float x, float y, int value)
+{
+	int ret = CLEAN_RUNNER_ERROR_NONE;
+
+	if (!runner || (type != CLEAN_RUNNER_EDIT_SUCTION && type != CLEAN_RUNNER_EDIT_MOVE))
+		return CLEAN_RUNNER_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&runner->edit_lock);
+	if (runner->edit_count < EDITS_MAX)
+	{
+		edit_s *edit = &runner->edits[runner->edit_count++];
+
+		edit->type = type;
+		edit->x = x;
+		edit->y = y;
+		edit->value = value;
+	}
+	else
+	{
+		ret = CLEAN_RUNNER_ERROR_FULL;
+	}
+	pthread_mutex_unlock(&runner->edit_lock);
+
+	return ret;
+}
+
+static bool
+_interrupted(struct clean_runner_s *r)
+{
+	return __atomic_load_n(&r->stop, __ATOMIC_ACQUIRE) || __atomic_load_n(&r->returning, __ATOMIC_ACQUIRE);
+}
+
+int clean_runner_drive_to(clean_runner_h runner, float x, float y, float speed)
+{
+	struct clean_runner_s *r = runner;
+	float px, py, pq, timeout;
+	unsigned long long deadline;
+	clean_runner_drive_e result;
+	motion_query_s query = { .max_lin = speed };
+
+	if (!r || speed <= 0.f)
+		return CLEAN_RUNNER_DRIVE_BLOCKED;
+
+	query.grid = r->env.grid;
+	query.hazards = r->env.hazards;
+	r->ops.get_pose(&px, &py, &pq, r->ops.data);
+	timeout = 3.f * hypotf(x - px, y - py) / speed + r->config.drive_timeout_margin;
+	deadline = r->ops.now_us(r->ops.data) + (unsigned long long)(timeout * 1e6f);
+
+	for (;;)
+	{
+		unsigned long long start = r->ops.now_us(r->ops.data), elapsed;
+		motion_plan_s plan;
+
+		if (_interrupted(r))
+		{
+			result = CLEAN_RUNNER_DRIVE_ABORTED;
+			break;
+		}
+		if (__atomic_load_n(&r->contact, __ATOMIC_ACQUIRE) || start > deadline)
+		{
+			result = CLEAN_RUNNER_DRIVE_BLOCKED;
+			break;
+		}
+
+		r->ops.get_pose(&px, &py, &pq, r->ops.data);
+		if (hypotf(x - px, y - py) < r->config.drive_tolerance)
+		{
+			result = CLEAN_RUNNER_DRIVE_REACHED;
+			break;
+		}
+
+		query.x = px;
+		query.y = py;
+		query.q = pq;
+		query.goal_x = x;
+		query.goal_y = y;
+		if (motion_planner_plan(r->env.planner, &query, r->config.plan_budget_us, &plan) != MOTION_PLANNER_ERROR_NONE
+				|| !plan.valid)
+		{
+			RVC_LOG_W("no clear motion to (%.0f, %.0f)", x, y);
+			result = CLEAN_RUNNER_DRIVE_BLOCKED;
+			break;
+		}
+
+		rvc_set_lin_ang(plan.lin, plan.ang);
+		query.lin = plan.lin;
+		query.ang = plan.ang;
+		elapsed = r->ops.now_us(r->ops.data) - start;
+		if (elapsed < r->config.drive_period_us)
+			r->ops.sleep_us(r->config.drive_period_us - (unsigned int)elapsed, r->ops.data);
+	}
+
+	// Once sent home the docking run drives; a stop command would cancel it.
+	if (!__atomic_load_n(&r->returning, __ATOMIC_ACQUIRE))
+		rvc_set_lin_ang(0.f, 0.f);
+
+	return result;
+}
+
+/* Pulls both lane ends in by the body radius so the bumper stops short of the wall. */
+static void
+_inset_lane(const struct clean_runner_s *r, float *x0, float *x1)
+{
+	float dir = *x1 >= *x0 ? 1.f : -1.f;
+	float inset = r->config.body_radius;
+
+	if (fabsf(*x1 - *x0) <= 2.f * inset)
+	{
+		*x0 = *x1 = 0.5f * (*x0 + *x1);
+		return;
+	}
+
+	*x0 += dir * inset;
+	*x1 -= dir * inset;
+}
+
+static void
+_save_jobs(struct clean_runner_s *r)
+{
+	if (r->env.jobs_path && clean_jobs_save(r->env.jobs, r->env.jobs_path) != CLEAN_JOBS_ERROR_NONE)
+		RVC_LOG_W("failed to save cleaning jobs");
+}
+
+/*
+ * Sweeps the remaining lanes of job @a index. A lane blocked by a bumper or cliff
+ * contact is given up for the next one. The resume point is saved after every
+ * lane. Returns false if the job was interrupted.
+ */
+static bool
+_clean_room(struct clean_runner_s *r, room_map_h rooms, int index, const energy_choice_s *choice)
+{
+	clean_job_s *job = clean_jobs_get(r->env.jobs, index);
+	int lane;
+
+	RVC_LOG_I("cleaning room %d from lane %d of %d, suction %d at %.0f", job->room, job->lane, job->lane_count, (int)choice->suction, choice->speed);
+	rvc_set_suction_state(choice->suction);
+
+	for (lane = job->lane; lane < job->lane_count; lane++)
+	{
+		int result;
+		float x0, y0, x1, y1;
+
+		if (!room_map_get_lane(rooms, job->room, r->config.lane_spacing, lane, &x0, &y0, &x1, &y1))
+			break;
+		_inset_lane(r, &x0, &x1);
+
+		__atomic_store_n(&r->contact, false, __ATOMIC_RELEASE);
+		result = clean_runner_drive_to(r, x0, y0, choice->speed);
+		if (result == CLEAN_RUNNER_DRIVE_REACHED)
+		{
+			__atomic_store_n(&r->contact, false, __ATOMIC_RELEASE);
+			result = clean_runner_drive_to(r, x1, y1, choice->speed);
+		}
+		if (result == CLEAN_RUNNER_DRIVE_ABORTED)
+			return false;
+
+		clean_jobs_advance(r->env.jobs, index, lane + 1);
+		_save_jobs(r);
+	}
+
+	clean_jobs_advance(r->env.jobs, index, job->lane_count);
+	_save_jobs(r);
+
+	return true;
+}
+
+/*
+ * Applies the queued edits to the jobs of @a rooms.
+ */
+static void
+_apply_edits(struct clean_runner_s *r, room_map_h rooms)
+{
+	edit_s edits[EDITS_MAX];
+	int count, i, j, room, ret;
+
+	pthread_mutex_lock(&r->edit_lock);
+	count = r->edit_count;
+	memcpy(edits, r->edits, count * sizeof(edits[0]));
+	r->edit_count = 0;
+	pthread_mutex_unlock(&r->edit_lock);
+
+	for (i = 0; i < count; i++)
+	{
+		room = room_map_room_at(rooms, edits[i].x, edits[i].y);
+		if (room <= 0)
+		{
+			RVC_LOG_W("no room at (%.0f, %.0f)", edits[i].x, edits[i].y);
+			continue;
+		}
+
+		if (edits[i].type == CLEAN_RUNNER_EDIT_SUCTION)
+		{
+			ret = clean_jobs_set_suction(r->env.jobs, room, (rvc_suction_state_e)edits[i].value);
+		}
+		else
+		{
+			for (j = 0; j < clean_jobs_count(r->env.jobs) && clean_jobs_get(r->env.jobs, j)->room != room; j++)
+				;
+			ret = clean_jobs_move(r->env.jobs, j, edits[i].value);
+		}
+		if (ret != CLEAN_JOBS_ERROR_NONE)
+			RVC_LOG_W("job edit %d of room %d failed (%d)", (int)edits[i].type, room, ret);
+	}
+
+	if (count > 0)
+		_save_jobs(r);
+}
+
+/*
+ * Fills @a regions with the unfinished jobs in queue order and @a order with
+ * their job indices. Returns the number of regions.
+ */
+static int
+_queue_regions(struct clean_runner_s *r, energy_region_s *regions, int *order)
+{
+	int count = 0, i;
+
+	for (i = clean_jobs_next(r->env.jobs); i >= 0 && i < clean_jobs_count(r->env.jobs); i++)
+	{
+		const clean_job_s *job = clean_jobs_get(r->env.jobs, i);
+
+		if (job->state == CLEAN_JOB_DONE || job->lane_count == 0)
+			continue;
+
+		regions[count].area = job->area * (job->lane_count - job->lane) / job->lane_count;
+		regions[count].min_suction = job->suction_set ? job->suction : RVC_SUCTION_SLIENT;
+		regions[count].dock_distance = hypotf(job->room_x - r->env.dock_x, job->room_y - r->env.dock_y);
+		order[count++] = i;
+	}
+
+	return count;
+}
+
+/*
+ * Segments the map and cleans rooms in queue order until the next one does not
+ * fit in the charge. Sends the robot home unless it is already returning.
+ */
+static jobs_result_e
+_run_jobs(struct clean_runner_s *r)
+{
+	energy_region_s regions[CLEAN_JOBS_MAX];
+	energy_choice_s choices[CLEAN_JOBS_MAX];
+	int order[CLEAN_JOBS_MAX];
+	room_map_h rooms = NULL;
+	int count, affordable, ret;
+	jobs_result_e result;
+
+	__atomic_store_n(&r->docked, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->cleaning, true, __ATOMIC_RELEASE);
+
+	ret = room_map_build(r->env.grid, NULL, &rooms);
+	if (ret != ROOM_MAP_ERROR_NONE)
+	{
+		// Nothing mapped yet: the built-in auto cleaning explores, and the pose callback maps it.
+		RVC_LOG_I("no rooms mapped (%d), exploring", ret);
+		rvc_set_mode(RVC_MODE_SET_CLEANING_AUTO);
+		return JOBS_EXPLORE;
+	}
+
+	clean_jobs_sync(r->env.jobs, rooms, r->env.dock_x, r->env.dock_y, r->config.lane_spacing);
+	if (clean_jobs_next(r->env.jobs) < 0)
+		clean_jobs_reset(r->env.jobs);
+	_save_jobs(r);
+
+	for (;;)
+	{
+		_apply_edits(r, rooms);
+
+		count = _queue_regions(r, regions, order);
+		if (count == 0)
+		{
+			result = JOBS_DONE;
+			break;
+		}
+
+		if (energy_planner_plan(r->env.energy, regions, count, choices, &affordable) != ENERGY_PLANNER_ERROR_NONE)
+			affordable = 0;
+		RVC_LOG_I("%d rooms queued, %d affordable on the current charge", count, affordable);
+
+		// A room larger than a full charge is cleaned over several charges, as its lanes are saved.
+		if (affordable == 0 && energy_planner_get_charge(r->env.energy) >= r->config.resume_charge)
+		{
+			RVC_LOG_W("room %d does not fit in one charge", clean_jobs_get(r->env.jobs, order[0])->room);
+			affordable = 1;
+		}
+
+		if (affordable == 0 || !_clean_room(r, rooms, order[0], &choices[0]))
+		{
+			result = JOBS_RECHARGE;
+			break;
+		}
+	}
+
+	if (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE))
+		clean_runner_send_home(r);
+	__atomic_store_n(&r->cleaning, false, __ATOMIC_RELEASE);
+
+	room_map_destroy(rooms);
+
+	return result;
+}
+
+/*
+ * Lets the built-in auto cleaning explore, then pauses it. Returns false when
+ * the runner stops or the robot is sent home meanwhile.
+ */
+static bool
+_explore(struct clean_runner_s *r)
+{
+	unsigned long long waited;
+
+	for (waited = 0; waited < r->config.explore_time_ms * 1000ULL; waited += r->config.poll_us)
+	{
+		if (_interrupted(r))
+			return false;
+		r->ops.sleep_us(r->config.poll_us, r->ops.data);
+	}
+	rvc_set_mode(RVC_MODE_SET_PAUSE);
+
+	return true;
+}
+
+/*
+ * Waits on the dock until the charge reaches resume_charge, sending the robot
+ * home first if it is not on its way. Returns false when the runner stops.
+ */
+static bool
+_recharge(struct clean_runner_s *r)
+{
+	__atomic_store_n(&r->cleaning, false, __ATOMIC_RELEASE);
+	if (!__atomic_load_n(&r->docked, __ATOMIC_ACQUIRE))
+	{
+		// Also when already sent home: a motion command sent just before may have cancelled that run.
+		__atomic_store_n(&r->returning, true, __ATOMIC_RELEASE);
+		__atomic_store_n(&r->redock, false, __ATOMIC_RELEASE);
+		rvc_set_mode(RVC_MODE_SET_DOCKING);
+	}
+
+	while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE))
+	{
+		if (!__atomic_load_n(&r->docked, __ATOMIC_ACQUIRE) && __atomic_exchange_n(&r->redock, false, __ATOMIC_ACQ_REL))
+		{
+			RVC_LOG_W("docking run ended away from the dock, trying again");
+			rvc_set_mode(RVC_MODE_SET_DOCKING);
+		}
+		if (__atomic_load_n(&r->docked, __ATOMIC_ACQUIRE) && energy_planner_get_charge(r->env.energy) >= r->config.resume_charge)
+		{
+			RVC_LOG_I("charge %.2f, resuming the room queue", energy_planner_get_charge(r->env.energy));
+			__atomic_store_n(&r->returning, false, __ATOMIC_RELEASE);
+			return true;
+		}
+		r->ops.sleep_us(r->config.poll_us, r->ops.data);
+	}
+
+	return false;
+}
+
+int clean_runner_run(clean_runner_h runner)
+{
+	struct clean_runner_s *r = runner;
+
+	if (!r)
+		return CLEAN_RUNNER_ERROR_INVALID_PARAMETER;
+
+	while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE))
+	{
+		switch (_run_jobs(r))
+		{
+		case JOBS_EXPLORE:
+			if (_explore(r))
+				break;
+			// Sent home while exploring
+			if (!_recharge(r))
+				return CLEAN_RUNNER_ERROR_NONE;
+			break;
+		case JOBS_RECHARGE:
+			if (!_recharge(r))
+				return CLEAN_RUNNER_ERROR_NONE;
+			break;
+		case JOBS_DONE:
+			RVC_LOG_I("all rooms clean");
+			return CLEAN_RUNNER_ERROR_NONE;
+		}
+	}
+
+	return CLEAN_RUNNER_ERROR_NONE;
+}
@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "pthread.h"
+
+#include "energy_planner.h"
+
+/*
+ * Drain model, in charge fraction:
+ *   drain = theta[0] * t_silent + theta[1] * t_normal + theta[2] * t_turbo + theta[3] * distance
+ *         + theta[4] * t_idle
+ * fitted with recursive least squares, one sample per battery level step.
+ */
+#define MODEL_DIM	5
+#define MODEL_DIST	3
+#define MODEL_IDLE	4
+
+static const rvc_suction_state_e g_suction_states[3] = {
+	RVC_SUCTION_SLIENT, RVC_SUCTION_NORMAL, RVC_SUCTION_TURBO,
+};
+
+struct energy_planner_s {
+	energy_planner_config_s config;
+	double theta[MODEL_DIM];
+	double P[MODEL_DIM][MODEL_DIM];
+	double x[MODEL_DIM];		// Usage accumulated since the last level step
+	int level;					// Last reported level, -1 before the first reading
+	float anchor;				// Charge at the last level step
+	bool anchor_exact;			// The anchor is a level boundary rather than a guess
+	unsigned int samples;
+	pthread_mutex_t lock;
+};
+
+void energy_planner_config_default(energy_planner_config_s *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->batt_levels = 4;
+	config->swath_width = 250.f;
+	config->speed[0] = 300.f;
+	config->speed[1] = 200.f;
+	config->speed[2] = 150.f;	// Turbo pays off only when given time over the floor
+	config->dock_speed = 200.f;
+	config->reserve_margin = 0.5f;
+	config->prior_suction_drain[0] = 1.f / 14400.f;
+	config->prior_suction_drain[1] = 1.f / 9000.f;
+	config->prior_suction_drain[2] = 1.f / 4800.f;
+	config->prior_motion_drain = 1.f / (300.f * 10800.f);
+	config->prior_idle_drain = 1.f / 86400.f;
+	config->forgetting = 0.98f;
+}
+
+static int
+_suction_index(rvc_suction_state_e suction)
+{
+	if (suction == RVC_SUCTION_SLIENT)
+		return 0;
+	if (suction == RVC_SUCTION_TURBO)
+		return 2;
+
+	return 1;
+}
+
+int energy_planner_create(const energy_planner_config_s *config, energy_planner_h *planner)
+{
+	struct energy_planner_s *p;
+	int i;
+
+	if (!config || !planner || config->batt_levels <= 0 || config->swath_width <= 0.f
+			|| config->speed[0] <= 0.f || config->speed[1] <= 0.f || config->speed[2] <= 0.f)
+		return ENERGY_PLANNER_ERROR_INVALID_PARAMETER;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return ENERGY_PLANNER_ERROR_OUT_OF_MEMORY;
+
+	p->config = *config;
+	for (i = 0; i < 3; i++)
+		p->theta[i] = config->prior_suction_drain[i];
+	p->theta[MODEL_DIST] = config->prior_motion_drain;
+	p->theta[MODEL_IDLE] = config->prior_idle_drain;
+
+	// Prior covariance scaled to each parameter so early samples move it by a similar relative amount.
+	for (i = 0; i < MODEL_DIM; i++)
+		p->P[i][i] = p->theta[i] > 0.0 ? 1.0 / (p->theta[i] * 1e4) : 1.0;
+
+	p->level = -1;
+	p->anchor = 1.f;
+	pthread_mutex_init(&p->lock, NULL);
+
+	*planner = p;
+
+	return ENERGY_PLANNER_ERROR_NONE;
+}
+
+void energy_planner_destroy(energy_planner_h planner)
+{
+	if (!planner)
+		return;
+
+	pthread_mutex_destroy(&planner->lock);
+	free(planner);
+}
+
+int energy_planner_observe_motion(energy_planner_h planner, float dt, rvc_suction_state_e suction, float speed)
+{
+	if (!planner || dt < 0.f)
+		return ENERGY_PLANNER_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&planner->lock);
+	planner->x[_suction_index(suction)] += dt;
+	planner->x[MODEL_DIST] += fabsf(speed) * dt;
+	pthread_mutex_unlock(&planner->lock);
+
+	return ENERGY_PLANNER_ERROR_NONE;
+}
+
+int energy_planner_observe_idle(energy_planner_h planner, float dt)
+{
+	if (!planner || dt < 0.f)
+		return ENERGY_PLANNER_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&planner->lock);
+	planner->x[MODEL_IDLE] += dt;
+	pthread_mutex_unlock(&planner->lock);
+
+	return ENERGY_PLANNER_ERROR_NONE;
+}
+
+/* One recursive least squares step. Caller holds the lock. */
+static void
+_rls_update(struct energy_planner_s *p, const double *x, double y)
+{
+	double Px[MODEL_DIM], k[MODEL_DIM];
+	double lambda = p->config.forgetting;
+	double denom = lambda, err = y;
+	int i, j;
+
+	for (i = 0; i < MODEL_DIM; i++)
+	{
+		Px[i] = 0.0;
+		for (j = 0; j < MODEL_DIM; j++)
+			Px[i] += p->P[i][j] * x[j];
+		denom += x[i] * Px[i];
+		err -= x[i] * p->theta[i];
+	}
+
+	for (i = 0; i < MODEL_DIM; i++)
+	{
+		k[i] = Px[i] / denom;
+		p->theta[i] += k[i] * err;
+		if (p->theta[i] < 0.0)
+			p->theta[i] = 0.0;
+	}
+
+	// P = (P - k * Px^T) / lambda; P is symmetric so x^T P == Px^T.
+	for (i = 0; i < MODEL_DIM; i++)
+		for (j = 0; j < MODEL_DIM; j++)
+			p->P[i][j] = (p->P[i][j] - k[i] * Px[j]) / lambda;
+
+	p->samples++;
+}
+
+int energy_planner_observe_level(energy_planner_h planner, rvc_batt_level_e level)
+{
+	struct energy_planner_s *p = planner;
+	int l = (int)level;
+
+	if (!p || l < 0 || l >= p->config.batt_levels)
+		return ENERGY_PLANNER_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&p->lock);
+
+	if (p->level >= 0 && l < p->level)
+	{
+		// A single step between two exact boundaries drained exactly one level.
+		if (p->anchor_exact && p->level - l == 1)
+			_rls_update(p, p->x, 1.0 / p->config.batt_levels);
+
+		p->anchor = (float)(l + 1) / p->config.batt_levels;
+		p->anchor_exact = true;
+	}
+	else if (p->level < 0 || l > p->level)
+	{
+		// First reading or charging: only the band is known.
+		p->anchor = (l + 0.5f) / p->config.batt_levels;
+		p->anchor_exact = false;
+	}
+	else
+	{
+		pthread_mutex_unlock(&p->lock);
+		return ENERGY_PLANNER_ERROR_NONE;
+	}
+
+	p->level = l;
+	memset(p->x, 0, sizeof(p->x));
+
+	pthread_mutex_unlock(&p->lock);
+
+	return ENERGY_PLANNER_ERROR_NONE;
+}
+
+/* Caller holds the lock. */
+static float
+_drain(const struct energy_planner_s *p, int s, float speed)
+{
+	return (float)(p->theta[s] + p->theta[MODEL_DIST] * fabsf(speed));
+}
+
+float energy_planner_get_drain(energy_planner_h planner, rvc_suction_state_e suction, float speed)
+{
+	float drain;
+
+	if (!planner)
+		return 0.f;
+
+	pthread_mutex_lock(&planner->lock);
+	drain = _drain(planner, _suction_index(suction), speed);
+	pthread_mutex_unlock(&planner->lock);
+
+	return drain;
+}
+
+/* Caller holds the lock. */
+static float
+_charge(const struct energy_planner_s *p)
+{
+	double used = 0.0;
+	float charge;
+	int i;
+
+	for (i = 0; i < MODEL_DIM; i++)
+		used += p->theta[i] * p->x[i];
+
+	charge = p->anchor - (float)used;
+
+	// The reported level bounds the estimate.
+	if (p->level >= 0)
+	{
+		float lo = (float)p->level / p->config.batt_levels;
+		float hi = (float)(p->level + 1) / p->config.batt_levels;
+
+		charge = fmaxf(lo, fminf(hi, charge));
+	}
+
+	return fmaxf(0.f, charge);
+}
+
+float energy_planner_get_charge(energy_planner_h planner)
+{
+	float charge;
+
+	if (!planner)
+		return 0.f;
+
+	pthread_mutex_lock(&planner->lock);
+	charge = _charge(planner);
+	pthread_mutex_unlock(&planner->lock);
+
+	return charge;
+}
+
+/* Caller holds the lock. Suction is assumed at its lowest setting on the way home. */
+static float
+_dock_reserve(const struct energy_planner_s *p, float dock_distance)
+{
+	float t = dock_distance / p->config.dock_speed;
+
+	return (_drain(p, 0, p->config.dock_speed) * t) * (1.f + p->config.reserve_margin);
+}
+
+float energy_planner_get_dock_reserve(energy_planner_h planner, float dock_distance)
+{
+	float reserve;
+
+	if (!planner)
+		return 0.f;
+
+	pthread_mutex_lock(&planner->lock);
+	reserve = _dock_reserve(planner, dock_distance);
+	pthread_mutex_unlock(&planner->lock);
+
+	return reserve;
+}
+
+bool energy_planner_should_dock(energy_planner_h planner, float dock_distance)
+{
+	bool dock;
+
+	if (!planner)
+		return false;
+
+	pthread_mutex_lock(&planner->lock);
+	dock = _charge(planner) <= _dock_reserve(planner, dock_distance);
+	pthread_mutex_unlock(&planner->lock);
+
+	return dock;
+}
+
+/* Charge per unit area cleaned with suction index @a s. Caller holds the lock. */
+static float
+_per_area(const struct energy_planner_s *p, int s)
+{
+	float v = p->config.speed[s];
+
+	return _drain(p, s, v) / (v * p->config.swath_width);
+}
+
+int energy_planner_plan(energy_planner_h planner, const energy_region_s *regions, int count, energy_choice_s *choices, int *affordable)
+{
+	struct energy_planner_s *p = planner;
+	float *slack;
+	float charge, spent = 0.f;
+	int i, j, s, funded = 0;
+
+	if (!p || !regions || !choices || count < 0)
+		return ENERGY_PLANNER_ERROR_INVALID_PARAMETER;
+
+	slack = malloc((count + 1) * sizeof(*slack));
+	if (!slack)
+		return ENERGY_PLANNER_ERROR_OUT_OF_MEMORY;
+
+	pthread_mutex_lock(&p->lock);
+
+	charge = _charge(p);
+
+	// Cheapest feasible setting per region, then fund in order.
+	for (i = 0; i < count; i++)
+	{
+		energy_choice_s *c = &choices[i];
+		float best = -1.f;
+
+		c->affordable = false;
+		c->suction = RVC_SUCTION_TURBO;
+		c->speed = 0.f;
+		c->energy = 0.f;
+
+		for (s = _suction_index(regions[i].min_suction); s < 3; s++)
+		{
+			float per_area = _per_area(p, s);
+
+			if (best < 0.f || per_area < best)
+			{
+				best = per_area;
+				c->suction = g_suction_states[s];
+				c->speed = p->config.speed[s];
+			}
+		}
+
+		c->energy = best * regions[i].area;
+		if (funded == i && spent + c->energy + _dock_reserve(p, regions[i].dock_distance) <= charge)
+		{
+			spent += c->energy;
+			slack[i] = charge - spent - _dock_reserve(p, regions[i].dock_distance);
+			c->affordable = true;
+			funded++;
+		}
+	}
+
+	// Spend what is left on stronger suction, earliest regions first. Raising region i
+	// costs every later funded region the same amount, so it must fit the smallest slack.
+	for (i = 0; i < funded; i++)
+	{
+		for (s = 2; s > _suction_index(choices[i].suction); s--)
+		{
+			float delta, min_slack = slack[i];
+
+			delta = _per_area(p, s) * regions[i].area - choices[i].energy;
+			for (j = i + 1; j < funded; j++)
+				min_slack = fminf(min_slack, slack[j]);
+
+			if (delta <= min_slack)
+			{
+				choices[i].suction = g_suction_states[s];
+				choices[i].speed = p->config.speed[s];
+				choices[i].energy += delta;
+				for (j = i; j < funded; j++)
+					slack[j] -= delta;
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&p->lock);
+	free(slack);
+
+	if (affordable)
+		*affordable = funded;
+
+	return ENERGY_PLANNER_ERROR_NONE;
+}
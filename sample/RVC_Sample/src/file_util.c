@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "file_util.h"
+
+uint32_t file_crc32(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t crc = 0xffffffffu;
+	int k;
+
+	while (len--)
+	{
+		crc ^= *p++;
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+int file_fsync_dir(const char *path)
+{
+	char *copy = strdup(path);
+	int fd, ret = -1;
+
+	if (!copy)
+		return -1;
+
+	fd = open(dirname(copy), O_RDONLY);
+	if (fd >= 0)
+	{
+		ret = fsync(fd);
+		close(fd);
+	}
+	free(copy);
+
+	return ret;
+}
@@ -0,0 +1,494 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "pthread.h"
+
+#include "hazard_index.h"
+
+#define HAZARD_INDEX_MAGIC		0x5a48564eu	// "NVHZ"
+#define HAZARD_INDEX_VERSION	1u
+#define HAZARD_NIL				0xffffffffu
+#define HAZARD_MIN_BUCKETS		16u
+
+/*
+ * Block layout (all offsets relative to the start of the block):
+ *   hazard_block_s header
+ *   uint32_t       buckets[bucket_count]   head entry of each hash chain
+ *   hazard_entry_s entries[capacity]       allocated in insertion order
+ *
+ * Entries are never freed, so the entry array doubles as a bump allocated pool
+ * and chains only ever hold indices, which keeps the block relocatable.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	float cell_size;
+	uint32_t capacity;
+	uint32_t bucket_count;
+	uint32_t count;
+} hazard_block_s;
+
+typedef struct {
+	hazard_s hazard;
+	int32_t cx;
+	int32_t cy;
+	uint32_t next;
+} hazard_entry_s;
+
+struct hazard_index_s {
+	hazard_block_s *block;
+	uint32_t *buckets;
+	hazard_entry_s *entries;
+	float inv_cell;
+	bool owns_block;
+	pthread_rwlock_t lock;
+};
+
+static uint32_t
+_bucket_count_for(unsigned int capacity)
+{
+	uint32_t n = HAZARD_MIN_BUCKETS;
+
+	while (n < capacity)
+		n <<= 1;
+
+	return n;
+}
+
+size_t hazard_index_block_size(unsigned int capacity)
+{
+	return sizeof(hazard_block_s)
+		+ _bucket_count_for(capacity) * sizeof(uint32_t)
+		+ (size_t)capacity * sizeof(hazard_entry_s);
+}
+
+static inline uint32_t
+_hash(const struct hazard_index_s *index, int32_t cx, int32_t cy)
+{
+	return (((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u)) & (index->block->bucket_count - 1);
+}
+
+static inline int32_t
+_cell(const struct hazard_index_s *index, float v)
+{
+	return (int32_t)floorf(v * index->inv_cell);
+}
+
+int hazard_index_attach(void *block, size_t size, float cell_size, unsigned int capacity, bool init, hazard_index_h *index)
+{
+	struct hazard_index_s *h;
+	hazard_block_s *hdr = block;
+
+	if (!block || !index || cell_size <= 0.f || capacity == 0 || size < hazard_index_block_size(capacity))
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+
+	if (init)
+	{
+		hdr->magic = HAZARD_INDEX_MAGIC;
+		hdr->version = HAZARD_INDEX_VERSION;
+		hdr->cell_size = cell_size;
+		hdr->capacity = capacity;
+		hdr->bucket_count = _bucket_count_for(capacity);
+		hdr->count = 0;
+		memset(hdr + 1, 0xff, hdr->bucket_count * sizeof(uint32_t));
+	}
+	else if (hdr->magic != HAZARD_INDEX_MAGIC || hdr->version != HAZARD_INDEX_VERSION
+			|| hdr->capacity != capacity || hdr->cell_size != cell_size
+			|| hdr->bucket_count != _bucket_count_for(capacity) || hdr->count > capacity)
+	{
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+	}
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return HAZARD_INDEX_ERROR_OUT_OF_MEMORY;
+
+	h->block = hdr;
+	h->buckets = (uint32_t *)(hdr + 1);
+	h->entries = (hazard_entry_s *)(h->buckets + hdr->bucket_count);
+	h->inv_cell = 1.f / cell_size;
+	pthread_rwlock_init(&h->lock, NULL);
+
+	*index = h;
+
+	return HAZARD_INDEX_ERROR_NONE;
+}
+
+int hazard_index_create(float cell_size, unsigned int capacity, hazard_index_h *index)
+{
+	size_t size = hazard_index_block_size(capacity);
+	void *block;
+	int ret;
+
+	if (capacity == 0)
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+
+	block = malloc(size);
+	if (!block)
+		return HAZARD_INDEX_ERROR_OUT_OF_MEMORY;
+
+	ret = hazard_index_attach(block, size, cell_size, capacity, true, index);
+	if (ret != HAZARD_INDEX_ERROR_NONE)
+	{
+		free(block);
+		return ret;
+	}
+	(*index)->owns_block = true;
+
+	return HAZARD_INDEX_ERROR_NONE;
+}
+
+void hazard_index_destroy(hazard_index_h index)
+{
+	if (!index)
+		return;
+
+	pthread_rwlock_destroy(&index->lock);
+	if (index->owns_block)
+		free(index->block);
+	free(index);
+}
+
+int hazard_index_recover(hazard_index_h index, unsigned int count)
+{
+	uint32_t e, b;
+
+	if (!index)
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	if (count > index->block->capacity)
+		count = index->block->capacity;
+
+	// Bucket heads may reference entries past the committed count, so all
+	// chains are relinked from the surviving entries.
+	memset(index->buckets, 0xff, index->block->bucket_count * sizeof(uint32_t));
+	for (e = 0; e < count; e++)
+	{
+		hazard_entry_s *entry = &index->entries[e];
+
+		b = _hash(index, entry->cx, entry->cy);
+		entry->next = index->buckets[b];
+		index->buckets[b] = e;
+	}
+	index->block->count = count;
+
+	pthread_rwlock_unlock(&index->lock);
+
+	return HAZARD_INDEX_ERROR_NONE;
+}
+
+/* Looks for an entry of the same type within one cell of (x, y). Caller holds the lock. */
+static hazard_entry_s *
+_find_mergeable(struct hazard_index_s *index, unsigned char type, float x, float y, int32_t cx, int32_t cy)
+{
+	float limit = index->block->cell_size * index->block->cell_size;
+	int32_t i, j;
+
+	for (j = cy - 1; j <= cy + 1; j++)
+	{
+		for (i = cx - 1; i <= cx + 1; i++)
+		{
+			uint32_t e = index->buckets[_hash(index, i, j)];
+
+			for (; e != HAZARD_NIL; e = index->entries[e].next)
+			{
+				hazard_entry_s *entry = &index->entries[e];
+				float dx, dy;
+
+				if (entry->cx != i || entry->cy != j || entry->hazard.type != type)
+					continue;
+
+				dx = entry->hazard.x - x;
+				dy = entry->hazard.y - y;
+				if (dx * dx + dy * dy <= limit)
+					return entry;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+int hazard_index_insert(hazard_index_h index, hazard_type_e type, unsigned char sensor, float x, float y, unsigned int stamp)
+{
+	hazard_entry_s *entry;
+	int32_t cx, cy;
+	uint32_t e, b;
+	int ret = HAZARD_INDEX_ERROR_NONE;
+
+	if (!index || !(type & HAZARD_TYPE_ALL))
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+
+	cx = _cell(index, x);
+	cy = _cell(index, y);
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	entry = _find_mergeable(index, (unsigned char)type, x, y, cx, cy);
+	if (entry)
+	{
+		// The entry keeps its first position so it never leaves the cell it is chained in.
+		entry->hazard.sensor |= sensor;
+		entry->hazard.last_seen = stamp;
+		if (entry->hazard.hits < 0xffff)
+			entry->hazard.hits++;
+	}
+	else if (index->block->count >= index->block->capacity)
+	{
+		ret = HAZARD_INDEX_ERROR_FULL;
+	}
+	else
+	{
+		e = index->block->count;
+		b = _hash(index, cx, cy);
+
+		entry = &index->entries[e];
+		entry->hazard.x = x;
+		entry->hazard.y = y;
+		entry->hazard.type = (unsigned char)type;
+		entry->hazard.sensor = sensor;
+		entry->hazard.hits = 1;
+		entry->hazard.last_seen = stamp;
+		entry->cx = cx;
+		entry->cy = cy;
+		entry->next = index->buckets[b];
+
+		index->buckets[b] = e;
+		index->block->count = e + 1;
+	}
+
+	pthread_rwlock_unlock(&index->lock);
+
+	return ret;
+}
+
+/* Calls visit() for every entry in cells [cx0, cx1] x [cy0, cy1]. Caller holds the lock. */
+static bool
+_scan_cells(struct hazard_index_s *index, int32_t cx0, int32_t cy0, int32_t cx1, int32_t cy1,
+		unsigned int type_mask, bool (*visit)(const hazard_s *hazard, void *ctx), void *ctx)
+{
+	int32_t i, j;
+
+	for (j = cy0; j <= cy1; j++)
+	{
+		for (i = cx0; i <= cx1; i++)
+		{
+			uint32_t e = index->buckets[_hash(index, i, j)];
+
+			for (; e != HAZARD_NIL; e = index->entries[e].next)
+			{
+				const hazard_entry_s *entry = &index->entries[e];
+
+				if (entry->cx != i || entry->cy != j || !(entry->hazard.type & type_mask))
+					continue;
+
+				if (!visit(&entry->hazard, ctx))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+typedef struct {
+	float x, y;
+	float best_d2;
+	const hazard_s *best;
+} nearest_ctx_s;
+
+static bool
+_visit_nearest(const hazard_s *hazard, void *data)
+{
+	nearest_ctx_s *ctx = data;
+	float dx = hazard->x - ctx->x;
+	float dy = hazard->y - ctx->y;
+	float d2 = dx * dx + dy * dy;
+
+	if (d2 <= ctx->best_d2)
+	{
+		ctx->best_d2 = d2;
+		ctx->best = hazard;
+	}
+
+	return true;
+}
+
+int hazard_index_nearest(hazard_index_h index, float x, float y, float max_radius, unsigned int type_mask, hazard_s *hazard, float *distance)
+{
+	nearest_ctx_s ctx = { x, y, max_radius * max_radius, NULL };
+	int32_t cx, cy, ring, rings;
+	float cell;
+
+	if (!index || max_radius < 0.f)
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+
+	cell = index->block->cell_size;
+	cx = _cell(index, x);
+	cy = _cell(index, y);
+	rings = (int32_t)ceilf(max_radius * index->inv_cell);
+
+	pthread_rwlock_rdlock(&index->lock);
+
+	// Search outward ring by ring. Every cell of ring k + 1 is at least k cells away,
+	// so once the best match is closer than that the remaining rings cannot win.
+	for (ring = 0; ring <= rings; ring++)
+	{
+		if (ring == 0)
+		{
+			_scan_cells(index, cx, cy, cx, cy, type_mask, _visit_nearest, &ctx);
+		}
+		else
+		{
+			_scan_cells(index, cx - ring, cy - ring, cx + ring, cy - ring, type_mask, _visit_nearest, &ctx);
+			_scan_cells(index, cx - ring, cy + ring, cx + ring, cy + ring, type_mask, _visit_nearest, &ctx);
+			_scan_cells(index, cx - ring, cy - ring + 1, cx - ring, cy + ring - 1, type_mask, _visit_nearest, &ctx);
+			_scan_cells(index, cx + ring, cy - ring + 1, cx + ring, cy + ring - 1, type_mask, _visit_nearest, &ctx);
+		}
+
+		if (ctx.best && ctx.best_d2 <= (ring * cell) * (ring * cell))
+			break;
+	}
+
+	if (ctx.best)
+	{
+		if (hazard)
+			*hazard = *ctx.best;
+		if (distance)
+			*distance = sqrtf(ctx.best_d2);
+	}
+
+	pthread_rwlock_unlock(&index->lock);
+
+	return ctx.best ? HAZARD_INDEX_ERROR_NONE : HAZARD_INDEX_ERROR_NO_DATA;
+}
+
+typedef struct {
+	float x, y;
+	float r2;
+	hazard_s *out;
+	unsigned int max_count;
+	unsigned int count;
+} radius_ctx_s;
+
+static bool
+_visit_radius(const hazard_s *hazard, void *data)
+{
+	radius_ctx_s *ctx = data;
+	float dx = hazard->x - ctx->x;
+	float dy = hazard->y - ctx->y;
+
+	if (dx * dx + dy * dy <= ctx->r2)
+	{
+		if (ctx->count < ctx->max_count)
+			ctx->out[ctx->count] = *hazard;
+		ctx->count++;
+	}
+
+	return true;
+}
+
+int hazard_index_query_radius(hazard_index_h index, float x, float y, float radius, unsigned int type_mask, hazard_s *hazards, unsigned int max_count, unsigned int *count)
+{
+	radius_ctx_s ctx = { x, y, radius * radius, hazards, max_count, 0 };
+
+	if (!index || radius < 0.f || (!hazards && max_count) || !count)
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+
+	pthread_rwlock_rdlock(&index->lock);
+	_scan_cells(index, _cell(index, x - radius), _cell(index, y - radius),
+			_cell(index, x + radius), _cell(index, y + radius), type_mask, _visit_radius, &ctx);
+	pthread_rwlock_unlock(&index->lock);
+
+	*count = ctx.count;
+
+	return HAZARD_INDEX_ERROR_NONE;
+}
+
+typedef struct {
+	float x, y;
+	float c, s;
+	float range;
+	float half_width;
+	bool found;
+} heading_ctx_s;
+
+static bool
+_visit_heading(const hazard_s *hazard, void *data)
+{
+	heading_ctx_s *ctx = data;
+	float dx = hazard->x - ctx->x;
+	float dy = hazard->y - ctx->y;
+	float along = dx * ctx->c + dy * ctx->s;
+	float across = -dx * ctx->s + dy * ctx->c;
+
+	if (along >= 0.f && along <= ctx->range && fabsf(across) <= ctx->half_width)
+	{
+		ctx->found = true;
+		return false;
+	}
+
+	return true;
+}
+
+int hazard_index_check_heading(hazard_index_h index, float x, float y, float q, float range, float half_width, unsigned int type_mask, bool *found)
+{
+	heading_ctx_s ctx = { x, y, cosf(q), sinf(q), range, half_width, false };
+	float ex, ey, x0, y0, x1, y1;
+
+	if (!index || range < 0.f || half_width < 0.f || !found)
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+
+	// Bounding box of the corridor rectangle
+	ex = x + ctx.c * range;
+	ey = y + ctx.s * range;
+	x0 = fminf(x, ex) - half_width;
+	x1 = fmaxf(x, ex) + half_width;
+	y0 = fminf(y, ey) - half_width;
+	y1 = fmaxf(y, ey) + half_width;
+
+	pthread_rwlock_rdlock(&index->lock);
+	_scan_cells(index, _cell(index, x0), _cell(index, y0), _cell(index, x1), _cell(index, y1),
+			type_mask, _visit_heading, &ctx);
+	pthread_rwlock_unlock(&index->lock);
+
+	*found = ctx.found;
+
+	return HAZARD_INDEX_ERROR_NONE;
+}
+
+unsigned int hazard_index_count(hazard_index_h index)
+{
+	unsigned int count;
+
+	if (!index)
+		return 0;
+
+	pthread_rwlock_rdlock(&index->lock);
+	count = index->block->count;
+	pthread_rwlock_unlock(&index->lock);
+
+	return count;
+}
+
+int hazard_index_foreach(hazard_index_h index, bool (*cb)(const hazard_s *hazard, void *user_data), void *user_data)
+{
+	uint32_t e;
+
+	if (!index || !cb)
+		return HAZARD_INDEX_ERROR_INVALID_PARAMETER;
+
+	pthread_rwlock_rdlock(&index->lock);
+	for (e = 0; e < index->block->count; e++)
+	{
+		if (!cb(&index->entries[e].hazard, user_data))
+			break;
+	}
+	pthread_rwlock_unlock(&index->lock);
+
+	return HAZARD_INDEX_ERROR_NONE;
+}
@@ -0,0 +1,460 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pthread.h"
+
+#include "rvc.h"
+#include "map_store.h"
+#include "file_util.h"
+
+#define MAP_STORE_MAGIC		0x50414d52u	// "RMAP"
+#define MAP_STORE_VERSION	1u
+#define MAP_STORE_SLOT_SIZE	512
+#define MAP_STORE_ALIGN		4096
+#define MAP_STORE_UNUSABLE	1			// _map(): the file holds no map of this layout
+
+/*
+ * File layout:
+ *   [0, 512)         header slot 0
+ *   [512, 1024)      header slot 1
+ *   grid_offset      occupancy grid block
+ *   hazard_offset    hazard index block
+ *
+ * Sections start on MAP_STORE_ALIGN boundaries. Each checkpoint writes the slot
+ * not holding the current generation, so a torn header write is caught by its
+ * CRC and the older slot is used instead.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation;
+	uint32_t grid_width;
+	uint32_t grid_height;
+	float grid_resolution;
+	uint32_t hazard_capacity;
+	float hazard_cell_size;
+	uint32_t grid_offset;
+	uint32_t grid_size;
+	uint32_t hazard_offset;
+	uint32_t hazard_size;
+	uint32_t hazard_count;	// Hazard entries known to be durable
+	uint32_t clean;			// Set only by map_store_close()
+	uint32_t dock_valid;
+	float dock_x;
+	float dock_y;
+	float dock_q;
+	uint32_t crc;			// CRC32 of all preceding fields
+} map_header_s;
+
+struct map_store_s {
+	int fd;
+	unsigned char *base;
+	size_t size;
+	map_header_s header;
+	occupancy_grid_h grid;
+	hazard_index_h hazards;
+	pthread_mutex_t lock;
+};
+
+static size_t
+_align(size_t v)
+{
+	return (v + MAP_STORE_ALIGN - 1) & ~(size_t)(MAP_STORE_ALIGN - 1);
+}
+
+static void
+_layout(const map_store_config_s *config, map_header_s *header)
+{
+	memset(header, 0, sizeof(*header));
+	header->magic = MAP_STORE_MAGIC;
+	header->version = MAP_STORE_VERSION;
+	header->grid_width = config->grid_width;
+	header->grid_height = config->grid_height;
+	header->grid_resolution = config->grid_resolution;
+	header->hazard_capacity = config->hazard_capacity;
+	header->hazard_cell_size = config->hazard_cell_size;
+	header->grid_offset = MAP_STORE_ALIGN;
+	header->grid_size = occupancy_grid_block_size(config->grid_width, config->grid_height);
+	header->hazard_offset = header->grid_offset + _align(header->grid_size);
+	header->hazard_size = hazard_index_block_size(config->hazard_capacity);
+}
+
+static bool
+_slot_valid(const map_header_s *slot)
+{
+	return slot->magic == MAP_STORE_MAGIC && slot->version == MAP_STORE_VERSION
+		&& slot->crc == file_crc32(slot, offsetof(map_header_s, crc));
+}
+
+static bool
+_same_geometry(const map_header_s *a, const map_header_s *b)
+{
+	return a->grid_width == b->grid_width && a->grid_height == b->grid_height
+		&& a->grid_resolution == b->grid_resolution && a->hazard_capacity == b->hazard_capacity
+		&& a->hazard_cell_size == b->hazard_cell_size && a->grid_offset == b->grid_offset
+		&& a->hazard_offset == b->hazard_offset && a->hazard_size == b->hazard_size;
+}
+
+/* Syncs [addr, addr + len) after widening it to page boundaries. */
+static int
+_sync_range(void *addr, size_t len)
+{
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)addr & ~(page - 1);
+
+	return msync((void *)start, (uintptr_t)addr + len - start, MS_SYNC);
+}
+
+/* Writes @a header to the slot for its generation. Caller holds the lock. */
+static int
+_write_header(struct map_store_s *store, map_header_s *header)
+{
+	unsigned char *slot = store->base + (header->generation & 1) * MAP_STORE_SLOT_SIZE;
+
+	header->crc = file_crc32(header, offsetof(map_header_s, crc));
+	memcpy(slot, header, sizeof(*header));
+
+	return _sync_range(slot, sizeof(*header)) == 0 ? MAP_STORE_ERROR_NONE : MAP_STORE_ERROR_IO;
+}
+
+/*
+ * Builds an empty map in a temporary file and renames it over @a path, so a
+ * crash during creation never leaves a half formatted file behind.
+ */
+static int
+_create_file(const char *path, const map_header_s *layout)
+{
+	map_header_s header = *layout;
+	occupancy_grid_h grid = NULL;
+	hazard_index_h hazards = NULL;
+	size_t size = header.hazard_offset + _align(header.hazard_size);
+	unsigned char *base;
+	char tmp[512];
+	int fd, ret = MAP_STORE_ERROR_IO;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return MAP_STORE_ERROR_INVALID_PARAMETER;
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return MAP_STORE_ERROR_IO;
+
+	if (ftruncate(fd, size) != 0)
+		goto out_close;
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		goto out_close;
+
+	if (occupancy_grid_attach(base + header.grid_offset, header.grid_size, header.grid_width, header.grid_height,
+			header.grid_resolution, true, &grid) == OCCUPANCY_GRID_ERROR_NONE
+		&& hazard_index_attach(base + header.hazard_offset, header.hazard_size, header.hazard_cell_size,
+			header.hazard_capacity, true, &hazards) == HAZARD_INDEX_ERROR_NONE)
+	{
+		header.generation = 1;
+		header.clean = 1;
+		header.crc = file_crc32(&header, offsetof(map_header_s, crc));
+		memcpy(base + MAP_STORE_SLOT_SIZE, &header, sizeof(header));
+
+		if (msync(base, size, MS_SYNC) == 0)
+			ret = MAP_STORE_ERROR_NONE;
+	}
+
+	occupancy_grid_destroy(grid);
+	hazard_index_destroy(hazards);
+	munmap(base, size);
+
+out_close:
+	if (ret == MAP_STORE_ERROR_NONE && fsync(fd) != 0)
+		ret = MAP_STORE_ERROR_IO;
+	close(fd);
+
+	if (ret == MAP_STORE_ERROR_NONE && (rename(tmp, path) != 0 || file_fsync_dir(path) != 0))
+		ret = MAP_STORE_ERROR_IO;
+	if (ret != MAP_STORE_ERROR_NONE)
+		unlink(tmp);
+
+	return ret;
+}
+
+/*
+ * Reads both header slots and returns the newest valid one matching @a layout,
+ * MAP_STORE_UNUSABLE if there is none or MAP_STORE_ERROR_IO if reading failed.
+ */
+static int
+_read_header(int fd, const map_header_s *layout, map_header_s *header)
+{
+	map_header_s slots[2];
+	struct stat st;
+	int i, best = -1;
+
+	if (fstat(fd, &st) != 0)
+		return MAP_STORE_ERROR_IO;
+	if ((size_t)st.st_size < layout->hazard_offset + _align(layout->hazard_size))
+		return MAP_STORE_UNUSABLE;
+
+	for (i = 0; i < 2; i++)
+	{
+		ssize_t n = pread(fd, &slots[i], sizeof(slots[i]), i * MAP_STORE_SLOT_SIZE);
+
+		if (n < 0)
+			return MAP_STORE_ERROR_IO;
+		if (n != sizeof(slots[i]) || !_slot_valid(&slots[i]))
+			continue;
+		if (best < 0 || slots[i].generation > slots[best].generation)
+			best = i;
+	}
+
+	if (best < 0 || !_same_geometry(&slots[best], layout))
+		return MAP_STORE_UNUSABLE;
+
+	*header = slots[best];
+
+	return MAP_STORE_ERROR_NONE;
+}
+
+/*
+ * Maps the file at @a path. Returns MAP_STORE_UNUSABLE if it is missing or holds
+ * no valid map of @a layout, which is safe to replace, and MAP_STORE_ERROR_IO for
+ * errors that say nothing about the data, such as EACCES or a failed mmap.
+ */
+static int
+_map(struct map_store_s *store, const char *path, const map_header_s *layout)
+{
+	int ret, attach;
+
+	store->fd = open(path, O_RDWR);
+	if (store->fd < 0)
+		return errno == ENOENT ? MAP_STORE_UNUSABLE : MAP_STORE_ERROR_IO;
+
+	ret = _read_header(store->fd, layout, &store->header);
+	if (ret != MAP_STORE_ERROR_NONE)
+		goto err;
+
+	ret = MAP_STORE_ERROR_IO;
+	store->size = store->header.hazard_offset + _align(store->header.hazard_size);
+	store->base = mmap(NULL, store->size, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+	if (store->base == MAP_FAILED)
+	{
+		store->base = NULL;
+		goto err;
+	}
+
+	// The sections reject a block that does not match the header as invalid.
+	attach = occupancy_grid_attach(store->base + store->header.grid_offset, store->header.grid_size,
+			store->header.grid_width, store->header.grid_height, store->header.grid_resolution,
+			false, &store->grid);
+	if (attach != OCCUPANCY_GRID_ERROR_NONE)
+	{
+		if (attach == OCCUPANCY_GRID_ERROR_INVALID_PARAMETER)
+			ret = MAP_STORE_UNUSABLE;
+		goto err;
+	}
+
+	attach = hazard_index_attach(store->base + store->header.hazard_offset, store->header.hazard_size,
+			store->header.hazard_cell_size, store->header.hazard_capacity, false, &store->hazards);
+	if (attach != HAZARD_INDEX_ERROR_NONE)
+	{
+		if (attach == HAZARD_INDEX_ERROR_INVALID_PARAMETER)
+			ret = MAP_STORE_UNUSABLE;
+		goto err;
+	}
+
+	return MAP_STORE_ERROR_NONE;
+
+err:
+	occupancy_grid_destroy(store->grid);
+	store->grid = NULL;
+	if (store->base)
+		munmap(store->base, store->size);
+	store->base = NULL;
+	close(store->fd);
+	store->fd = -1;
+
+	return ret;
+}
+
+/* Releases a mapped store without touching its header. */
+static void
+_free_store(struct map_store_s *store)
+{
+	occupancy_grid_destroy(store->grid);
+	hazard_index_destroy(store->hazards);
+	munmap(store->base, store->size);
+	close(store->fd);
+	pthread_mutex_destroy(&store->lock);
+	free(store);
+}
+
+int map_store_open(const char *path, const map_store_config_s *config, map_store_h *store, bool *restored)
+{
+	struct map_store_s *s;
+	map_header_s layout;
+	bool loaded = true;
+	int ret;
+
+	if (!path || !config || !store)
+		return MAP_STORE_ERROR_INVALID_PARAMETER;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return MAP_STORE_ERROR_OUT_OF_MEMORY;
+
+	pthread_mutex_init(&s->lock, NULL);
+	_layout(config, &layout);
+
+	ret = _map(s, path, &layout);
+	if (ret == MAP_STORE_UNUSABLE)
+	{
+		dlog_print(DLOG_INFO, LOG_TAG, "no usable map at %s, creating a new one", path);
+		loaded = false;
+
+		ret = _create_file(path, &layout);
+		if (ret == MAP_STORE_ERROR_NONE)
+			ret = _map(s, path, &layout);
+	}
+	else if (ret != MAP_STORE_ERROR_NONE)
+	{
+		// A transient failure must not cost the saved map; leave the file alone.
+		dlog_print(DLOG_ERROR, LOG_TAG, "cannot open map at %s", path);
+	}
+
+	if (ret != MAP_STORE_ERROR_NONE)
+	{
+		pthread_mutex_destroy(&s->lock);
+		free(s);
+		return MAP_STORE_ERROR_IO;
+	}
+
+	if (!s->header.clean)
+	{
+		dlog_print(DLOG_WARN, LOG_TAG, "map was not closed cleanly, keeping %u hazards", s->header.hazard_count);
+		hazard_index_recover(s->hazards, s->header.hazard_count);
+	}
+
+	// From here on the file is in use; a crash must be detected by the next open.
+	s->header.generation++;
+	s->header.clean = 0;
+	if (_write_header(s, &s->header) != MAP_STORE_ERROR_NONE)
+	{
+		// Unmarked, a crash would leave a clean header and skip the hazard recovery.
+		dlog_print(DLOG_ERROR, LOG_TAG, "cannot mark map at %s in use", path);
+		_free_store(s);
+		return MAP_STORE_ERROR_IO;
+	}
+
+	*store = s;
+	if (restored)
+		*restored = loaded;
+
+	return MAP_STORE_ERROR_NONE;
+}
+
+static int
+_checkpoint(struct map_store_s *store, bool clean)
+{
+	map_header_s header;
+	int ret = MAP_STORE_ERROR_NONE;
+
+	pthread_mutex_lock(&store->lock);
+
+	header = store->header;
+	header.hazard_count = hazard_index_count(store->hazards);
+
+	// Data first, header last: the header never references unsynced entries.
+	if (msync(store->base + header.grid_offset, _align(header.grid_size), MS_SYNC) != 0
+			|| msync(store->base + header.hazard_offset, _align(header.hazard_size), MS_SYNC) != 0)
+	{
+		ret = MAP_STORE_ERROR_IO;
+	}
+	else
+	{
+		header.generation++;
+		header.clean = clean;
+		ret = _write_header(store, &header);
+		if (ret == MAP_STORE_ERROR_NONE)
+			store->header = header;
+	}
+
+	pthread_mutex_unlock(&store->lock);
+
+	return ret;
+}
+
+int map_store_checkpoint(map_store_h store)
+{
+	if (!store)
+		return MAP_STORE_ERROR_INVALID_PARAMETER;
+
+	return _checkpoint(store, false);
+}
+
+void map_store_close(map_store_h store)
+{
+	if (!store)
+		return;
+
+	if (_checkpoint(store, true) != MAP_STORE_ERROR_NONE)
+		dlog_print(DLOG_ERROR, LOG_TAG, "final map checkpoint failed");
+
+	_free_store(store);
+}
+
+occupancy_grid_h map_store_get_grid(map_store_h store)
+{
+	return store ? store->grid : NULL;
+}
+
+hazard_index_h map_store_get_hazards(map_store_h store)
+{
+	return store ? store->hazards : NULL;
+}
+
+int map_store_set_dock(map_store_h store, float x, float y, float q)
+{
+	if (!store)
+		return MAP_STORE_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&store->lock);
+	store->header.dock_valid = 1;
+	store->header.dock_x = x;
+	store->header.dock_y = y;
+	store->header.dock_q = q;
+	pthread_mutex_unlock(&store->lock);
+
+	return MAP_STORE_ERROR_NONE;
+}
+
+int map_store_get_dock(map_store_h store, float *x, float *y, float *q)
+{
+	int ret = MAP_STORE_ERROR_NONE;
+
+	if (!store)
+		return MAP_STORE_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&store->lock);
+	if (!store->header.dock_valid)
+	{
+		ret = MAP_STORE_ERROR_INVALID_PARAMETER;
+	}
+	else
+	{
+		if (x)
+			*x = store->header.dock_x;
+		if (y)
+			*y = store->header.dock_y;
+		if (q)
+			*q = store->header.dock_q;
+	}
+	pthread_mutex_unlock(&store->lock);
+
+	return ret;
+}
@@ -0,0 +1,679 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pthread.h"
+
+#include "motion_planner.h"
+
+#define MAX_WORKERS			16
+#define MAX_HAZARDS			256
+#define SPECIAL_CANDIDATES	3		// Current command, stop, turn toward the goal
+#define CLEAR_INF			1e9f
+
+typedef struct {
+	float lin, ang;
+	float score;
+	unsigned int index;
+	bool valid;
+} candidate_s;
+
+typedef struct {
+	pthread_mutex_t lock;
+	unsigned int lo, hi;		// Candidates not yet taken
+	candidate_s best;
+	unsigned int evaluated;
+	unsigned int steals;
+} worker_s;
+
+typedef struct {
+	struct motion_planner_s *planner;
+	int index;
+} worker_arg_s;
+
+struct motion_planner_s {
+	motion_planner_config_s config;
+	int workers;				// Including the calling thread
+	worker_s w[MAX_WORKERS];
+	worker_arg_s args[MAX_WORKERS];
+	pthread_t threads[MAX_WORKERS];
+	int started;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t idle;
+	unsigned int generation;
+	int active;
+	bool quit;
+
+	// Current plan, set up while the pool is idle
+	motion_query_s query;
+	float max_lin;
+	unsigned long long deadline;
+	float start_clearance;
+
+	// Clearance map around the robot
+	float *clear;
+	unsigned char *cells;		// Grid cells under it
+	int size;
+	int capacity;
+	float res;
+	float origin_x, origin_y;
+};
+
+void motion_planner_config_default(motion_planner_config_s *config)
+{
+	config->threads = -1;
+	config->max_candidates = 2048;
+	config->batch = 8;
+	config->horizon = 1.5f;
+	config->sim_step = 0.1f;
+	config->max_lin = 300.f;
+	config->max_ang = 1.5f;
+	config->lin_acc = 600.f;
+	config->ang_acc = 3.f;
+	config->robot_radius = 170.f;
+	config->clearance_range = 300.f;
+	config->window = 1000.f;
+	config->w_progress = 1.f;
+	config->w_heading = 0.3f;
+	config->w_clearance = 0.4f;
+	config->w_speed = 0.1f;
+}
+
+static unsigned long long
+_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static float
+_wrap(float a)
+{
+	while (a > (float)M_PI)
+		a -= 2.f * (float)M_PI;
+	while (a < -(float)M_PI)
+		a += 2.f * (float)M_PI;
+
+	return a;
+}
+
+static float
+_approach(float v, float target, float step)
+{
+	if (v < target)
+		return v + step < target ? v + step : target;
+	return v - step > target ? v - step : target;
+}
+
+static float
+_clamp(float v, float lo, float hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* Radical inverse of @a i in @a base, the Halton sequence. */
+static float
+_halton(unsigned int i, unsigned int base)
+{
+	float f = 1.f, r = 0.f;
+
+	while (i > 0)
+	{
+		f /= base;
+		r += f * (i % base);
+		i /= base;
+	}
+
+	return r;
+}
+
+/*
+ * Clearance map
+ */
+
+static bool
+_mark(struct motion_planner_s *p, float x, float y)
+{
+	int cx = (int)floorf((x - p->origin_x) / p->res);
+	int cy = (int)floorf((y - p->origin_y) / p->res);
+
+	if (cx < 0 || cy < 0 || cx >= p->size || cy >= p->size)
+		return false;
+
+	p->clear[cy * p->size + cx] = 0.f;
+
+	return true;
+}
+
+/*
+ * Builds the distance to the nearest obstacle around the robot: occupied grid
+ * cells and recorded bumper and cliff hazards, spread by a two pass chamfer.
+ */
+static bool
+_build_clearance(struct motion_planner_s *p)
+{
+	const motion_query_s *q = &p->query;
+	hazard_s hazards[MAX_HAZARDS];
+	unsigned int count = 0, i;
+	float res = 50.f, diag;
+	int half, n, x, y;
+
+	if (q->grid)
+	{
+		unsigned int w, h;
+
+		occupancy_grid_get_size(q->grid, &w, &h, &res);
+	}
+
+	half = (int)ceilf(p->config.window / res);
+	n = 2 * half + 1;
+	if (n * n > p->capacity)
+	{
+		float *clear = realloc(p->clear, (size_t)n * n * sizeof(float));
+		unsigned char *cells;
+
+		if (!clear)
+			return false;
+		p->clear = clear;
+		cells = realloc(p->cells, (size_t)n * n);
+		if (!cells)
+			return false;
+		p->cells = cells;
+		p->capacity = n * n;
+	}
+
+	p->size = n;
+	p->res = res;
+	p->origin_x = q->x - (half + 0.5f) * res;
+	p->origin_y = q->y - (half + 0.5f) * res;
+	for (i = 0; i < (unsigned int)(n * n); i++)
+		p->clear[i] = CLEAR_INF;
+
+	if (q->grid)
+	{
+		int cx, cy;
+
+		// The map has the same cell size, so the window is a block of grid cells.
+		occupancy_grid_world_to_cell(q->grid, p->origin_x + 0.5f * res, p->origin_y + 0.5f * res, &cx, &cy);
+		occupancy_grid_copy(q->grid, cx, cy, n, n, p->cells);
+		for (i = 0; i < (unsigned int)(n * n); i++)
+		{
+			if (p->cells[i] == OCCUPANCY_OCCUPIED)
+				p->clear[i] = 0.f;
+		}
+	}
+
+	if (q->hazards && hazard_index_query_radius(q->hazards, q->x, q->y, p->config.window * (float)M_SQRT2,
+			HAZARD_TYPE_BUMPER | HAZARD_TYPE_CLIFF, hazards, MAX_HAZARDS, &count) == HAZARD_INDEX_ERROR_NONE)
+	{
+		if (count > MAX_HAZARDS)
+			count = MAX_HAZARDS;
+		for (i = 0; i < count; i++)
+			_mark(p, hazards[i].x, hazards[i].y);
+	}
+
+	diag = res * (float)M_SQRT2;
+	for (y = 0; y < n; y++)
+	{
+		for (x = 0; x < n; x++)
+		{
+			float *c = &p->clear[y * n + x];
+
+			if (x > 0 && c[-1] + res < *c)
+				*c = c[-1] + res;
+			if (y > 0)
+			{
+				if (c[-n] + res < *c)
+					*c = c[-n] + res;
+				if (x > 0 && c[-n - 1] + diag < *c)
+					*c = c[-n - 1] + diag;
+				if (x + 1 < n && c[-n + 1] + diag < *c)
+					*c = c[-n + 1] + diag;
+			}
+		}
+	}
+	for (y = n - 1; y >= 0; y--)
+	{
+		for (x = n - 1; x >= 0; x--)
+		{
+			float *c = &p->clear[y * n + x];
+
+			if (x + 1 < n && c[1] + res < *c)
+				*c = c[1] + res;
+			if (y + 1 < n)
+			{
+				if (c[n] + res < *c)
+					*c = c[n] + res;
+				if (x + 1 < n && c[n + 1] + diag < *c)
+					*c = c[n + 1] + diag;
+				if (x > 0 && c[n - 1] + diag < *c)
+					*c = c[n - 1] + diag;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Interpolates between cell centers, so the clearance keeps shrinking while the
+ * robot creeps toward an obstacle within one cell.
+ */
+static float
+_clearance(const struct motion_planner_s *p, float x, float y)
+{
+	float u = (x - p->origin_x) / p->res - 0.5f, v = (y - p->origin_y) / p->res - 0.5f;
+	int n = p->size, x0, y0, x1, y1;
+	const float *c = p->clear;
+	float fu, fv;
+
+	// Outside the map nothing is known, and the horizon rarely gets there.
+	if (u < -0.5f || v < -0.5f || u > n - 0.5f || v > n - 0.5f)
+		return CLEAR_INF;
+
+	x0 = (int)floorf(u);
+	y0 = (int)floorf(v);
+	fu = u - x0;
+	fv = v - y0;
+	x1 = x0 + 1 < n ? x0 + 1 : n - 1;
+	y1 = y0 + 1 < n ? y0 + 1 : n - 1;
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+
+	return (1.f - fv) * ((1.f - fu) * c[y0 * n + x0] + fu * c[y0 * n + x1])
+		+ fv * ((1.f - fu) * c[y1 * n + x0] + fu * c[y1 * n + x1]);
+}
+
+/*
+ * Candidates
+ */
+
+static void
+_candidate(const struct motion_planner_s *p, unsigned int index, float *lin, float *ang)
+{
+	const motion_query_s *q = &p->query;
+	float max_ang = p->config.max_ang;
+
+	switch (index)
+	{
+	case 0:
+		*lin = _clamp(q->lin, 0.f, p->max_lin);
+		*ang = _clamp(q->ang, -max_ang, max_ang);
+		break;
+	case 1:
+		*lin = 0.f;
+		*ang = 0.f;
+		break;
+	case 2:
+		*lin = 0.f;
+		*ang = _wrap(atan2f(q->goal_y - q->y, q->goal_x - q->x) - q->q) >= 0.f ? max_ang : -max_ang;
+		break;
+	default:
+		*lin = _halton(index - SPECIAL_CANDIDATES + 1, 2) * p->max_lin;
+		*ang = (2.f * _halton(index - SPECIAL_CANDIDATES + 1, 3) - 1.f) * max_ang;
+		break;
+	}
+}
+
+/*
+ * Simulates one candidate from the current pose and command. Returns false if it
+ * runs into an obstacle; moving away from one the robot already touches is fine.
+ */
+static bool
+_evaluate(const struct motion_planner_s *p, float target_lin, float target_ang, float *score)
+{
+	const motion_planner_config_s *cfg = &p->config;
+	const motion_query_s *q = &p->query;
+	int steps = (int)(cfg->horizon / cfg->sim_step + 0.5f), s;
+	float x = q->x, y = q->y, th = q->q, lin = q->lin, ang = q->ang, dt = cfg->sim_step;
+	float prev = p->start_clearance, min_clear = p->start_clearance;
+	float reach = p->max_lin * cfg->horizon;
+	float d0, d1, progress, heading, clearance;
+
+	for (s = 0; s < steps; s++)
+	{
+		float mid, c;
+
+		lin = _approach(lin, target_lin, cfg->lin_acc * dt);
+		ang = _approach(ang, target_ang, cfg->ang_acc * dt);
+		mid = th + 0.5f * ang * dt;
+		x += lin * dt * cosf(mid);
+		y += lin * dt * sinf(mid);
+		th += ang * dt;
+
+		c = _clearance(p, x, y);
+		if (c < cfg->robot_radius && c < prev)
+			return false;
+		prev = c;
+		if (c < min_clear)
+			min_clear = c;
+	}
+
+	d0 = hypotf(q->goal_x - q->x, q->goal_y - q->y);
+	d1 = hypotf(q->goal_x - x, q->goal_y - y);
+	progress = (d0 - d1) / reach;
+	// The final heading matters less the closer the goal, and not at all on it.
+	heading = cosf(_wrap(atan2f(q->goal_y - y, q->goal_x - x) - th)) * _clamp(d1 / reach, 0.f, 1.f);
+	clearance = _clamp((min_clear - cfg->robot_radius) / cfg->clearance_range, 0.f, 1.f);
+
+	*score = cfg->w_progress * progress + cfg->w_heading * heading
+		+ cfg->w_clearance * clearance + cfg->w_speed * target_lin / cfg->max_lin;
+
+	return true;
+}
+
+static bool
+_better(const candidate_s *a, const candidate_s *b)
+{
+	if (!b->valid)
+		return a->valid;
+	if (!a->valid)
+		return false;
+	if (a->score != b->score)
+		return a->score > b->score;
+	return a->index < b->index;
+}
+
+/*
+ * Work stealing
+ */
+
+static bool
+_take(struct motion_planner_s *p, int self, unsigned int *lo, unsigned int *hi)
+{
+	worker_s *w = &p->w[self];
+	bool found = false;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->lo < w->hi)
+	{
+		*lo = w->lo;
+		*hi = w->hi - w->lo > (unsigned int)p->config.batch ? w->lo + p->config.batch : w->hi;
+		w->lo = *hi;
+		found = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return found;
+}
+
+/* Moves the upper half of the largest range left to @a self. Only one worker lock is held at a time. */
+static bool
+_steal(struct motion_planner_s *p, int self)
+{
+	unsigned int lo = 0, hi = 0;
+	int tries;
+
+	for (tries = 0; tries < p->workers; tries++)
+	{
+		unsigned int best_left = 0;
+		int victim = -1, i;
+
+		for (i = 1; i < p->workers; i++)
+		{
+			int v = (self + i) % p->workers;
+			unsigned int left = __atomic_load_n(&p->w[v].hi, __ATOMIC_RELAXED) - __atomic_load_n(&p->w[v].lo, __ATOMIC_RELAXED);
+
+			if ((int)left > 0 && left > best_left)
+			{
+				best_left = left;
+				victim = v;
+			}
+		}
+		if (victim < 0)
+			return false;
+
+		pthread_mutex_lock(&p->w[victim].lock);
+		if (p->w[victim].hi > p->w[victim].lo)
+		{
+			unsigned int left = p->w[victim].hi - p->w[victim].lo;
+
+			hi = p->w[victim].hi;
+			lo = left > (unsigned int)p->config.batch ? p->w[victim].lo + left / 2 : p->w[victim].lo;
+			p->w[victim].hi = lo;
+		}
+		pthread_mutex_unlock(&p->w[victim].lock);
+
+		if (lo < hi)
+		{
+			pthread_mutex_lock(&p->w[self].lock);
+			p->w[self].lo = lo;
+			p->w[self].hi = hi;
+			p->w[self].steals++;
+			pthread_mutex_unlock(&p->w[self].lock);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+_work(struct motion_planner_s *p, int self)
+{
+	worker_s *w = &p->w[self];
+	// The caller always finishes one batch, so a late start still has a plan.
+	bool first = self == 0;
+
+	while (first || _now_us() < p->deadline)
+	{
+		candidate_s best = { .valid = false };
+		unsigned int lo, hi, i;
+
+		if (!_take(p, self, &lo, &hi))
+		{
+			if (!_steal(p, self) || !_take(p, self, &lo, &hi))
+				break;
+		}
+
+		for (i = lo; i < hi; i++)
+		{
+			candidate_s c;
+
+			_candidate(p, i, &c.lin, &c.ang);
+			c.index = i;
+			c.valid = _evaluate(p, c.lin, c.ang, &c.score);
+			if (_better(&c, &best))
+				best = c;
+		}
+
+		first = false;
+		pthread_mutex_lock(&w->lock);
+		w->evaluated += hi - lo;
+		if (_better(&best, &w->best))
+			w->best = best;
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+static void *
+_worker_main(void *data)
+{
+	worker_arg_s *arg = data;
+	struct motion_planner_s *p = arg->planner;
+	unsigned int seen = 0;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&p->lock);
+		while (!p->quit && p->generation == seen)
+			pthread_cond_wait(&p->start, &p->lock);
+		if (p->quit)
+		{
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		seen = p->generation;
+		pthread_mutex_unlock(&p->lock);
+
+		_work(p, arg->index);
+
+		pthread_mutex_lock(&p->lock);
+		if (--p->active == 0)
+			pthread_cond_broadcast(&p->idle);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	return NULL;
+}
+
+int motion_planner_create(const motion_planner_config_s *config, motion_planner_h *planner)
+{
+	struct motion_planner_s *p;
+	pthread_condattr_t attr;
+	int threads, i;
+
+	if (!config || !planner || config->max_candidates <= SPECIAL_CANDIDATES || config->batch <= 0
+			|| config->horizon <= 0.f || config->sim_step <= 0.f || config->max_lin <= 0.f || config->max_ang <= 0.f
+			|| config->clearance_range <= 0.f || config->window <= 0.f)
+		return MOTION_PLANNER_ERROR_INVALID_PARAMETER;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return MOTION_PLANNER_ERROR_OUT_OF_MEMORY;
+
+	p->config = *config;
+
+	threads = config->threads;
+	if (threads < 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (threads < 0)
+		threads = 0;
+	if (threads > MAX_WORKERS - 1)
+		threads = MAX_WORKERS - 1;
+	p->workers = threads + 1;
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->idle, &attr);
+	pthread_condattr_destroy(&attr);
+	for (i = 0; i < p->workers; i++)
+		pthread_mutex_init(&p->w[i].lock, NULL);
+
+	for (i = 1; i < p->workers; i++)
+	{
+		p->args[i].planner = p;
+		p->args[i].index = i;
+		if (pthread_create(&p->threads[i], NULL, _worker_main, &p->args[i]) != 0)
+		{
+			motion_planner_destroy(p);
+			return MOTION_PLANNER_ERROR_THREAD;
+		}
+		p->started = i;
+	}
+
+	*planner = p;
+
+	return MOTION_PLANNER_ERROR_NONE;
+}
+
+void motion_planner_destroy(motion_planner_h planner)
+{
+	int i;
+
+	if (!planner)
+		return;
+
+	pthread_mutex_lock(&planner->lock);
+	planner->quit = true;
+	pthread_cond_broadcast(&planner->start);
+	pthread_mutex_unlock(&planner->lock);
+
+	for (i = 1; i <= planner->started; i++)
+		pthread_join(planner->threads[i], NULL);
+
+	for (i = 0; i < planner->workers; i++)
+		pthread_mutex_destroy(&planner->w[i].lock);
+	pthread_cond_destroy(&planner->start);
+	pthread_cond_destroy(&planner->idle);
+	pthread_mutex_destroy(&planner->lock);
+	free(planner->clear);
+	free(planner->cells);
+	free(planner);
+}
+
+int motion_planner_plan(motion_planner_h planner, const motion_query_s *query, unsigned int budget_us, motion_plan_s *plan)
+{
+	struct motion_planner_s *p = planner;
+	unsigned int total;
+	candidate_s best = { .valid = false };
+	struct timespec until;
+	int i;
+
+	if (!p || !query || !plan)
+		return MOTION_PLANNER_ERROR_INVALID_PARAMETER;
+
+	// Workers that overran the last deadline finish their batch first.
+	pthread_mutex_lock(&p->lock);
+	while (p->active > 0)
+		pthread_cond_wait(&p->idle, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+
+	p->deadline = _now_us() + budget_us;
+	p->query = *query;
+	p->max_lin = query->max_lin > 0.f && query->max_lin < p->config.max_lin ? query->max_lin : p->config.max_lin;
+	if (!_build_clearance(p))
+		return MOTION_PLANNER_ERROR_OUT_OF_MEMORY;
+	p->start_clearance = _clearance(p, query->x, query->y);
+
+	total = p->config.max_candidates;
+	for (i = 0; i < p->workers; i++)
+	{
+		worker_s *w = &p->w[i];
+
+		w->lo = (unsigned int)((unsigned long long)total * i / p->workers);
+		w->hi = (unsigned int)((unsigned long long)total * (i + 1) / p->workers);
+		w->best.valid = false;
+		w->evaluated = 0;
+		w->steals = 0;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->active = p->workers - 1;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	_work(p, 0);
+
+	// Out of work early: give the workers until the deadline to finish their batches.
+	until.tv_sec = p->deadline / 1000000ULL;
+	until.tv_nsec = (p->deadline % 1000000ULL) * 1000;
+	pthread_mutex_lock(&p->lock);
+	while (p->active > 0 && _now_us() < p->deadline)
+		pthread_cond_timedwait(&p->idle, &p->lock, &until);
+	pthread_mutex_unlock(&p->lock);
+
+	memset(plan, 0, sizeof(*plan));
+	for (i = 0; i < p->workers; i++)
+	{
+		worker_s *w = &p->w[i];
+
+		pthread_mutex_lock(&w->lock);
+		if (_better(&w->best, &best))
+			best = w->best;
+		plan->evaluated += w->evaluated;
+		plan->steals += w->steals;
+		pthread_mutex_unlock(&w->lock);
+	}
+
+	plan->valid = best.valid;
+	if (best.valid)
+	{
+		plan->lin = best.lin;
+		plan->ang = best.ang;
+		plan->score = best.score;
+	}
+
+	return MOTION_PLANNER_ERROR_NONE;
+}
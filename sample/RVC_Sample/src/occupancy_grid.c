@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "pthread.h"
+
+#include "occupancy_grid.h"
+
+#define OCCUPANCY_GRID_MAGIC	0x5a47564eu	// "NVGZ"
+#define OCCUPANCY_GRID_VERSION	1u
+
+/*
+ * Block layout: occupancy_block_s header followed by width * height cells, row major.
+ * The grid is centered on the pose origin, so cell (width / 2, height / 2) holds (0, 0).
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	float resolution;
+	uint32_t reserved;
+} occupancy_block_s;
+
+struct occupancy_grid_s {
+	occupancy_block_s *block;
+	unsigned char *cells;
+	float inv_resolution;
+	float origin_x;
+	float origin_y;
+	bool owns_block;
+	pthread_rwlock_t lock;
+};
+
+size_t occupancy_grid_block_size(unsigned int width, unsigned int height)
+{
+	return sizeof(occupancy_block_s) + (size_t)width * height;
+}
+
+int occupancy_grid_attach(void *block, size_t size, unsigned int width, unsigned int height, float resolution, bool init, occupancy_grid_h *grid)
+{
+	struct occupancy_grid_s *g;
+	occupancy_block_s *hdr = block;
+
+	if (!block || !grid || width == 0 || height == 0 || resolution <= 0.f || size < occupancy_grid_block_size(width, height))
+		return OCCUPANCY_GRID_ERROR_INVALID_PARAMETER;
+
+	if (init)
+	{
+		hdr->magic = OCCUPANCY_GRID_MAGIC;
+		hdr->version = OCCUPANCY_GRID_VERSION;
+		hdr->width = width;
+		hdr->height = height;
+		hdr->resolution = resolution;
+		hdr->reserved = 0;
+		memset(hdr + 1, OCCUPANCY_UNKNOWN, (size_t)width * height);
+	}
+	else if (hdr->magic != OCCUPANCY_GRID_MAGIC || hdr->version != OCCUPANCY_GRID_VERSION
+			|| hdr->width != width || hdr->height != height || hdr->resolution != resolution)
+	{
+		return OCCUPANCY_GRID_ERROR_INVALID_PARAMETER;
+	}
+
+	g = calloc(1, sizeof(*g));
+	if (!g)
+		return OCCUPANCY_GRID_ERROR_OUT_OF_MEMORY;
+
+	g->block = hdr;
+	g->cells = (unsigned char *)(hdr + 1);
+	g->inv_resolution = 1.f / resolution;
+	g->origin_x = -0.5f * width * resolution;
+	g->origin_y = -0.5f * height * resolution;
+	pthread_rwlock_init(&g->lock, NULL);
+
+	*grid = g;
+
+	return OCCUPANCY_GRID_ERROR_NONE;
+}
+
+int occupancy_grid_create(unsigned int width, unsigned int height, float resolution, occupancy_grid_h *grid)
+{
+	size_t size = occupancy_grid_block_size(width, height);
+	void *block;
+	int ret;
+
+	if (width == 0 || height == 0)
+		return OCCUPANCY_GRID_ERROR_INVALID_PARAMETER;
+
+	block = malloc(size);
+	if (!block)
+		return OCCUPANCY_GRID_ERROR_OUT_OF_MEMORY;
+
+	ret = occupancy_grid_attach(block, size, width, height, resolution, true, grid);
+	if (ret != OCCUPANCY_GRID_ERROR_NONE)
+	{
+		free(block);
+		return ret;
+	}
+	(*grid)->owns_block = true;
+
+	return OCCUPANCY_GRID_ERROR_NONE;
+}
+
+void occupancy_grid_destroy(occupancy_grid_h grid)
+{
+	if (!grid)
+		return;
+
+	pthread_rwlock_destroy(&grid->lock);
+	if (grid->owns_block)
+		free(grid->block);
+	free(grid);
+}
+
+int occupancy_grid_get_size(occupancy_grid_h grid, unsigned int *width, unsigned int *height, float *resolution)
+{
+	if (!grid)
+		return OCCUPANCY_GRID_ERROR_INVALID_PARAMETER;
+
+	if (width)
+		*width = grid->block->width;
+	if (height)
+		*height = grid->block->height;
+	if (resolution)
+		*resolution = grid->block->resolution;
+
+	return OCCUPANCY_GRID_ERROR_NONE;
+}
+
+int occupancy_grid_world_to_cell(occupancy_grid_h grid, float x, float y, int *cx, int *cy)
+{
+	int i, j;
+
+	if (!grid || !cx || !cy)
+		return OCCUPANCY_GRID_ERROR_INVALID_PARAMETER;
+
+	i = (int)floorf((x - grid->origin_x) * grid->inv_resolution);
+	j = (int)floorf((y - grid->origin_y) * grid->inv_resolution);
+
+	*cx = i;
+	*cy = j;
+
+	if (i < 0 || j < 0 || i >= (int)grid->block->width || j >= (int)grid->block->height)
+		return OCCUPANCY_GRID_ERROR_OUT_OF_RANGE;
+
+	return OCCUPANCY_GRID_ERROR_NONE;
+}
+
+void occupancy_grid_cell_to_world(occupancy_grid_h grid, int cx, int cy, float *x, float *y)
+{
+	if (x)
+		*x = grid->origin_x + (cx + 0.5f) * grid->block->resolution;
+	if (y)
+		*y = grid->origin_y + (cy + 0.5f) * grid->block->resolution;
+}
+
+occupancy_state_e occupancy_grid_get(occupancy_grid_h grid, int cx, int cy)
+{
+	occupancy_state_e state;
+
+	if (!grid || cx < 0 || cy < 0 || cx >= (int)grid->block->width || cy >= (int)grid->block->height)
+		return OCCUPANCY_UNKNOWN;
+
+	pthread_rwlock_rdlock(&grid->lock);
+	state = (occupancy_state_e)grid->cells[(size_t)cy * grid->block->width + cx];
+	pthread_rwlock_unlock(&grid->lock);
+
+	return state;
+}
+
+int occupancy_grid_copy(occupancy_grid_h grid, int cx, int cy, unsigned int width, unsigned int height, unsigned char *cells)
+{
+	long x0, x1, y;
+
+	if (!grid || !cells)
+		return OCCUPANCY_GRID_ERROR_INVALID_PARAMETER;
+
+	// Columns of the window that fall inside the grid
+	x0 = cx < 0 ? 0 : cx;
+	x1 = (long)cx + width;
+	if (x1 > (long)grid->block->width)
+		x1 = grid->block->width;
+
+	memset(cells, OCCUPANCY_UNKNOWN, (size_t)width * height);
+
+	pthread_rwlock_rdlock(&grid->lock);
+	for (y = cy < 0 ? 0 : cy; y < (long)cy + (long)height && y < (long)grid->block->height; y++)
+	{
+		if (x0 < x1)
+			memcpy(cells + (size_t)(y - cy) * width + (x0 - cx), grid->cells + (size_t)y * grid->block->width + x0, x1 - x0);
+	}
+	pthread_rwlock_unlock(&grid->lock);
+
+	return OCCUPANCY_GRID_ERROR_NONE;
+}
+
+int occupancy_grid_mark_free(occupancy_grid_h grid, float x, float y, float radius)
+{
+	int cx0, cy0, cx1, cy1, i, j;
+	float r2 = radius * radius;
+
+	if (!grid || radius < 0.f)
+		return OCCUPANCY_GRID_ERROR_INVALID_PARAMETER;
+
+	occupancy_grid_world_to_cell(grid, x - radius, y - radius, &cx0, &cy0);
+	occupancy_grid_world_to_cell(grid, x + radius, y + radius, &cx1, &cy1);
+
+	if (cx0 < 0)
+		cx0 = 0;
+	if (cy0 < 0)
+		cy0 = 0;
+	if (cx1 >= (int)grid->block->width)
+		cx1 = grid->block->width - 1;
+	if (cy1 >= (int)grid->block->height)
+		cy1 = grid->block->height - 1;
+
+	pthread_rwlock_wrlock(&grid->lock);
+	for (j = cy0; j <= cy1; j++)
+	{
+		unsigned char *row = grid->cells + (size_t)j * grid->block->width;
+
+		for (i = cx0; i <= cx1; i++)
+		{
+			float wx, wy;
+
+			if (row[i] != OCCUPANCY_UNKNOWN)
+				continue;
+
+			occupancy_grid_cell_to_world(grid, i, j, &wx, &wy);
+			if ((wx - x) * (wx - x) + (wy - y) * (wy - y) <= r2)
+				row[i] = OCCUPANCY_FREE;
+		}
+	}
+	pthread_rwlock_unlock(&grid->lock);
+
+	return OCCUPANCY_GRID_ERROR_NONE;
+}
+
+int occupancy_grid_mark_occupied(occupancy_grid_h grid, float x, float y)
+{
+	int cx, cy, ret;
+
+	ret = occupancy_grid_world_to_cell(grid, x, y, &cx, &cy);
+	if (ret != OCCUPANCY_GRID_ERROR_NONE)
+		return ret;
+
+	pthread_rwlock_wrlock(&grid->lock);
+	grid->cells[(size_t)cy * grid->block->width + cx] = OCCUPANCY_OCCUPIED;
+	pthread_rwlock_unlock(&grid->lock);
+
+	return OCCUPANCY_GRID_ERROR_NONE;
+}
@@ -0,0 +1,1062 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pthread.h"
+
+#include "pose_graph.h"
+
+#define INPUT_QUEUE_SIZE	256
+#define MAX_CG_ITERATIONS	50
+#define CONVERGED_XY		0.1		// Steps below this leave the estimate settled
+#define CONVERGED_Q			1e-4
+
+typedef enum {
+	INPUT_NODE,
+	INPUT_OBSERVE,
+	INPUT_DOCK,
+} input_kind_e;
+
+typedef struct {
+	input_kind_e kind;
+	int type;
+	double p[3];		// Raw pose of a node, sensor offset of an observation
+	double odo;			// Distance travelled up to a node
+	double rot;			// Rotation accumulated up to a node
+} input_s;
+
+typedef struct {
+	double raw[3];
+	double est[3];
+	double odo;
+	double rot;
+	bool prior;
+	double prior_pose[3];
+} node_s;
+
+typedef struct {
+	int type;
+	double x, y;
+	unsigned int count;
+} landmark_s;
+
+typedef struct {
+	int node;
+	int landmark;
+	double ox, oy;
+	double w, j0, j1;	// Weight and heading Jacobian from the last linearization
+} observation_s;
+
+struct pose_graph_s {
+	pose_graph_config_s config;
+
+	// Input side, shared with the callbacks
+	pthread_mutex_t input_lock;
+	input_s queue[INPUT_QUEUE_SIZE];
+	int queue_head;
+	int queue_count;
+	bool has_pose;
+	bool pose_queued;	// The latest pose already is a queued node
+	double last_pose[3];
+	double odo, rot;
+	double key_odo, key_rot;
+	bool has_dock;
+	double dock[3];
+	pose_graph_stats_s stats;
+
+	// Solver side, owned by pose_graph_optimize()
+	node_s *nodes;
+	int node_count;
+	landmark_s *landmarks;
+	int landmark_count;
+	observation_s *observations;
+	int observation_count;
+	unsigned int dropped;
+	bool dirty;
+	double *D;			// Diagonal 3x3 blocks of the node Hessian
+	double *U;			// Blocks coupling node i to node i + 1
+	double *Sinv;		// Inverted pivots of the chain factorization
+	double *C;			// Landmark Hessian, a multiple of the identity
+	double *g, *x, *r, *z, *p, *Ap;
+	double error;
+
+	// Published correction: raw odometry to corrected pose
+	unsigned int seq;
+	float tx, ty, tq;
+};
+
+void pose_graph_config_default(pose_graph_config_s *config)
+{
+	config->keyframe_distance = 200.f;
+	config->keyframe_angle = 0.3f;
+	config->odom_sigma_xy = 5.f;
+	config->odom_sigma_xy_per_dist = 0.02f;
+	config->odom_sigma_q = 0.005f;
+	config->odom_sigma_q_per_dist = 2e-5f;	// About a degree per meter
+	config->odom_sigma_q_per_rot = 0.02f;
+	config->dock_sigma_xy = 20.f;
+	config->dock_sigma_q = 0.05f;
+	config->landmark_sigma[POSE_GRAPH_LANDMARK_MAGNET] = 40.f;	// About the width of the magnet sensor
+	config->landmark_sigma[POSE_GRAPH_LANDMARK_BUMPER] = 60.f;
+	config->landmark_radius[POSE_GRAPH_LANDMARK_MAGNET] = 100.f;	// Strips are lines: only a crossing at the same spot is the same point
+	config->landmark_radius[POSE_GRAPH_LANDMARK_BUMPER] = 150.f;
+	config->huber = 2.f;
+	config->max_nodes = 2048;
+	config->max_landmarks = 256;
+	config->max_observations = 2048;
+}
+
+static double
+_wrap(double a)
+{
+	while (a > M_PI)
+		a -= 2.0 * M_PI;
+	while (a < -M_PI)
+		a += 2.0 * M_PI;
+
+	return a;
+}
+
+static unsigned long long
+_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* out = a^-1 * b, pose b in the frame of pose a. */
+static void
+_relative(const double *a, const double *b, double *out)
+{
+	double c = cos(a[2]), s = sin(a[2]);
+	double dx = b[0] - a[0], dy = b[1] - a[1];
+
+	out[0] = c * dx + s * dy;
+	out[1] = -s * dx + c * dy;
+	out[2] = _wrap(b[2] - a[2]);
+}
+
+/* out = a * b, pose b given in the frame of pose a. */
+static void
+_compose(const double *a, const double *b, double *out)
+{
+	double c = cos(a[2]), s = sin(a[2]);
+	double x = a[0] + c * b[0] - s * b[1];
+	double y = a[1] + s * b[0] + c * b[1];
+
+	out[0] = x;
+	out[1] = y;
+	out[2] = a[2] + b[2];
+}
+
+int pose_graph_create(const pose_graph_config_s *config, pose_graph_h *graph)
+{
+	struct pose_graph_s *g;
+	size_t n, vars;
+
+	if (!config || !graph || config->max_nodes < 4 || config->max_landmarks < 0 || config->max_observations < 0
+			|| config->keyframe_distance <= 0.f || config->odom_sigma_xy <= 0.f || config->odom_sigma_q <= 0.f
+			|| config->dock_sigma_xy <= 0.f || config->dock_sigma_q <= 0.f)
+		return POSE_GRAPH_ERROR_INVALID_PARAMETER;
+
+	g = calloc(1, sizeof(*g));
+	if (!g)
+		return POSE_GRAPH_ERROR_OUT_OF_MEMORY;
+
+	pthread_mutex_init(&g->input_lock, NULL);
+	g->config = *config;
+	n = config->max_nodes;
+	vars = 3 * n + 2 * (size_t)config->max_landmarks;
+
+	g->nodes = calloc(n, sizeof(node_s));
+	g->landmarks = calloc(config->max_landmarks + 1, sizeof(landmark_s));
+	g->observations = calloc(config->max_observations + 1, sizeof(observation_s));
+	g->D = malloc(9 * n * sizeof(double));
+	g->U = malloc(9 * n * sizeof(double));
+	g->Sinv = malloc(9 * n * sizeof(double));
+	g->C = malloc((config->max_landmarks + 1) * sizeof(double));
+	g->g = malloc(vars * sizeof(double));
+	g->x = malloc(vars * sizeof(double));
+	g->r = malloc(vars * sizeof(double));
+	g->z = malloc(vars * sizeof(double));
+	g->p = malloc(vars * sizeof(double));
+	g->Ap = malloc(vars * sizeof(double));
+	if (!g->nodes || !g->landmarks || !g->observations || !g->D || !g->U || !g->Sinv || !g->C
+			|| !g->g || !g->x || !g->r || !g->z || !g->p || !g->Ap)
+	{
+		pose_graph_destroy(g);
+		return POSE_GRAPH_ERROR_OUT_OF_MEMORY;
+	}
+
+	*graph = g;
+
+	return POSE_GRAPH_ERROR_NONE;
+}
+
+void pose_graph_destroy(pose_graph_h graph)
+{
+	if (!graph)
+		return;
+
+	pthread_mutex_destroy(&graph->input_lock);
+	free(graph->nodes);
+	free(graph->landmarks);
+	free(graph->observations);
+	free(graph->D);
+	free(graph->U);
+	free(graph->Sinv);
+	free(graph->C);
+	free(graph->g);
+	free(graph->x);
+	free(graph->r);
+	free(graph->z);
+	free(graph->p);
+	free(graph->Ap);
+	free(graph);
+}
+
+int pose_graph_set_dock(pose_graph_h graph, float x, float y, float q)
+{
+	if (!graph)
+		return POSE_GRAPH_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&graph->input_lock);
+	graph->dock[0] = x;
+	graph->dock[1] = y;
+	graph->dock[2] = q;
+	graph->has_dock = true;
+	pthread_mutex_unlock(&graph->input_lock);
+
+	return POSE_GRAPH_ERROR_NONE;
+}
+
+/*
+ * Input queue
+ */
+
+/* Caller holds the input lock. */
+static bool
+_push(struct pose_graph_s *g, const input_s *input)
+{
+	if (g->queue_count == INPUT_QUEUE_SIZE)
+	{
+		g->stats.dropped++;
+		return false;
+	}
+
+	g->queue[(g->queue_head + g->queue_count) % INPUT_QUEUE_SIZE] = *input;
+	g->queue_count++;
+
+	return true;
+}
+
+/* Queues the latest pose as a keyframe. Caller holds the input lock. */
+static bool
+_push_keyframe(struct pose_graph_s *g)
+{
+	input_s input;
+
+	if (g->pose_queued)
+		return true;
+
+	input.kind = INPUT_NODE;
+	input.type = 0;
+	memcpy(input.p, g->last_pose, sizeof(input.p));
+	input.odo = g->odo;
+	input.rot = g->rot;
+	if (!_push(g, &input))
+		return false;
+
+	g->key_odo = g->odo;
+	g->key_rot = g->rot;
+	g->pose_queued = true;
+
+	return true;
+}
+
+int pose_graph_add_pose(pose_graph_h graph, float x, float y, float q)
+{
+	struct pose_graph_s *g = graph;
+
+	if (!g)
+		return POSE_GRAPH_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&g->input_lock);
+
+	if (g->has_pose)
+	{
+		double step = hypot(x - g->last_pose[0], y - g->last_pose[1]);
+		double turn = fabs(_wrap(q - g->last_pose[2]));
+
+		if (step > 0.0 || turn > 0.0)
+			g->pose_queued = false;
+		g->odo += step;
+		g->rot += turn;
+	}
+	else
+	{
+		g->pose_queued = false;
+	}
+	g->last_pose[0] = x;
+	g->last_pose[1] = y;
+	g->last_pose[2] = q;
+
+	if (!g->has_pose || g->odo - g->key_odo >= g->config.keyframe_distance || g->rot - g->key_rot >= g->config.keyframe_angle)
+		_push_keyframe(g);
+	g->has_pose = true;
+
+	pthread_mutex_unlock(&g->input_lock);
+
+	return POSE_GRAPH_ERROR_NONE;
+}
+
+static int
+_observe(struct pose_graph_s *g, input_kind_e kind, int type, float offset_x, float offset_y)
+{
+	input_s input;
+	int ret = POSE_GRAPH_ERROR_NONE;
+
+	pthread_mutex_lock(&g->input_lock);
+
+	// An observation belongs to the pose it was made at, so that pose becomes a keyframe.
+	if (!g->has_pose)
+	{
+		g->stats.dropped++;
+		ret = POSE_GRAPH_ERROR_FULL;
+	}
+	else if (!_push_keyframe(g))
+	{
+		ret = POSE_GRAPH_ERROR_FULL;
+	}
+	else
+	{
+		memset(&input, 0, sizeof(input));
+		input.kind = kind;
+		input.type = type;
+		input.p[0] = offset_x;
+		input.p[1] = offset_y;
+		if (!_push(g, &input))
+			ret = POSE_GRAPH_ERROR_FULL;
+	}
+
+	pthread_mutex_unlock(&g->input_lock);
+
+	return ret;
+}
+
+int pose_graph_observe(pose_graph_h graph, pose_graph_landmark_e type, float offset_x, float offset_y)
+{
+	if (!graph || type < 0 || type >= POSE_GRAPH_LANDMARK_TYPE_MAX)
+		return POSE_GRAPH_ERROR_INVALID_PARAMETER;
+
+	return _observe(graph, INPUT_OBSERVE, type, offset_x, offset_y);
+}
+
+int pose_graph_observe_dock(pose_graph_h graph)
+{
+	if (!graph)
+		return POSE_GRAPH_ERROR_INVALID_PARAMETER;
+
+	return _observe(graph, INPUT_DOCK, 0, 0.f, 0.f);
+}
+
+/*
+ * Graph building
+ */
+
+/*
+ * Drops every other keyframe of the older half of the graph. Odometry edges are
+ * rebuilt from the raw poses, so only observations need to move: each goes to the
+ * next kept keyframe with its sensor offset carried over in the current estimate.
+ */
+static void
+_thin(struct pose_graph_s *g)
+{
+	int *remap = (int *)g->z;	// Solver scratch, free between steps and large enough
+	int n = g->node_count, half = n / 2, kept = 0, i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (i == 0 || i >= half || (i & 1) == 0 || g->nodes[i].prior)
+			remap[i] = kept++;
+		else
+			remap[i] = -1;
+	}
+
+	for (i = 0; i < g->observation_count; i++)
+	{
+		observation_s *o = &g->observations[i];
+		double sensor[3] = { 0.0, 0.0, 0.0 }, world[3], local[3];
+		int k;
+
+		if (remap[o->node] >= 0)
+			continue;
+
+		// The newer half is kept whole, so a kept keyframe always follows.
+		for (k = o->node + 1; remap[k] < 0; k++)
+			;
+
+		sensor[0] = o->ox;
+		sensor[1] = o->oy;
+		_compose(g->nodes[o->node].est, sensor, world);
+		_relative(g->nodes[k].est, world, local);
+		o->ox = local[0];
+		o->oy = local[1];
+		o->node = k;
+	}
+	for (i = 0; i < g->observation_count; i++)
+		g->observations[i].node = remap[g->observations[i].node];
+
+	for (i = 0; i < n; i++)
+	{
+		if (remap[i] >= 0)
+			g->nodes[remap[i]] = g->nodes[i];
+	}
+	g->node_count = kept;
+}
+
+static void
+_add_node(struct pose_graph_s *g, const input_s *input)
+{
+	node_s *node;
+
+	if (g->node_count == g->config.max_nodes)
+		_thin(g);
+
+	node = &g->nodes[g->node_count];
+	memset(node, 0, sizeof(*node));
+	memcpy(node->raw, input->p, sizeof(node->raw));
+	node->odo = input->odo;
+	node->rot = input->rot;
+
+	if (g->node_count == 0)
+	{
+		// The first keyframe anchors the graph where odometry starts.
+		memcpy(node->est, node->raw, sizeof(node->est));
+		node->prior = true;
+		memcpy(node->prior_pose, node->raw, sizeof(node->prior_pose));
+	}
+	else
+	{
+		// Carry the latest correction over to the new keyframe.
+		const node_s *last = &g->nodes[g->node_count - 1];
+		double delta[3];
+
+		_relative(last->raw, node->raw, delta);
+		_compose(last->est, delta, node->est);
+	}
+
+	g->node_count++;
+}
+
+static void
+_add_observation(struct pose_graph_s *g, const input_s *input)
+{
+	double sensor[3] = { input->p[0], input->p[1], 0.0 }, world[3];
+	float radius = g->config.landmark_radius[input->type];
+	observation_s *o;
+	int best = -1, i;
+	double best_d = radius;
+
+	if (g->node_count == 0 || g->observation_count == g->config.max_observations)
+	{
+		g->dropped++;
+		return;
+	}
+
+	_compose(g->nodes[g->node_count - 1].est, sensor, world);
+
+	for (i = 0; i < g->landmark_count; i++)
+	{
+		const landmark_s *l = &g->landmarks[i];
+		double d;
+
+		if (l->type != input->type)
+			continue;
+		d = hypot(l->x - world[0], l->y - world[1]);
+		if (d < best_d)
+		{
+			best = i;
+			best_d = d;
+		}
+	}
+
+	if (best < 0)
+	{
+		if (g->landmark_count == g->config.max_landmarks)
+		{
+			g->dropped++;
+			return;
+		}
+		best = g->landmark_count++;
+		g->landmarks[best].type = input->type;
+		g->landmarks[best].x = world[0];
+		g->landmarks[best].y = world[1];
+		g->landmarks[best].count = 0;
+	}
+
+	g->landmarks[best].count++;
+
+	o = &g->observations[g->observation_count++];
+	memset(o, 0, sizeof(*o));
+	o->node = g->node_count - 1;
+	o->landmark = best;
+	o->ox = input->p[0];
+	o->oy = input->p[1];
+
+	// A first sighting only places the landmark; the second one closes a loop.
+	if (g->landmarks[best].count > 1)
+		g->dirty = true;
+}
+
+static void
+_add_dock(struct pose_graph_s *g, const double *dock)
+{
+	node_s *node;
+
+	if (g->node_count == 0)
+	{
+		g->dropped++;
+		return;
+	}
+
+	node = &g->nodes[g->node_count - 1];
+	node->prior = true;
+	memcpy(node->prior_pose, dock, sizeof(node->prior_pose));
+	g->dirty = true;
+}
+
+/*
+ * Linear algebra on 3x3 row major blocks
+ */
+
+/* out += Ja^T * diag(w) * Jb for 3x3 Jacobians. */
+static void
+_add_jtwj(double *out, const double *Ja, const double *Jb, const double *w)
+{
+	int i, j, k;
+
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			for (k = 0; k < 3; k++)
+				out[i * 3 + j] += Ja[k * 3 + i] * w[k] * Jb[k * 3 + j];
+}
+
+/* out += J^T * diag(w) * e. */
+static void
+_add_jtwe(double *out, const double *J, const double *w, const double *e)
+{
+	int i, k;
+
+	for (i = 0; i < 3; i++)
+		for (k = 0; k < 3; k++)
+			out[i] += J[k * 3 + i] * w[k] * e[k];
+}
+
+static bool
+_inv3(const double *m, double *out)
+{
+	double det = m[0] * (m[4] * m[8] - m[5] * m[7])
+		- m[1] * (m[3] * m[8] - m[5] * m[6])
+		+ m[2] * (m[3] * m[7] - m[4] * m[6]);
+
+	if (!(fabs(det) > 1e-300))
+		return false;
+
+	out[0] = (m[4] * m[8] - m[5] * m[7]) / det;
+	out[1] = (m[2] * m[7] - m[1] * m[8]) / det;
+	out[2] = (m[1] * m[5] - m[2] * m[4]) / det;
+	out[3] = (m[5] * m[6] - m[3] * m[8]) / det;
+	out[4] = (m[0] * m[8] - m[2] * m[6]) / det;
+	out[5] = (m[2] * m[3] - m[0] * m[5]) / det;
+	out[6] = (m[3] * m[7] - m[4] * m[6]) / det;
+	out[7] = (m[1] * m[6] - m[0] * m[7]) / det;
+	out[8] = (m[0] * m[4] - m[1] * m[3]) / det;
+
+	return true;
+}
+
+/* out = m * v, or m^T * v. */
+static void
+_mul3(const double *m, const double *v, double *out, bool transpose)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		if (transpose)
+			out[i] = m[i] * v[0] + m[3 + i] * v[1] + m[6 + i] * v[2];
+		else
+			out[i] = m[i * 3] * v[0] + m[i * 3 + 1] * v[1] + m[i * 3 + 2] * v[2];
+	}
+}
+
+/*
+ * Solver
+ */
+
+static int
+_var_count(const struct pose_graph_s *g)
+{
+	return 3 * g->node_count + 2 * g->landmark_count;
+}
+
+/* Builds the normal equations H dx = -g around the current estimate. */
+static void
+_linearize(struct pose_graph_s *g)
+{
+	const pose_graph_config_s *cfg = &g->config;
+	int n = g->node_count, i;
+	double *gl = g->g + 3 * n;
+
+	memset(g->D, 0, 9 * n * sizeof(double));
+	memset(g->U, 0, 9 * n * sizeof(double));
+	memset(g->C, 0, g->landmark_count * sizeof(double));
+	memset(g->g, 0, _var_count(g) * sizeof(double));
+	g->error = 0.0;
+
+	for (i = 0; i < n; i++)
+	{
+		const node_s *node = &g->nodes[i];
+		double wxy = 1.0 / ((double)cfg->dock_sigma_xy * cfg->dock_sigma_xy);
+		double w[3] = { wxy, wxy, 1.0 / ((double)cfg->dock_sigma_q * cfg->dock_sigma_q) };
+		double e[3];
+		int k;
+
+		if (!node->prior)
+			continue;
+
+		e[0] = node->est[0] - node->prior_pose[0];
+		e[1] = node->est[1] - node->prior_pose[1];
+		e[2] = _wrap(node->est[2] - node->prior_pose[2]);
+		for (k = 0; k < 3; k++)
+		{
+			g->D[9 * i + 4 * k] += w[k];
+			g->g[3 * i + k] += w[k] * e[k];
+			g->error += w[k] * e[k] * e[k];
+		}
+	}
+
+	// Odometry edges between consecutive keyframes.
+	for (i = 1; i < n; i++)
+	{
+		const node_s *a = &g->nodes[i - 1], *b = &g->nodes[i];
+		double dist = b->odo - a->odo, rot = b->rot - a->rot;
+		double sxy = cfg->odom_sigma_xy + cfg->odom_sigma_xy_per_dist * dist;
+		double sq = cfg->odom_sigma_q + cfg->odom_sigma_q_per_dist * dist + cfg->odom_sigma_q_per_rot * rot;
+		double w[3] = { 1.0 / (sxy * sxy), 1.0 / (sxy * sxy), 1.0 / (sq * sq) };
+		double c = cos(a->est[2]), s = sin(a->est[2]);
+		double dx = b->est[0] - a->est[0], dy = b->est[1] - a->est[1];
+		double z[3], e[3];
+		double Ja[9] = {
+			-c, -s, -s * dx + c * dy,
+			s, -c, -c * dx - s * dy,
+			0, 0, -1,
+		};
+		double Jb[9] = {
+			c, s, 0,
+			-s, c, 0,
+			0, 0, 1,
+		};
+
+		_relative(a->raw, b->raw, z);
+		e[0] = c * dx + s * dy - z[0];
+		e[1] = -s * dx + c * dy - z[1];
+		e[2] = _wrap(b->est[2] - a->est[2] - z[2]);
+
+		_add_jtwj(g->D + 9 * (i - 1), Ja, Ja, w);
+		_add_jtwj(g->D + 9 * i, Jb, Jb, w);
+		_add_jtwj(g->U + 9 * (i - 1), Ja, Jb, w);
+		_add_jtwe(g->g + 3 * (i - 1), Ja, w, e);
+		_add_jtwe(g->g + 3 * i, Jb, w, e);
+		g->error += w[0] * e[0] * e[0] + w[1] * e[1] * e[1] + w[2] * e[2] * e[2];
+	}
+
+	// Landmark observations, with a Huber weight against wrong associations.
+	for (i = 0; i < g->observation_count; i++)
+	{
+		observation_s *o = &g->observations[i];
+		const node_s *node = &g->nodes[o->node];
+		const landmark_s *l = &g->landmarks[o->landmark];
+		double sigma = cfg->landmark_sigma[l->type];
+		double c = cos(node->est[2]), s = sin(node->est[2]);
+		double e0 = node->est[0] + c * o->ox - s * o->oy - l->x;
+		double e1 = node->est[1] + s * o->ox + c * o->oy - l->y;
+		double norm = sqrt(e0 * e0 + e1 * e1) / sigma;
+		double w = 1.0 / (sigma * sigma);
+		double *D = g->D + 9 * o->node, *gn = g->g + 3 * o->node;
+
+		if (norm > cfg->huber)
+			w *= cfg->huber / norm;
+
+		o->w = w;
+		o->j0 = -s * o->ox - c * o->oy;
+		o->j1 = c * o->ox - s * o->oy;
+
+		D[0] += w;
+		D[2] += w * o->j0;
+		D[4] += w;
+		D[5] += w * o->j1;
+		D[6] += w * o->j0;
+		D[7] += w * o->j1;
+		D[8] += w * (o->j0 * o->j0 + o->j1 * o->j1);
+		gn[0] += w * e0;
+		gn[1] += w * e1;
+		gn[2] += w * (o->j0 * e0 + o->j1 * e1);
+		g->C[o->landmark] += w;
+		gl[2 * o->landmark] -= w * e0;
+		gl[2 * o->landmark + 1] -= w * e1;
+		g->error += w * (e0 * e0 + e1 * e1);
+	}
+}
+
+/* Factors the odometry chain, the block tridiagonal part of H, for the preconditioner. */
+static bool
+_factor(struct pose_graph_s *g)
+{
+	int i;
+
+	if (!_inv3(g->D, g->Sinv))
+		return false;
+
+	for (i = 1; i < g->node_count; i++)
+	{
+		const double *Up = g->U + 9 * (i - 1), *Sp = g->Sinv + 9 * (i - 1);
+		double S[9], T[9];
+		int r, c, k;
+
+		// S_i = D_i - U_{i-1}^T S_{i-1}^-1 U_{i-1}
+		for (r = 0; r < 3; r++)
+			for (c = 0; c < 3; c++)
+			{
+				T[r * 3 + c] = 0.0;
+				for (k = 0; k < 3; k++)
+					T[r * 3 + c] += Sp[r * 3 + k] * Up[k * 3 + c];
+			}
+		for (r = 0; r < 3; r++)
+			for (c = 0; c < 3; c++)
+			{
+				S[r * 3 + c] = g->D[9 * i + r * 3 + c];
+				for (k = 0; k < 3; k++)
+					S[r * 3 + c] -= Up[k * 3 + r] * T[k * 3 + c];
+			}
+
+		if (!_inv3(S, g->Sinv + 9 * i))
+			return false;
+	}
+
+	return true;
+}
+
+/* out = M^-1 v: exact solve of the odometry chain, landmarks on their own. */
+static void
+_precondition(const struct pose_graph_s *g, const double *v, double *out)
+{
+	int n = g->node_count, i, k;
+
+	memcpy(out, v, 3 * n * sizeof(double));
+	for (i = 1; i < n; i++)
+	{
+		double t[3], u[3];
+
+		_mul3(g->Sinv + 9 * (i - 1), out + 3 * (i - 1), t, false);
+		_mul3(g->U + 9 * (i - 1), t, u, true);
+		for (k = 0; k < 3; k++)
+			out[3 * i + k] -= u[k];
+	}
+	for (i = n - 1; i >= 0; i--)
+	{
+		double y[3], t[3];
+
+		memcpy(y, out + 3 * i, sizeof(y));
+		if (i < n - 1)
+		{
+			_mul3(g->U + 9 * i, out + 3 * (i + 1), t, false);
+			for (k = 0; k < 3; k++)
+				y[k] -= t[k];
+		}
+		_mul3(g->Sinv + 9 * i, y, out + 3 * i, false);
+	}
+
+	for (i = 0; i < g->landmark_count; i++)
+	{
+		double c = g->C[i] > 0.0 ? 1.0 / g->C[i] : 0.0;
+
+		out[3 * n + 2 * i] = v[3 * n + 2 * i] * c;
+		out[3 * n + 2 * i + 1] = v[3 * n + 2 * i + 1] * c;
+	}
+}
+
+/* out = H v */
+static void
+_multiply(const struct pose_graph_s *g, const double *v, double *out)
+{
+	int n = g->node_count, i, k;
+	const double *vl = v + 3 * n;
+	double *ol = out + 3 * n;
+
+	for (i = 0; i < n; i++)
+	{
+		double t[3];
+
+		_mul3(g->D + 9 * i, v + 3 * i, out + 3 * i, false);
+		if (i < n - 1)
+		{
+			_mul3(g->U + 9 * i, v + 3 * (i + 1), t, false);
+			for (k = 0; k < 3; k++)
+				out[3 * i + k] += t[k];
+		}
+		if (i > 0)
+		{
+			_mul3(g->U + 9 * (i - 1), v + 3 * (i - 1), t, true);
+			for (k = 0; k < 3; k++)
+				out[3 * i + k] += t[k];
+		}
+	}
+
+	for (i = 0; i < g->landmark_count; i++)
+	{
+		ol[2 * i] = g->C[i] * vl[2 * i];
+		ol[2 * i + 1] = g->C[i] * vl[2 * i + 1];
+	}
+
+	// Node-landmark blocks: -w J^T and its transpose.
+	for (i = 0; i < g->observation_count; i++)
+	{
+		const observation_s *o = &g->observations[i];
+		const double *vn = v + 3 * o->node, *vm = vl + 2 * o->landmark;
+		double *on = out + 3 * o->node, *om = ol + 2 * o->landmark;
+
+		on[0] -= o->w * vm[0];
+		on[1] -= o->w * vm[1];
+		on[2] -= o->w * (o->j0 * vm[0] + o->j1 * vm[1]);
+		om[0] -= o->w * (vn[0] + o->j0 * vn[2]);
+		om[1] -= o->w * (vn[1] + o->j1 * vn[2]);
+	}
+}
+
+static double
+_dot(const double *a, const double *b, int n)
+{
+	double sum = 0.0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+/*
+ * Preconditioned conjugate gradients on H x = -g, stopped at @a deadline.
+ * Every iterate lowers the quadratic model, so an early stop still gives a usable step.
+ */
+static void
+_solve(struct pose_graph_s *g, unsigned long long deadline)
+{
+	int vars = _var_count(g), it, i;
+	double rz, r0;
+
+	for (i = 0; i < vars; i++)
+	{
+		g->x[i] = 0.0;
+		g->r[i] = -g->g[i];
+	}
+	_precondition(g, g->r, g->z);
+	memcpy(g->p, g->z, vars * sizeof(double));
+	rz = _dot(g->r, g->z, vars);
+	r0 = rz;
+
+	for (it = 0; it < MAX_CG_ITERATIONS && rz > 1e-12 * r0 && rz > 0.0; it++)
+	{
+		double pAp, alpha, beta, rz_next;
+
+		_multiply(g, g->p, g->Ap);
+		pAp = _dot(g->p, g->Ap, vars);
+		if (!(pAp > 0.0))
+			break;
+
+		alpha = rz / pAp;
+		for (i = 0; i < vars; i++)
+		{
+			g->x[i] += alpha * g->p[i];
+			g->r[i] -= alpha * g->Ap[i];
+		}
+
+		if (_now_us() >= deadline)
+			break;
+
+		_precondition(g, g->r, g->z);
+		rz_next = _dot(g->r, g->z, vars);
+		beta = rz_next / rz;
+		rz = rz_next;
+		for (i = 0; i < vars; i++)
+			g->p[i] = g->z[i] + beta * g->p[i];
+	}
+}
+
+/* Applies the step in x. Returns true if it was small enough to call the estimate settled. */
+static bool
+_apply(struct pose_graph_s *g)
+{
+	int n = g->node_count, i;
+	bool settled = true;
+
+	for (i = 0; i < n; i++)
+	{
+		double *est = g->nodes[i].est, *dx = g->x + 3 * i;
+
+		est[0] += dx[0];
+		est[1] += dx[1];
+		est[2] = _wrap(est[2] + dx[2]);
+		if (fabs(dx[0]) > CONVERGED_XY || fabs(dx[1]) > CONVERGED_XY || fabs(dx[2]) > CONVERGED_Q)
+			settled = false;
+	}
+
+	for (i = 0; i < g->landmark_count; i++)
+	{
+		g->landmarks[i].x += g->x[3 * n + 2 * i];
+		g->landmarks[i].y += g->x[3 * n + 2 * i + 1];
+	}
+
+	return settled;
+}
+
+/* Publishes the correction of the newest keyframe under the sequence counter. */
+static void
+_publish(struct pose_graph_s *g)
+{
+	const node_s *last = &g->nodes[g->node_count - 1];
+	double tq = _wrap(last->est[2] - last->raw[2]);
+	double c = cos(tq), s = sin(tq);
+	float tx = last->est[0] - (c * last->raw[0] - s * last->raw[1]);
+	float ty = last->est[1] - (s * last->raw[0] + c * last->raw[1]);
+	float q = tq;
+
+	// Single writer: an odd count marks the update in progress.
+	__atomic_store_n(&g->seq, g->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store(&g->tx, &tx, __ATOMIC_RELAXED);
+	__atomic_store(&g->ty, &ty, __ATOMIC_RELAXED);
+	__atomic_store(&g->tq, &q, __ATOMIC_RELAXED);
+	__atomic_store_n(&g->seq, g->seq + 1, __ATOMIC_RELEASE);
+}
+
+int pose_graph_optimize(pose_graph_h graph, unsigned int budget_us)
+{
+	struct pose_graph_s *g = graph;
+	input_s inputs[INPUT_QUEUE_SIZE];
+	const node_s *last;
+	unsigned long long deadline = _now_us() + budget_us;
+	double dock[3];
+	bool has_dock;
+	int count, i, steps = 0;
+
+	if (!g)
+		return POSE_GRAPH_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&g->input_lock);
+	count = g->queue_count;
+	for (i = 0; i < count; i++)
+		inputs[i] = g->queue[(g->queue_head + i) % INPUT_QUEUE_SIZE];
+	g->queue_head = (g->queue_head + count) % INPUT_QUEUE_SIZE;
+	g->queue_count = 0;
+	has_dock = g->has_dock;
+	memcpy(dock, g->dock, sizeof(dock));
+	pthread_mutex_unlock(&g->input_lock);
+
+	for (i = 0; i < count; i++)
+	{
+		switch (inputs[i].kind)
+		{
+		case INPUT_NODE:
+			_add_node(g, &inputs[i]);
+			break;
+		case INPUT_OBSERVE:
+			_add_observation(g, &inputs[i]);
+			break;
+		case INPUT_DOCK:
+			if (has_dock)
+				_add_dock(g, dock);
+			break;
+		}
+	}
+
+	if (g->node_count == 0)
+		return POSE_GRAPH_ERROR_NONE;
+
+	while (g->dirty && (steps == 0 || _now_us() < deadline))
+	{
+		_linearize(g);
+		if (!_factor(g))
+		{
+			g->dirty = false;
+			break;
+		}
+		_solve(g, deadline);
+		if (_apply(g))
+			g->dirty = false;
+		steps++;
+	}
+
+	last = &g->nodes[g->node_count - 1];
+	if (steps > 0)
+		_linearize(g);	// Refreshes the error for the stats
+	if (steps > 0 || count > 0)
+		_publish(g);
+
+	pthread_mutex_lock(&g->input_lock);
+	g->stats.nodes = g->node_count;
+	g->stats.landmarks = g->landmark_count;
+	g->stats.observations = g->observation_count;
+	g->stats.dropped += g->dropped;
+	g->stats.iterations += steps;
+	if (steps > 0)
+		g->stats.error = g->error;
+	g->stats.correction = hypot(last->est[0] - last->raw[0], last->est[1] - last->raw[1]);
+	pthread_mutex_unlock(&g->input_lock);
+	g->dropped = 0;
+
+	return POSE_GRAPH_ERROR_NONE;
+}
+
+void pose_graph_correct(pose_graph_h graph, float *x, float *y, float *q)
+{
+	unsigned int seq;
+	float tx, ty, tq, c, s, rx, ry;
+
+	if (!graph || !x || !y || !q)
+		return;
+
+	do
+	{
+		seq = __atomic_load_n(&graph->seq, __ATOMIC_ACQUIRE);
+		__atomic_load(&graph->tx, &tx, __ATOMIC_RELAXED);
+		__atomic_load(&graph->ty, &ty, __ATOMIC_RELAXED);
+		__atomic_load(&graph->tq, &tq, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&graph->seq, __ATOMIC_RELAXED));
+
+	c = cosf(tq);
+	s = sinf(tq);
+	rx = *x;
+	ry = *y;
+	*x = c * rx - s * ry + tx;
+	*y = s * rx + c * ry + ty;
+	*q += tq;
+}
+
+int pose_graph_get_stats(pose_graph_h graph, pose_graph_stats_s *stats)
+{
+	if (!graph || !stats)
+		return POSE_GRAPH_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&graph->input_lock);
+	*stats = graph->stats;
+	pthread_mutex_unlock(&graph->input_lock);
+
+	return POSE_GRAPH_ERROR_NONE;
+}
@@ -0,0 +1,968 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pthread.h"
+
+#include "room_map.h"
+
+#define MAX_THREADS		8
+#define MAX_LABELS		65535
+#define DT_INF			1e20f
+
+struct room_map_s {
+	unsigned int width;
+	unsigned int height;
+	float resolution;
+	float origin_x;
+	float origin_y;
+	unsigned short *labels;
+	room_s *rooms;
+	int room_count;
+};
+
+/* Shared state of one segmentation run. */
+typedef struct {
+	unsigned int width;
+	unsigned int height;
+	const unsigned char *cells;	// Snapshot of the grid
+	float *g;					// Column pass output, squared distances
+	float *dt;					// Distance to the nearest non-free cell, in cells
+	float seed_dist;
+	int *parent;				// Union-find over marker cells
+} segment_ctx_s;
+
+typedef struct {
+	segment_ctx_s *ctx;
+	unsigned int begin;
+	unsigned int end;
+	bool failed;
+} segment_task_s;
+
+typedef struct {
+	float d;
+	unsigned int idx;
+	unsigned short label;
+} flood_item_s;
+
+typedef struct {
+	flood_item_s *items;
+	size_t count;
+	size_t capacity;
+} flood_heap_s;
+
+void room_map_config_default(room_map_config_s *config)
+{
+	config->door_width = 900.f;
+	config->min_room_area = 1.5e6f;	// 1.5 m^2
+	config->threads = 0;
+}
+
+/*
+ * Distance transform
+ */
+
+/*
+ * Squared distance transform of one line (Felzenszwalb and Huttenlocher). Both
+ * ends of the line count as obstacles since nothing outside the grid is known.
+ */
+static void
+_dt_line(const float *f, float *d, int n, int *v, float *z)
+{
+	int k = 0, q;
+
+	v[0] = 0;
+	z[0] = -DT_INF;
+	z[1] = DT_INF;
+
+	for (q = 1; q < n; q++)
+	{
+		float s;
+
+		for (;;)
+		{
+			int p = v[k];
+
+			s = ((f[q] + (float)q * q) - (f[p] + (float)p * p)) / (2.f * (q - p));
+			if (s > z[k])
+				break;
+			k--;
+		}
+
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = DT_INF;
+	}
+
+	k = 0;
+	for (q = 0; q < n; q++)
+	{
+		float lo = (float)(q + 1) * (q + 1);
+		float hi = (float)(n - q) * (n - q);
+		float dq;
+
+		while (z[k + 1] < q)
+			k++;
+		dq = (float)(q - v[k]) * (q - v[k]) + f[v[k]];
+
+		if (hi < lo)
+			lo = hi;
+		d[q] = dq < lo ? dq : lo;
+	}
+}
+
+static void *
+_dt_columns(void *data)
+{
+	segment_task_s *task = data;
+	segment_ctx_s *ctx = task->ctx;
+	unsigned int w = ctx->width, h = ctx->height;
+	float *f = calloc(h, sizeof(float));
+	float *d = malloc(h * sizeof(float));
+	int *v = malloc(h * sizeof(int));
+	float *z = malloc((h + 1) * sizeof(float));
+	unsigned int x, y;
+
+	if (!f || !d || !v || !z)
+	{
+		task->failed = true;
+		goto out;
+	}
+
+	for (x = task->begin; x < task->end; x++)
+	{
+		for (y = 0; y < h; y++)
+			f[y] = ctx->cells[(size_t)y * w + x] == OCCUPANCY_FREE ? DT_INF : 0.f;
+
+		_dt_line(f, d, h, v, z);
+
+		for (y = 0; y < h; y++)
+			ctx->g[(size_t)y * w + x] = d[y];
+	}
+
+out:
+
+	free(f);
+	free(d);
+	free(v);
+	free(z);
+
+	return NULL;
+}
+
+static void *
+_dt_rows(void *data)
+{
+	segment_task_s *task = data;
+	segment_ctx_s *ctx = task->ctx;
+	unsigned int w = ctx->width;
+	int *v = malloc(w * sizeof(int));
+	float *z = malloc((w + 1) * sizeof(float));
+	unsigned int x, y;
+
+	if (v && z)
+	{
+		for (y = task->begin; y < task->end; y++)
+		{
+			float *row = ctx->dt + (size_t)y * w;
+
+			_dt_line(ctx->g + (size_t)y * w, row, w, v, z);
+			for (x = 0; x < w; x++)
+				row[x] = sqrtf(row[x]);
+		}
+	}
+	else
+	{
+		task->failed = true;
+	}
+
+	free(v);
+	free(z);
+
+	return NULL;
+}
+
+/*
+ * Marker labeling
+ */
+
+static int
+_find(int *parent, int i)
+{
+	while (parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+/* Links the larger root under the smaller one, so a root is always the first cell of its set. */
+static void
+_union(int *parent, int a, int b)
+{
+	a = _find(parent, a);
+	b = _find(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+static bool
+_is_seed(const segment_ctx_s *ctx, size_t i)
+{
+	return ctx->dt[i] > ctx->seed_dist;
+}
+
+/* Labels the markers of one band of rows. Links never leave the band, so bands run in parallel. */
+static void *
+_label_band(void *data)
+{
+	segment_task_s *task = data;
+	segment_ctx_s *ctx = task->ctx;
+	unsigned int w = ctx->width;
+	unsigned int x, y;
+
+	for (y = task->begin; y < task->end; y++)
+	{
+		for (x = 0; x < w; x++)
+		{
+			size_t i = (size_t)y * w + x;
+
+			if (!_is_seed(ctx, i))
+				continue;
+
+			ctx->parent[i] = i;
+			if (x > 0 && _is_seed(ctx, i - 1))
+				_union(ctx->parent, i, i - 1);
+			if (y > task->begin && _is_seed(ctx, i - w))
+				_union(ctx->parent, i, i - w);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs @a fn over [0, n) split into up to @a threads contiguous ranges. The range
+ * starts go to @a bounds. Returns the number of ranges, or -1 if a task failed.
+ */
+static int
+_run_parallel(segment_ctx_s *ctx, void *(*fn)(void *), unsigned int n, int threads, unsigned int *bounds)
+{
+	segment_task_s tasks[MAX_THREADS];
+	pthread_t ids[MAX_THREADS];
+	bool started[MAX_THREADS];
+	bool failed = false;
+	int t;
+
+	if ((unsigned int)threads > n)
+		threads = n > 0 ? n : 1;
+
+	for (t = 0; t < threads; t++)
+	{
+		tasks[t].ctx = ctx;
+		tasks[t].begin = (unsigned int)((unsigned long long)n * t / threads);
+		tasks[t].end = (unsigned int)((unsigned long long)n * (t + 1) / threads);
+		tasks[t].failed = false;
+		if (bounds)
+			bounds[t] = tasks[t].begin;
+		started[t] = t > 0 && pthread_create(&ids[t], NULL, fn, &tasks[t]) == 0;
+	}
+
+	// The calling thread takes the first range, and any range no thread could be started for.
+	for (t = 0; t < threads; t++)
+	{
+		if (!started[t])
+			fn(&tasks[t]);
+	}
+	for (t = 0; t < threads; t++)
+	{
+		if (started[t])
+			pthread_join(ids[t], NULL);
+		failed |= tasks[t].failed;
+	}
+
+	return failed ? -1 : threads;
+}
+
+/*
+ * Flooding
+ */
+
+static bool
+_heap_before(const flood_item_s *a, const flood_item_s *b)
+{
+	if (a->d != b->d)
+		return a->d > b->d;
+	return a->idx < b->idx;
+}
+
+static bool
+_heap_push(flood_heap_s *heap, float d, unsigned int idx, unsigned short label)
+{
+	flood_item_s item = { d, idx, label };
+	size_t i;
+
+	if (heap->count == heap->capacity)
+	{
+		size_t capacity = heap->capacity ? heap->capacity * 2 : 4096;
+		flood_item_s *items = realloc(heap->items, capacity * sizeof(*items));
+
+		if (!items)
+			return false;
+		heap->items = items;
+		heap->capacity = capacity;
+	}
+
+	i = heap->count++;
+	while (i > 0)
+	{
+		size_t up = (i - 1) / 2;
+
+		if (!_heap_before(&item, &heap->items[up]))
+			break;
+		heap->items[i] = heap->items[up];
+		i = up;
+	}
+	heap->items[i] = item;
+
+	return true;
+}
+
+static flood_item_s
+_heap_pop(flood_heap_s *heap)
+{
+	flood_item_s top = heap->items[0];
+	flood_item_s last = heap->items[--heap->count];
+	size_t i = 0;
+
+	for (;;)
+	{
+		size_t c = 2 * i + 1;
+
+		if (c >= heap->count)
+			break;
+		if (c + 1 < heap->count && _heap_before(&heap->items[c + 1], &heap->items[c]))
+			c++;
+		if (!_heap_before(&heap->items[c], &last))
+			break;
+		heap->items[i] = heap->items[c];
+		i = c;
+	}
+	if (heap->count > 0)
+		heap->items[i] = last;
+
+	return top;
+}
+
+/* Pushes the free, unlabeled 4-neighbors of cell @a i. */
+static bool
+_push_neighbors(flood_heap_s *heap, const segment_ctx_s *ctx, const unsigned short *labels, size_t i, unsigned short label)
+{
+	static const int dx[4] = { -1, 1, 0, 0 };
+	static const int dy[4] = { 0, 0, -1, 1 };
+	int x = i % ctx->width, y = i / ctx->width;
+	int k;
+
+	for (k = 0; k < 4; k++)
+	{
+		int nx = x + dx[k], ny = y + dy[k];
+		size_t n;
+
+		if (nx < 0 || ny < 0 || nx >= (int)ctx->width || ny >= (int)ctx->height)
+			continue;
+		n = (size_t)ny * ctx->width + nx;
+		if (labels[n] || ctx->cells[n] != OCCUPANCY_FREE)
+			continue;
+		if (!_heap_push(heap, ctx->dt[n], n, label))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Every free cell goes to the marker whose flood reaches it first, visiting cells
+ * from the largest distance down, so the borders end up at the narrow passages.
+ */
+static bool
+_flood(const segment_ctx_s *ctx, unsigned short *labels)
+{
+	flood_heap_s heap = { NULL, 0, 0 };
+	size_t n = (size_t)ctx->width * ctx->height, i;
+	bool ok = true;
+
+	for (i = 0; i < n && ok; i++)
+	{
+		if (labels[i])
+			ok = _push_neighbors(&heap, ctx, labels, i, labels[i]);
+	}
+
+	while (ok && heap.count > 0)
+	{
+		flood_item_s item = _heap_pop(&heap);
+
+		if (labels[item.idx])
+			continue;
+		labels[item.idx] = item.label;
+		ok = _push_neighbors(&heap, ctx, labels, item.idx, item.label);
+	}
+
+	free(heap.items);
+
+	return ok;
+}
+
+/* Gives each free area no marker reached a label of its own. Returns the next free label, or 0 without memory. */
+static int
+_label_rest(const segment_ctx_s *ctx, unsigned short *labels, int next)
+{
+	static const int dx[4] = { -1, 1, 0, 0 };
+	static const int dy[4] = { 0, 0, -1, 1 };
+	size_t n = (size_t)ctx->width * ctx->height, i;
+	unsigned int *stack = malloc(n * sizeof(*stack));
+
+	if (!stack)
+		return 0;
+
+	for (i = 0; i < n && next <= MAX_LABELS; i++)
+	{
+		size_t top = 0;
+
+		if (labels[i] || ctx->cells[i] != OCCUPANCY_FREE)
+			continue;
+
+		// Cells are labeled when pushed, so each is pushed once and n entries suffice.
+		labels[i] = next;
+		stack[top++] = i;
+		while (top > 0)
+		{
+			unsigned int c = stack[--top];
+			int x = c % ctx->width, y = c / ctx->width;
+			int k;
+
+			for (k = 0; k < 4; k++)
+			{
+				int nx = x + dx[k], ny = y + dy[k];
+				size_t m;
+
+				if (nx < 0 || ny < 0 || nx >= (int)ctx->width || ny >= (int)ctx->height)
+					continue;
+				m = (size_t)ny * ctx->width + nx;
+				if (labels[m] || ctx->cells[m] != OCCUPANCY_FREE)
+					continue;
+
+				labels[m] = next;
+				stack[top++] = m;
+			}
+		}
+		next++;
+	}
+
+	free(stack);
+
+	return next;
+}
+
+/*
+ * Region statistics and merging
+ */
+
+typedef struct {
+	unsigned int cells;
+	int min_x, min_y, max_x, max_y;
+} region_s;
+
+static void
+_region_stats(const unsigned short *labels, unsigned int w, unsigned int h, region_s *regions, int count)
+{
+	unsigned int x, y;
+	int l;
+
+	for (l = 0; l < count; l++)
+	{
+		regions[l].cells = 0;
+		regions[l].min_x = w;
+		regions[l].min_y = h;
+		regions[l].max_x = -1;
+		regions[l].max_y = -1;
+	}
+
+	for (y = 0; y < h; y++)
+	{
+		for (x = 0; x < w; x++)
+		{
+			region_s *r;
+
+			l = labels[(size_t)y * w + x];
+			if (!l)
+				continue;
+			r = &regions[l];
+			r->cells++;
+			if ((int)x < r->min_x)
+				r->min_x = x;
+			if ((int)x > r->max_x)
+				r->max_x = x;
+			if ((int)y < r->min_y)
+				r->min_y = y;
+			if ((int)y > r->max_y)
+				r->max_y = y;
+		}
+	}
+}
+
+/*
+ * Merges each region under @a min_cells into the neighbor it shares the longest
+ * border with, smallest first. Regions without neighbors are unreachable specks
+ * and are dropped.
+ */
+static bool
+_merge_small(unsigned short *labels, unsigned int w, unsigned int h, region_s *regions, int count, unsigned int min_cells)
+{
+	unsigned int *border = calloc(count, sizeof(*border));
+
+	if (!border)
+		return false;
+
+	for (;;)
+	{
+		int small = 0, best = 0, l, x, y;
+		region_s *r;
+
+		for (l = 1; l < count; l++)
+		{
+			if (regions[l].cells > 0 && regions[l].cells < min_cells &&
+					(!small || regions[l].cells < regions[small].cells))
+				small = l;
+		}
+		if (!small)
+			break;
+
+		r = &regions[small];
+		memset(border, 0, count * sizeof(*border));
+		for (y = r->min_y; y <= r->max_y; y++)
+		{
+			for (x = r->min_x; x <= r->max_x; x++)
+			{
+				size_t i = (size_t)y * w + x;
+
+				if (labels[i] != small)
+					continue;
+				if (x > 0 && labels[i - 1] && labels[i - 1] != small)
+					border[labels[i - 1]]++;
+				if (x + 1 < (int)w && labels[i + 1] && labels[i + 1] != small)
+					border[labels[i + 1]]++;
+				if (y > 0 && labels[i - w] && labels[i - w] != small)
+					border[labels[i - w]]++;
+				if (y + 1 < (int)h && labels[i + w] && labels[i + w] != small)
+					border[labels[i + w]]++;
+			}
+		}
+		for (l = 1; l < count; l++)
+		{
+			if (border[l] > (best ? border[best] : 0))
+				best = l;
+		}
+
+		for (y = r->min_y; y <= r->max_y; y++)
+		{
+			for (x = r->min_x; x <= r->max_x; x++)
+			{
+				size_t i = (size_t)y * w + x;
+
+				if (labels[i] == small)
+					labels[i] = best;
+			}
+		}
+
+		if (best)
+		{
+			region_s *b = &regions[best];
+
+			b->cells += r->cells;
+			if (r->min_x < b->min_x)
+				b->min_x = r->min_x;
+			if (r->max_x > b->max_x)
+				b->max_x = r->max_x;
+			if (r->min_y < b->min_y)
+				b->min_y = r->min_y;
+			if (r->max_y > b->max_y)
+				b->max_y = r->max_y;
+		}
+		r->cells = 0;
+	}
+
+	free(border);
+
+	return true;
+}
+
+/* Renumbers the labels 1..n in row major order of first appearance and fills in the rooms. */
+static bool
+_finish(struct room_map_s *m, int count)
+{
+	unsigned short *remap = calloc(count, sizeof(*remap));
+	double *sx = NULL, *sy = NULL;
+	size_t n = (size_t)m->width * m->height, i;
+	int rooms = 0, l;
+
+	if (!remap)
+		return false;
+
+	for (i = 0; i < n; i++)
+	{
+		l = m->labels[i];
+		if (l && !remap[l])
+			remap[l] = ++rooms;
+		m->labels[i] = remap[l];
+	}
+	free(remap);
+
+	m->room_count = rooms;
+	if (rooms == 0)
+		return true;
+
+	m->rooms = calloc(rooms, sizeof(room_s));
+	sx = calloc(rooms, sizeof(double));
+	sy = calloc(rooms, sizeof(double));
+	if (!m->rooms || !sx || !sy)
+	{
+		free(sx);
+		free(sy);
+		return false;
+	}
+
+	for (l = 0; l < rooms; l++)
+	{
+		m->rooms[l].id = l + 1;
+		m->rooms[l].min_cx = m->width;
+		m->rooms[l].min_cy = m->height;
+		m->rooms[l].max_cx = -1;
+		m->rooms[l].max_cy = -1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		int x = i % m->width, y = i / m->width;
+		room_s *r;
+
+		if (!m->labels[i])
+			continue;
+		r = &m->rooms[m->labels[i] - 1];
+		r->cells++;
+		sx[r->id - 1] += x;
+		sy[r->id - 1] += y;
+		if (x < r->min_cx)
+			r->min_cx = x;
+		if (x > r->max_cx)
+			r->max_cx = x;
+		if (y < r->min_cy)
+			r->min_cy = y;
+		if (y > r->max_cy)
+			r->max_cy = y;
+	}
+
+	for (l = 0; l < rooms; l++)
+	{
+		room_s *r = &m->rooms[l];
+
+		r->area = r->cells * m->resolution * m->resolution;
+		r->x = m->origin_x + (float)(sx[l] / r->cells + 0.5) * m->resolution;
+		r->y = m->origin_y + (float)(sy[l] / r->cells + 0.5) * m->resolution;
+	}
+
+	free(sx);
+	free(sy);
+
+	return true;
+}
+
+int room_map_build(occupancy_grid_h grid, const room_map_config_s *config, room_map_h *map)
+{
+	room_map_config_s defaults;
+	segment_ctx_s ctx;
+	struct room_map_s *m;
+	unsigned int bounds[MAX_THREADS];
+	unsigned char *cells = NULL;
+	region_s *regions = NULL;
+	size_t n, i;
+	int threads, bands, count = 1, ret = ROOM_MAP_ERROR_OUT_OF_MEMORY, t;
+	float resolution;
+
+	if (!grid || !map)
+		return ROOM_MAP_ERROR_INVALID_PARAMETER;
+
+	if (!config)
+	{
+		room_map_config_default(&defaults);
+		config = &defaults;
+	}
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return ROOM_MAP_ERROR_OUT_OF_MEMORY;
+
+	occupancy_grid_get_size(grid, &m->width, &m->height, &resolution);
+	occupancy_grid_cell_to_world(grid, 0, 0, &m->origin_x, &m->origin_y);
+	m->resolution = resolution;
+	m->origin_x -= 0.5f * resolution;
+	m->origin_y -= 0.5f * resolution;
+	n = (size_t)m->width * m->height;
+
+	threads = config->threads;
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.width = m->width;
+	ctx.height = m->height;
+	ctx.seed_dist = 0.5f * config->door_width / resolution + 0.5f;
+
+	// The pose callback keeps marking cells while this runs, so work on a copy.
+	cells = malloc(n);
+	m->labels = calloc(n, sizeof(unsigned short));
+	ctx.g = malloc(n * sizeof(float));
+	ctx.dt = malloc(n * sizeof(float));
+	ctx.parent = malloc(n * sizeof(int));
+	if (!cells || !m->labels || !ctx.g || !ctx.dt || !ctx.parent)
+		goto out;
+	occupancy_grid_copy(grid, 0, 0, m->width, m->height, cells);
+	ctx.cells = cells;
+
+	if (_run_parallel(&ctx, _dt_columns, m->width, threads, NULL) < 0 ||
+			_run_parallel(&ctx, _dt_rows, m->height, threads, NULL) < 0)
+		goto out;
+
+	for (i = 0; i < n && cells[i] != OCCUPANCY_FREE; i++)
+		;
+	if (i == n)
+	{
+		ret = ROOM_MAP_ERROR_NO_DATA;
+		goto out;
+	}
+
+	// Markers: label bands in parallel, then join them across the band borders.
+	bands = _run_parallel(&ctx, _label_band, m->height, threads, bounds);
+	for (t = 1; t < bands; t++)
+	{
+		unsigned int y = bounds[t], x;
+
+		for (x = 0; x < m->width; x++)
+		{
+			i = (size_t)y * m->width + x;
+			if (_is_seed(&ctx, i) && _is_seed(&ctx, i - m->width))
+				_union(ctx.parent, i, i - m->width);
+		}
+	}
+	for (i = 0; i < n; i++)
+	{
+		size_t root;
+
+		if (!_is_seed(&ctx, i))
+			continue;
+		root = _find(ctx.parent, i);
+		if (root == i)
+		{
+			if (count > MAX_LABELS)
+				continue;
+			m->labels[i] = count++;
+		}
+		else
+		{
+			m->labels[i] = m->labels[root];
+		}
+	}
+
+	if (!_flood(&ctx, m->labels))
+		goto out;
+
+	count = _label_rest(&ctx, m->labels, count);
+	if (!count)
+		goto out;
+
+	regions = malloc(count * sizeof(*regions));
+	if (!regions)
+		goto out;
+	_region_stats(m->labels, m->width, m->height, regions, count);
+	if (!_merge_small(m->labels, m->width, m->height, regions, count,
+			(unsigned int)ceilf(config->min_room_area / (resolution * resolution))))
+		goto out;
+
+	if (!_finish(m, count))
+		goto out;
+
+	ret = m->room_count > 0 ? ROOM_MAP_ERROR_NONE : ROOM_MAP_ERROR_NO_DATA;
+
+out:
+	free(regions);
+	free(ctx.parent);
+	free(ctx.dt);
+	free(ctx.g);
+	free(cells);
+
+	if (ret != ROOM_MAP_ERROR_NONE)
+	{
+		room_map_destroy(m);
+		return ret;
+	}
+
+	*map = m;
+
+	return ROOM_MAP_ERROR_NONE;
+}
+
+void room_map_destroy(room_map_h map)
+{
+	if (!map)
+		return;
+
+	free(map->rooms);
+	free(map->labels);
+	free(map);
+}
+
+int room_map_get_rooms(room_map_h map, const room_s **rooms, int *count)
+{
+	if (!map || !rooms || !count)
+		return ROOM_MAP_ERROR_INVALID_PARAMETER;
+
+	*rooms = map->rooms;
+	*count = map->room_count;
+
+	return ROOM_MAP_ERROR_NONE;
+}
+
+const room_s *room_map_get_room(room_map_h map, int id)
+{
+	if (!map || id < 1 || id > map->room_count)
+		return NULL;
+
+	return &map->rooms[id - 1];
+}
+
+int room_map_room_at(room_map_h map, float x, float y)
+{
+	int cx, cy;
+
+	if (!map)
+		return 0;
+
+	cx = (int)floorf((x - map->origin_x) / map->resolution);
+	cy = (int)floorf((y - map->origin_y) / map->resolution);
+	if (cx < 0 || cy < 0 || cx >= (int)map->width || cy >= (int)map->height)
+		return 0;
+
+	return map->labels[(size_t)cy * map->width + cx];
+}
+
+const unsigned short *room_map_labels(room_map_h map, unsigned int *width, unsigned int *height)
+{
+	if (!map)
+		return NULL;
+
+	if (width)
+		*width = map->width;
+	if (height)
+		*height = map->height;
+
+	return map->labels;
+}
+
+static float
+_lane_step(room_map_h map, float spacing)
+{
+	float step = spacing / map->resolution;
+
+	return step < 1.f ? 1.f : step;
+}
+
+int room_map_lane_count(room_map_h map, int id, float spacing)
+{
+	const room_s *r = room_map_get_room(map, id);
+
+	if (!r || spacing <= 0.f)
+		return 0;
+
+	return (int)ceilf((r->max_cy - r->min_cy + 1) / _lane_step(map, spacing));
+}
+
+/* Finds the extent of room @a id on row @a cy. */
+static bool
+_row_extent(room_map_h map, const room_s *r, int cy, int *x0, int *x1)
+{
+	const unsigned short *row = map->labels + (size_t)cy * map->width;
+	int x;
+
+	for (x = r->min_cx; x <= r->max_cx && row[x] != r->id; x++)
+		;
+	if (x > r->max_cx)
+		return false;
+	*x0 = x;
+
+	for (x = r->max_cx; row[x] != r->id; x--)
+		;
+	*x1 = x;
+
+	return true;
+}
+
+bool room_map_get_lane(room_map_h map, int id, float spacing, int lane, float *x0, float *y0, float *x1, float *y1)
+{
+	const room_s *r = room_map_get_room(map, id);
+	float step;
+	int cy, lo = 0, hi = 0, off;
+	bool found = false;
+
+	if (!r || lane < 0 || lane >= room_map_lane_count(map, id, spacing))
+		return false;
+
+	step = _lane_step(map, spacing);
+	cy = r->min_cy + (int)((lane + 0.5f) * step);
+	if (cy > r->max_cy)
+		cy = r->max_cy;
+
+	// A lane row may miss a non convex room; take the nearest row within the lane that does not.
+	for (off = 0; off <= (int)(step * 0.5f) && !found; off++)
+	{
+		if (cy - off >= r->min_cy && _row_extent(map, r, cy - off, &lo, &hi))
+		{
+			cy -= off;
+			found = true;
+		}
+		else if (cy + off <= r->max_cy && _row_extent(map, r, cy + off, &lo, &hi))
+		{
+			cy += off;
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		// Nothing of the room in this lane: a zero length lane at the centroid.
+		*x0 = *x1 = r->x;
+		*y0 = *y1 = r->y;
+		return true;
+	}
+
+	if (lane & 1)
+	{
+		int tmp = lo;
+
+		lo = hi;
+		hi = tmp;
+	}
+
+	*x0 = map->origin_x + (lo + 0.5f) * map->resolution;
+	*x1 = map->origin_x + (hi + 0.5f) * map->resolution;
+	*y0 = *y1 = map->origin_y + (cy + 0.5f) * map->resolution;
+
+	return true;
+}
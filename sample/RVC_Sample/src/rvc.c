@@ -1,8 +1,24 @@
 #include <tizen.h>
 #include <service_app.h>
 #include <rvc_api.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "rvc.h"
+#include "hazard_index.h"
+#include "map_store.h"
+#include "energy_planner.h"
+#include "rvc_log.h"
+#include "sensor_filter.h"
+#include "room_map.h"
+#include "clean_jobs.h"
+#include "pose_graph.h"
+#include "motion_planner.h"
+#include "clean_runner.h"
 
 #include "pthread.h"
 #include "Ecore.h"
@@ -192,72 +208,665 @@ void set_rvc_command(){
 * @endcode
 */
 
+#define HAZARD_CELL_SIZE		100.f	// Grid cell of the hazard index, in rvc_get_pose() units (mm)
+#define HAZARD_CAPACITY			4096
+#define MAP_GRID_SIZE			512		// Cells per side of the occupancy grid
+#define MAP_GRID_RESOLUTION		50.f	// 5 cm cells, 25.6 m square map
+#define MAP_FILE_NAME			"map.bin"
+#define MAP_CHECKPOINT_INTERVAL	30.0	// Seconds between incremental map checkpoints
+#define RVC_BODY_RADIUS			170.f	// Distance from the robot center to the bumper/cliff sensors
+#define RVC_SENSOR_SIDE_ANGLE	0.7854f	// Angle of the left/right sensors from the heading (45 deg)
+#define ENERGY_INTERVAL			1.0		// Seconds between battery model updates
+#define SENSOR_FILTER_INTERVAL	0.05	// Seconds between checks for due sensor releases
+#define POSE_GRAPH_INTERVAL		0.1		// Seconds between pose graph updates
+#define POSE_GRAPH_BUDGET_US	5000	// Solver time allowed per update
+#define JOBS_FILE_NAME			"jobs.bin"
+
+typedef struct {
+	float x, y, q;
+} pose_s;
+
 pthread_t p_thread;
 
-void *t_func(void *data)
+static map_store_h g_map;
+static hazard_index_h g_hazards;
+static occupancy_grid_h g_grid;
+static Ecore_Timer *g_checkpoint_timer;
+static energy_planner_h g_energy;
+static Ecore_Timer *g_energy_timer;
+static sensor_filter_h g_filter;
+static Ecore_Timer *g_filter_timer;
+static pose_graph_h g_graph;
+static Ecore_Timer *g_graph_timer;
+static motion_planner_h g_planner;
+static rvc_suction_state_e g_suction = RVC_SUCTION_NORMAL;
+static clean_jobs_h g_jobs;
+static char g_jobs_path[512];
+static clean_runner_h g_runner;
+static pose_s g_pose;
+static pthread_mutex_t g_pose_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Writes messages formatted by the logger thread to dlog. */
+static void
+_dlog_sink(int level, uint64_t t_ns, const char *message, void *user_data)
+{
+	static const log_priority priority[] = { DLOG_INFO, DLOG_ERROR, DLOG_WARN, DLOG_INFO, DLOG_DEBUG };
+
+	dlog_print(priority[level >= 1 && level <= RVC_LOG_LEVEL_DEBUG ? level : 0], LOG_TAG, "%s", message);
+}
+
+static unsigned int
+_now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned int)ts.tv_sec;
+}
+
+static unsigned long long
+_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static pose_s
+_get_pose(void)
 {
+	pose_s pose;
 
-	bool b_should_pause = false;
-	int timer = 0;
+	pthread_mutex_lock(&g_pose_lock);
+	pose = g_pose;
+	pthread_mutex_unlock(&g_pose_lock);
 
-	while(!b_should_pause)
+	return pose;
+}
+
+static void
+_runner_pose(float *x, float *y, float *q, void *data)
+{
+	pose_s pose = _get_pose();
+
+	*x = pose.x;
+	*y = pose.y;
+	*q = pose.q;
+}
+
+/*
+ * Records a hazard at the position of the sensor that fired.
+ * sensor bit 0 is the left sensor, bit 1 the center and bit 2 the right one.
+ */
+static void
+_record_hazard(hazard_type_e type, unsigned char sensor)
+{
+	pose_s pose = _get_pose();
+	unsigned int stamp = _now_sec();
+	int i;
+
+	for (i = 0; i < 3; i++)
 	{
-		if (timer < 100)
-		{
-			rvc_set_control(RVC_CONTROL_DIR_RIGHT);
-		}
-		else if (timer < 150)
-		{
-			rvc_set_control(RVC_CONTROL_DIR_LEFT);
-		}
-		else // when time is over
-		{
-			timer = 0;
+		float q, x, y;
+		int ret;
 
-			// Sends a command to stop RVC
-			rvc_set_mode(RVC_MODE_SET_PAUSE);
+		if (!(sensor & (1 << i)))
+			continue;
 
-			b_should_pause = true;
-		}
-		timer++;
+		q = pose.q + (1 - i) * RVC_SENSOR_SIDE_ANGLE;
+		x = pose.x + RVC_BODY_RADIUS * cosf(q);
+		y = pose.y + RVC_BODY_RADIUS * sinf(q);
+
+		ret = hazard_index_insert(g_hazards, type, 1 << i, x, y, stamp);
+		if (ret == HAZARD_INDEX_ERROR_FULL)
+			RVC_LOG_W("hazard index is full");
+
+		if (type & (HAZARD_TYPE_BUMPER | HAZARD_TYPE_CLIFF))
+			occupancy_grid_mark_occupied(g_grid, x, y);
 	}
 }
 
+/* Feeds a landmark sighting by the sensors in @a sensor to the pose graph. */
+static void
+_observe_landmark(pose_graph_landmark_e type, unsigned char sensor)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		float q = (1 - i) * RVC_SENSOR_SIDE_ANGLE;
+
+		if (sensor & (1 << i))
+			pose_graph_observe(g_graph, type, RVC_BODY_RADIUS * cosf(q), RVC_BODY_RADIUS * sinf(q));
+	}
+}
+
+/*
+ * Raw odometry goes to the pose graph; everything else, the map included, works
+ * on the drift corrected pose.
+ */
+static void
+_pose_callback(float pose_x, float pose_y, float pose_q, void* data)
+{
+	pose_graph_add_pose(g_graph, pose_x, pose_y, pose_q);
+	pose_graph_correct(g_graph, &pose_x, &pose_y, &pose_q);
+
+	pthread_mutex_lock(&g_pose_lock);
+	g_pose.x = pose_x;
+	g_pose.y = pose_y;
+	g_pose.q = pose_q;
+	pthread_mutex_unlock(&g_pose_lock);
+
+	occupancy_grid_mark_free(g_grid, pose_x, pose_y, RVC_BODY_RADIUS);
+}
+
+/*
+ * Raw sensor callbacks go through the sensor filter; only the filtered changes
+ * below reach the map. A new activation is recorded once, however long it chatters.
+ */
+static void
+_filtered_callback(sensor_filter_type_e type, unsigned char active, unsigned char rising, void* data)
+{
+	pose_s pose;
+
+	if (!rising)
+		return;
+
+	switch (type)
+	{
+	case SENSOR_FILTER_BUMPER:
+		_record_hazard(HAZARD_TYPE_BUMPER, rising);
+		_observe_landmark(POSE_GRAPH_LANDMARK_BUMPER, rising);
+		clean_runner_contact(g_runner);
+		break;
+	case SENSOR_FILTER_CLIFF:
+		_record_hazard(HAZARD_TYPE_CLIFF, rising);
+		clean_runner_contact(g_runner);
+		break;
+	case SENSOR_FILTER_LIFT:
+		// Wheel lift happens under the body, so it is recorded at the robot center.
+		pose = _get_pose();
+		hazard_index_insert(g_hazards, HAZARD_TYPE_LIFT, rising, pose.x, pose.y, _now_sec());
+		break;
+	case SENSOR_FILTER_MAGNET:
+		_record_hazard(HAZARD_TYPE_MAGNET, rising);
+		_observe_landmark(POSE_GRAPH_LANDMARK_MAGNET, rising);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+_bumper_callback(unsigned char bumper_left, unsigned char bumper_right, void* data)
+{
+	sensor_filter_input(g_filter, SENSOR_FILTER_BUMPER, (bumper_left ? 0x1 : 0) | (bumper_right ? 0x4 : 0), _now_ms());
+}
+
+static void
+_cliff_callback(unsigned char cliff_left, unsigned char cliff_center, unsigned char cliff_right, void* data)
+{
+	sensor_filter_input(g_filter, SENSOR_FILTER_CLIFF, (cliff_left ? 0x1 : 0) | (cliff_center ? 0x2 : 0) | (cliff_right ? 0x4 : 0), _now_ms());
+}
+
+static void
+_lift_callback(unsigned char lift_left, unsigned char lift_right, void* data)
+{
+	sensor_filter_input(g_filter, SENSOR_FILTER_LIFT, (lift_left ? 0x1 : 0) | (lift_right ? 0x4 : 0), _now_ms());
+}
+
+static void
+_magnet_callback(unsigned char magnet, void* data)
+{
+	sensor_filter_input(g_filter, SENSOR_FILTER_MAGNET, magnet ? 0x2 : 0, _now_ms());
+}
+
+static void
+_suction_callback(rvc_suction_state_e state, void* data)
+{
+	g_suction = state;
+}
+
+/*
+ * A docking run ends with a mode change away from docking. Sitting on the dock
+ * then pins down the drifted pose.
+ */
+static void
+_mode_callback(rvc_mode_type_get_e mode, void* data)
+{
+	if (mode != RVC_MODE_GET_DOCKING && clean_runner_arrived(g_runner))
+		pose_graph_observe_dock(g_graph);
+}
+
+static void
+_batt_callback(rvc_batt_level_e level, void* data)
+{
+	static rvc_batt_level_e last_level = (rvc_batt_level_e)-1;
+
+	// A rising level means the robot is charging, should the arrival event be missed.
+	// It is not a dock observation: nothing says the robot reached the dock it was sent to.
+	if ((int)level > (int)last_level)
+		clean_runner_charging(g_runner);
+	last_level = level;
+
+	energy_planner_observe_level(g_energy, level);
+}
+
+static void
+_register_callback(void)
+{
+	rvc_batt_level_e level;
+
+	rvc_get_pose(&g_pose.x, &g_pose.y, &g_pose.q);
+	pose_graph_add_pose(g_graph, g_pose.x, g_pose.y, g_pose.q);
+	rvc_get_suction_state(&g_suction);
+	if (rvc_get_battery_level(&level) == RVC_USER_ERROR_NONE)
+		_batt_callback(level, NULL);
+
+	rvc_set_mode_evt_cb(_mode_callback, NULL);
+	rvc_set_pose_evt_cb(_pose_callback, NULL);
+	rvc_set_bumper_evt_cb(_bumper_callback, NULL);
+	rvc_set_cliff_evt_cb(_cliff_callback, NULL);
+	rvc_set_lift_evt_cb(_lift_callback, NULL);
+	rvc_set_magnet_evt_cb(_magnet_callback, NULL);
+	rvc_set_suction_evt_cb(_suction_callback, NULL);
+	rvc_set_batt_evt_cb(_batt_callback, NULL);
+}
+
+static void
+_unregister_callback(void)
+{
+	rvc_unset_mode_evt_cb();
+	rvc_unset_pose_evt_cb();
+	rvc_unset_bumper_evt_cb();
+	rvc_unset_cliff_evt_cb();
+	rvc_unset_lift_evt_cb();
+	rvc_unset_magnet_evt_cb();
+	rvc_unset_suction_evt_cb();
+	rvc_unset_batt_evt_cb();
+}
+
+/*
+ * Maps the map saved by the previous run, or creates an empty one.
+ * The pose origin is where the robot powered up, normally on its dock, so it is
+ * taken as the dock location until a better one is known.
+ */
+static bool
+_open_map(void)
+{
+	map_store_config_s config = {
+		.grid_width = MAP_GRID_SIZE,
+		.grid_height = MAP_GRID_SIZE,
+		.grid_resolution = MAP_GRID_RESOLUTION,
+		.hazard_capacity = HAZARD_CAPACITY,
+		.hazard_cell_size = HAZARD_CELL_SIZE,
+	};
+	char path[512];
+	char *data_path = app_get_data_path();
+	bool restored = false;
+	int ret;
+
+	if (!data_path)
+		return false;
+
+	snprintf(path, sizeof(path), "%s%s", data_path, MAP_FILE_NAME);
+	free(data_path);
+
+	ret = map_store_open(path, &config, &g_map, &restored);
+	if (ret != MAP_STORE_ERROR_NONE)
+	{
+		RVC_LOG_E("failed to open map store (%d)", ret);
+		return false;
+	}
+
+	g_grid = map_store_get_grid(g_map);
+	g_hazards = map_store_get_hazards(g_map);
+
+	if (map_store_get_dock(g_map, NULL, NULL, NULL) != MAP_STORE_ERROR_NONE)
+		map_store_set_dock(g_map, 0.f, 0.f, 0.f);
+
+	RVC_LOG_I("map %s with %u hazards", restored ? "restored" : "created", hazard_index_count(g_hazards));
+
+	return true;
+}
+
+static void
+_close_map(void)
+{
+	g_grid = NULL;
+	g_hazards = NULL;
+	map_store_close(g_map);
+	g_map = NULL;
+}
+
+static Eina_Bool
+_checkpoint_cb(void *data)
+{
+	if (map_store_checkpoint(g_map) != MAP_STORE_ERROR_NONE)
+		RVC_LOG_W("map checkpoint failed");
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+/*
+ * Charges the battery model with the last interval of cleaning, or of idling away
+ * from the dock, and sends the robot home once the estimated charge only just
+ * covers the trip back. Time on the dock drains nothing the model could learn from.
+ */
+static Eina_Bool
+_energy_cb(void *data)
+{
+	pose_s pose = _get_pose();
+	float lin_vel = 0.f, ang_vel = 0.f;
+	float dock_x = 0.f, dock_y = 0.f;
+	clean_runner_state_e state = clean_runner_get_state(g_runner);
+
+	if (state == CLEAN_RUNNER_DOCKED)
+		return ECORE_CALLBACK_RENEW;
+
+	if (state != CLEAN_RUNNER_IDLE)
+	{
+		rvc_get_lin_ang_vel(&lin_vel, &ang_vel);
+		energy_planner_observe_motion(g_energy, ENERGY_INTERVAL, g_suction, lin_vel);
+	}
+	else
+	{
+		energy_planner_observe_idle(g_energy, ENERGY_INTERVAL);
+	}
+
+	map_store_get_dock(g_map, &dock_x, &dock_y, NULL);
+	if (state != CLEAN_RUNNER_RETURNING && energy_planner_should_dock(g_energy, hypotf(pose.x - dock_x, pose.y - dock_y)))
+	{
+		RVC_LOG_I("charge %.2f left, returning to dock", energy_planner_get_charge(g_energy));
+		clean_runner_send_home(g_runner);
+	}
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+static Eina_Bool
+_filter_cb(void *data)
+{
+	sensor_filter_tick(g_filter, _now_ms());
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+static Eina_Bool
+_pose_graph_cb(void *data)
+{
+	pose_graph_optimize(g_graph, POSE_GRAPH_BUDGET_US);
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+static void
+_log_filter_stats(void)
+{
+	static const char *names[SENSOR_FILTER_TYPE_MAX] = { "bumper", "cliff", "lift", "magnet" };
+	sensor_filter_stats_s stats;
+	int t;
+
+	for (t = 0; t < SENSOR_FILTER_TYPE_MAX; t++)
+	{
+		if (sensor_filter_get_stats(g_filter, t, &stats) == SENSOR_FILTER_ERROR_NONE && stats.events)
+			RVC_LOG_I("%s: %u events, %u reported, %u absorbed, %u storms", names[t], stats.events, stats.reported, stats.absorbed, stats.storms);
+	}
+}
+
+static void
+_log_graph_stats(void)
+{
+	pose_graph_stats_s stats;
+
+	if (pose_graph_get_stats(g_graph, &stats) == POSE_GRAPH_ERROR_NONE)
+		RVC_LOG_I("pose graph: %u keyframes, %u landmarks, %u observations, %u dropped, %u steps, correction %.0f",
+			stats.nodes, stats.landmarks, stats.observations, stats.dropped, stats.iterations, stats.correction);
+}
+
+void *t_func(void *data)
+{
+	clean_runner_run(g_runner);
+
+	return NULL;
+}
+
+/* Releases what service_app_create() set up, also after a partial start. */
+static void
+_shutdown(void)
+{
+	_unregister_callback();
+	rvc_deinitialize();
+
+	if (g_checkpoint_timer)
+	{
+		ecore_timer_del(g_checkpoint_timer);
+		g_checkpoint_timer = NULL;
+	}
+	if (g_filter_timer)
+	{
+		ecore_timer_del(g_filter_timer);
+		g_filter_timer = NULL;
+	}
+	_log_filter_stats();
+	sensor_filter_destroy(g_filter);
+	g_filter = NULL;
+	if (g_energy_timer)
+	{
+		ecore_timer_del(g_energy_timer);
+		g_energy_timer = NULL;
+	}
+	energy_planner_destroy(g_energy);
+	g_energy = NULL;
+	if (g_graph_timer)
+	{
+		ecore_timer_del(g_graph_timer);
+		g_graph_timer = NULL;
+	}
+	_log_graph_stats();
+	pose_graph_destroy(g_graph);
+	g_graph = NULL;
+	clean_runner_destroy(g_runner);
+	g_runner = NULL;
+	motion_planner_destroy(g_planner);
+	g_planner = NULL;
+	clean_jobs_destroy(g_jobs);
+	g_jobs = NULL;
+	_close_map();
+
+	rvc_log_shutdown();
+}
+
 bool service_app_create(void *data)
 {
+	rvc_log_config_s log_config;
+
+	rvc_log_config_default(&log_config);
+	log_config.sink = _dlog_sink;
+	rvc_log_init(&log_config);
+
 	if(rvc_initialize()!=RVC_USER_ERROR_NONE)
 	{
 		return false;
 	}
 
+	if (!_open_map())
+	{
+		goto fail;
+	}
+
+	energy_planner_config_s energy_config;
+
+	energy_planner_config_default(&energy_config);
+	if (energy_planner_create(&energy_config, &g_energy) != ENERGY_PLANNER_ERROR_NONE)
+	{
+		goto fail;
+	}
+
+	sensor_filter_config_s filter_config;
+
+	sensor_filter_config_default(&filter_config);
+	if (sensor_filter_create(&filter_config, _filtered_callback, NULL, &g_filter) != SENSOR_FILTER_ERROR_NONE)
+	{
+		goto fail;
+	}
+
+	pose_graph_config_s graph_config;
+	float dock_x = 0.f, dock_y = 0.f, dock_q = 0.f;
+
+	pose_graph_config_default(&graph_config);
+	if (pose_graph_create(&graph_config, &g_graph) != POSE_GRAPH_ERROR_NONE)
+	{
+		goto fail;
+	}
+	map_store_get_dock(g_map, &dock_x, &dock_y, &dock_q);
+	pose_graph_set_dock(g_graph, dock_x, dock_y, dock_q);
+
+	motion_planner_config_s planner_config;
+
+	motion_planner_config_default(&planner_config);
+	planner_config.robot_radius = RVC_BODY_RADIUS;
+	if (motion_planner_create(&planner_config, &g_planner) != MOTION_PLANNER_ERROR_NONE)
+	{
+		goto fail;
+	}
+
+	if (clean_jobs_create(&g_jobs) != CLEAN_JOBS_ERROR_NONE)
+	{
+		goto fail;
+	}
+
+	char *data_path = app_get_data_path();
+
+	if (data_path)
+	{
+		snprintf(g_jobs_path, sizeof(g_jobs_path), "%s%s", data_path, JOBS_FILE_NAME);
+		free(data_path);
+		clean_jobs_load(g_jobs, g_jobs_path);
+	}
+
+	clean_runner_config_s runner_config;
+	clean_runner_env_s runner_env = {
+		.grid = g_grid,
+		.hazards = g_hazards,
+		.planner = g_planner,
+		.energy = g_energy,
+		.jobs = g_jobs,
+		.jobs_path = g_jobs_path[0] ? g_jobs_path : NULL,
+		.dock_x = dock_x,
+		.dock_y = dock_y,
+	};
+	clean_runner_ops_s runner_ops = { .get_pose = _runner_pose };
+
+	clean_runner_config_default(&runner_config);
+	runner_config.body_radius = RVC_BODY_RADIUS;
+	if (clean_runner_create(&runner_config, &runner_env, &runner_ops, &g_runner) != CLEAN_RUNNER_ERROR_NONE)
+	{
+		goto fail;
+	}
+
+	_register_callback();
+	g_filter_timer = ecore_timer_add(SENSOR_FILTER_INTERVAL, _filter_cb, NULL);
+	g_graph_timer = ecore_timer_add(POSE_GRAPH_INTERVAL, _pose_graph_cb, NULL);
+	g_checkpoint_timer = ecore_timer_add(MAP_CHECKPOINT_INTERVAL, _checkpoint_cb, NULL);
+	g_energy_timer = ecore_timer_add(ENERGY_INTERVAL, _energy_cb, NULL);
 
 	// Todo: add your code here.
 	int thread_id = pthread_create(&p_thread, NULL, t_func, NULL);
 
-	if (thread_id < 0)
+	if (thread_id != 0)
 	{
-		return false;
+		goto fail;
 	}
 
 	return true;
+
+fail:
+	// Without a terminate call the map would stay marked in use.
+	_shutdown();
+	return false;
 }
 
 void service_app_terminate(void *data)
 {
-	rvc_deinitialize();
-
 	// Todo: add your code here.
 	int p_thread_status;
 
+	// The cleaning thread drives the robot, so it has to stop before the rvc API goes away.
+	clean_runner_stop(g_runner);
 	pthread_join(p_thread, (void **)&p_thread_status);
 
+	_shutdown();
+
     return;
 }
 
+static char *
+_get_extra(app_control_h app_control, const char *key)
+{
+	char *value = NULL;
+
+	if (app_control_get_extra_data(app_control, key, &value) != APP_CONTROL_ERROR_NONE)
+		return NULL;
+
+	return value;
+}
+
+/*
+ * Edits the cleaning queue from app_control extra data:
+ *   operation=suction, x, y, suction=silent|normal|turbo   lowest suction of a room
+ *   operation=move, x, y, position                        queue position of a room, 0 first
+ * (x, y) is any point of the room in rvc_get_pose() units. The cleaning thread
+ * applies the edits before it starts the next room.
+ */
 void service_app_control(app_control_h app_control, void *data)
 {
-    // Todo: add your code here.
-    return;
+	char *operation = _get_extra(app_control, "operation");
+	char *x = _get_extra(app_control, "x");
+	char *y = _get_extra(app_control, "y");
+	char *value = NULL;
+	clean_runner_edit_e type = CLEAN_RUNNER_EDIT_SUCTION;
+	int edit_value = 0;
+	bool valid = false;
+
+	if (operation && x && y)
+	{
+		if (strcmp(operation, "suction") == 0 && (value = _get_extra(app_control, "suction")))
+		{
+			valid = true;
+			if (strcmp(value, "silent") == 0)
+				edit_value = RVC_SUCTION_SLIENT;
+			else if (strcmp(value, "normal") == 0)
+				edit_value = RVC_SUCTION_NORMAL;
+			else if (strcmp(value, "turbo") == 0)
+				edit_value = RVC_SUCTION_TURBO;
+			else
+				valid = false;
+		}
+		else if (strcmp(operation, "move") == 0 && (value = _get_extra(app_control, "position")))
+		{
+			type = CLEAN_RUNNER_EDIT_MOVE;
+			edit_value = atoi(value);
+			valid = true;
+		}
+	}
+
+	if (!valid)
+	{
+		// A plain launch carries no operation
+		if (operation)
+			RVC_LOG_W("unsupported app control request '%s'", operation);
+	}
+	else if (clean_runner_edit(g_runner, type, strtof(x, NULL), strtof(y, NULL), edit_value) != CLEAN_RUNNER_ERROR_NONE)
+	{
+		RVC_LOG_W("too many pending job edits");
+	}
+
+	free(operation);
+	free(x);
+	free(y);
+	free(value);
 }
 
 static void
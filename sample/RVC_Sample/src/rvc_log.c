@@ -0,0 +1,521 @@
+/**
+ * @file	rvc_log.c
+ * @brief	Asynchronous logger with deferred formatting
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rvc_log.h"
+
+#define LOG_MESSAGE_MAX		512
+#define LOG_RECORD_MAX		(sizeof(log_record_s) + RVC_LOG_MAX_ARGS * (8 + RVC_LOG_MAX_STRING + 8))
+
+typedef enum {
+	RING_OWNED,
+	RING_ABANDONED,			// Owner thread exited; free for the next new thread
+} ring_state_e;
+
+/* Record header; arguments follow, each scalar in 8 bytes, strings as length + bytes. */
+typedef struct {
+	uint32_t size;							// Whole record, multiple of 8
+	uint32_t reserved;
+	uint64_t t_ns;
+	const rvc_log_site_s *site;				// NULL for padding up to the end of the ring
+} log_record_s;
+
+/*
+ * Single producer, single consumer byte ring. head is written only by the owner
+ * thread and tail only by the logger thread, so each side needs just an acquire
+ * load of the other's index and a release store of its own.
+ */
+typedef struct log_ring_s {
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t tail __attribute__((aligned(64)));
+	uint32_t dropped;
+	int state;
+	struct log_ring_s *next;
+	uint32_t mask;
+	unsigned char *data;
+} log_ring_s;
+
+static rvc_log_config_s g_config;
+static log_ring_s *g_rings;					// Grows at the head only, never shrinks while running
+static pthread_t g_thread;
+static pthread_key_t g_ring_key;
+static int g_running;
+static int g_stop;
+static __thread log_ring_s *t_ring;
+
+void rvc_log_config_default(rvc_log_config_s *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->ring_size = 64 * 1024;
+	config->poll_ms = 10;
+}
+
+void rvc_log_sink_stream(int level, uint64_t t_ns, const char *message, void *user_data)
+{
+	FILE *fp = user_data ? user_data : stdout;
+
+	fprintf(fp, "[%5llu.%06llu] %c %s\n", (unsigned long long)(t_ns / 1000000000ULL),
+		(unsigned long long)(t_ns % 1000000000ULL / 1000), "?EWID"[level >= 1 && level <= 4 ? level : 0], message);
+	fflush(fp);
+}
+
+static uint64_t
+_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+_release_ring(void *ring)
+{
+	__atomic_store_n(&((log_ring_s *)ring)->state, RING_ABANDONED, __ATOMIC_RELEASE);
+}
+
+/* Returns the ring of the calling thread, taking over an abandoned one if possible. */
+static log_ring_s *
+_get_ring(void)
+{
+	log_ring_s *ring;
+
+	if (t_ring)
+		return t_ring;
+
+	for (ring = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+	{
+		int expected = RING_ABANDONED;
+
+		if (__atomic_compare_exchange_n(&ring->state, &expected, RING_OWNED, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break;
+	}
+
+	if (!ring)
+	{
+		ring = calloc(1, sizeof(*ring));
+		if (!ring)
+			return NULL;
+		ring->data = malloc(g_config.ring_size);
+		if (!ring->data)
+		{
+			free(ring);
+			return NULL;
+		}
+		ring->mask = g_config.ring_size - 1;
+		ring->state = RING_OWNED;
+
+		ring->next = __atomic_load_n(&g_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&g_rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	pthread_setspecific(g_ring_key, ring);
+	t_ring = ring;
+
+	return ring;
+}
+
+/* Copies @a len bytes into the ring at position @a pos, which never wraps inside a record. */
+static inline void
+_ring_put(log_ring_s *ring, uint64_t pos, const void *data, size_t len)
+{
+	memcpy(ring->data + (pos & ring->mask), data, len);
+}
+
+void rvc_log_write(const rvc_log_site_s *site, ...)
+{
+	uint64_t buf[LOG_RECORD_MAX / 8 + 1];
+	log_record_s *rec = (log_record_s *)buf;
+	unsigned char *p = (unsigned char *)(rec + 1);
+	log_ring_s *ring;
+	uint64_t head, tail, offset;
+	uint32_t size, room;
+	va_list ap;
+	int i;
+
+	if (!__atomic_load_n(&g_running, __ATOMIC_ACQUIRE))
+		return;
+
+	ring = _get_ring();
+	if (!ring)
+		return;
+
+	rec->t_ns = _now_ns();
+	rec->site = site;
+	rec->reserved = 0;
+
+	va_start(ap, site);
+	for (i = 0; i < site->arg_count; i++)
+	{
+		union {
+			int64_t i;
+			uint64_t u;
+			double d;
+		} v;
+
+		switch (site->arg_types[i])
+		{
+		case RVC_LOG_ARG_INT:		v.i = va_arg(ap, int); break;
+		case RVC_LOG_ARG_UINT:		v.u = va_arg(ap, unsigned int); break;
+		case RVC_LOG_ARG_LONG:		v.i = va_arg(ap, long); break;
+		case RVC_LOG_ARG_ULONG:		v.u = va_arg(ap, unsigned long); break;
+		case RVC_LOG_ARG_LLONG:		v.i = va_arg(ap, long long); break;
+		case RVC_LOG_ARG_ULLONG:	v.u = va_arg(ap, unsigned long long); break;
+		case RVC_LOG_ARG_DOUBLE:	v.d = va_arg(ap, double); break;
+		case RVC_LOG_ARG_POINTER:	v.u = (uintptr_t)va_arg(ap, void *); break;
+		case RVC_LOG_ARG_STRING:
+		{
+			const char *s = va_arg(ap, const char *);
+			uint32_t len = s ? strnlen(s, RVC_LOG_MAX_STRING) : 0;
+
+			memcpy(p, &len, sizeof(len));
+			if (len)
+				memcpy(p + sizeof(len), s, len);
+			p += (sizeof(len) + len + 7) & ~7u;
+			continue;
+		}
+		default:
+			v.u = 0;
+			break;
+		}
+		memcpy(p, &v, 8);
+		p += 8;
+	}
+	va_end(ap);
+
+	size = p - (unsigned char *)rec;
+	rec->size = size;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	offset = head & ring->mask;
+	room = ring->mask + 1 - offset;
+
+	// A record never wraps: pad to the end of the ring first if it does not fit there.
+	if (size > room)
+	{
+		if (head + room + size - tail > ring->mask + 1)
+			goto full;
+
+		// A tail too short for a header is skipped by the consumer on its own.
+		if (room >= sizeof(log_record_s))
+		{
+			log_record_s pad = { room, 0, 0, NULL };
+
+			_ring_put(ring, head, &pad, sizeof(pad));
+		}
+		head += room;
+	}
+	else if (head + size - tail > ring->mask + 1)
+	{
+		goto full;
+	}
+
+	_ring_put(ring, head, rec, size);
+	__atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+
+	return;
+
+full:
+	__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Formatting, on the logger thread
+ */
+
+/* Formats one conversion of @a spec (without length modifier) with argument @a arg of type @a type. */
+static int
+_format_arg(char *out, size_t size, const char *spec, size_t spec_len, char conv,
+		rvc_log_arg_e type, const unsigned char *arg)
+{
+	char fmt[32];
+	int64_t i;
+	uint64_t u;
+	double d;
+
+	if (spec_len > sizeof(fmt) - 4)
+		spec_len = sizeof(fmt) - 4;
+	memcpy(fmt, spec, spec_len);
+
+	if (type == RVC_LOG_ARG_STRING)
+	{
+		uint32_t len;
+
+		memcpy(&len, arg, sizeof(len));
+		if (conv != 's')
+			return snprintf(out, size, "(str)");
+
+		fmt[spec_len] = 's';
+		fmt[spec_len + 1] = '\0';
+		{
+			char str[RVC_LOG_MAX_STRING + 1];
+
+			memcpy(str, arg + sizeof(len), len);
+			str[len] = '\0';
+			return snprintf(out, size, fmt, str);
+		}
+	}
+
+	memcpy(&i, arg, 8);
+	memcpy(&u, arg, 8);
+	memcpy(&d, arg, 8);
+
+	switch (conv)
+	{
+	case 'd': case 'i':
+		fmt[spec_len] = 'l';
+		fmt[spec_len + 1] = 'l';
+		fmt[spec_len + 2] = conv;
+		fmt[spec_len + 3] = '\0';
+		return snprintf(out, size, fmt, type == RVC_LOG_ARG_DOUBLE ? (long long)d : (long long)i);
+
+	case 'o': case 'u': case 'x': case 'X':
+		fmt[spec_len] = 'l';
+		fmt[spec_len + 1] = 'l';
+		fmt[spec_len + 2] = conv;
+		fmt[spec_len + 3] = '\0';
+		// Keep the width of the original type so negative values print as in printf.
+		if (type == RVC_LOG_ARG_INT)
+			u = (unsigned int)i;
+		else if (type == RVC_LOG_ARG_LONG)
+			u = (unsigned long)i;
+		else if (type == RVC_LOG_ARG_DOUBLE)
+			u = (unsigned long long)d;
+		return snprintf(out, size, fmt, (unsigned long long)u);
+
+	case 'c':
+		fmt[spec_len] = 'c';
+		fmt[spec_len + 1] = '\0';
+		return snprintf(out, size, fmt, (int)i);
+
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		fmt[spec_len] = conv;
+		fmt[spec_len + 1] = '\0';
+		if (type != RVC_LOG_ARG_DOUBLE)
+			d = (type == RVC_LOG_ARG_UINT || type == RVC_LOG_ARG_ULONG || type == RVC_LOG_ARG_ULLONG) ? (double)u : (double)i;
+		return snprintf(out, size, fmt, d);
+
+	case 'p':
+		return snprintf(out, size, "%p", (void *)(uintptr_t)u);
+
+	default:
+		return snprintf(out, size, "%%%c", conv);
+	}
+}
+
+static void
+_format(const log_record_s *rec, char *out, size_t size)
+{
+	const rvc_log_site_s *site = rec->site;
+	const unsigned char *arg = (const unsigned char *)(rec + 1);
+	const char *f = site->format;
+	size_t n = 0;
+	int next = 0;
+
+	while (*f && n + 1 < size)
+	{
+		const char *spec;
+		size_t spec_len;
+		int w;
+
+		if (*f != '%')
+		{
+			out[n++] = *f++;
+			continue;
+		}
+		if (f[1] == '%')
+		{
+			out[n++] = '%';
+			f += 2;
+			continue;
+		}
+
+		// Flags, width and precision are kept; length modifiers are replaced by the stored type.
+		spec = f++;
+		while (*f && strchr("-+ #0", *f))
+			f++;
+		while (*f >= '0' && *f <= '9')
+			f++;
+		if (*f == '.')
+		{
+			f++;
+			while (*f >= '0' && *f <= '9')
+				f++;
+		}
+		spec_len = f - spec;
+		while (*f && strchr("hlLqjzt", *f))
+			f++;
+		if (!*f)
+			break;
+
+		if (next >= site->arg_count)
+		{
+			w = snprintf(out + n, size - n, "(?)");
+		}
+		else
+		{
+			w = _format_arg(out + n, size - n, spec, spec_len, *f, site->arg_types[next], arg);
+			if (site->arg_types[next] == RVC_LOG_ARG_STRING)
+			{
+				uint32_t len;
+
+				memcpy(&len, arg, sizeof(len));
+				arg += (sizeof(len) + len + 7) & ~7u;
+			}
+			else
+			{
+				arg += 8;
+			}
+			next++;
+		}
+		f++;
+
+		if (w > 0)
+			n += (size_t)w < size - n ? (size_t)w : size - n - 1;
+	}
+
+	out[n] = '\0';
+}
+
+/* Drains one ring; returns the number of records handled. */
+static int
+_drain(log_ring_s *ring)
+{
+	char message[LOG_MESSAGE_MAX];
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint32_t dropped;
+	int count = 0;
+
+	while (tail < head)
+	{
+		uint64_t offset = tail & ring->mask;
+		uint64_t room = ring->mask + 1 - offset;
+		const log_record_s *rec = (const log_record_s *)(ring->data + offset);
+
+		if (room < sizeof(log_record_s) || !rec->site)
+		{
+			tail += room;
+			continue;
+		}
+
+		_format(rec, message, sizeof(message));
+		g_config.sink(rec->site->level, rec->t_ns, message, g_config.sink_data);
+		tail += rec->size;
+		count++;
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+	{
+		snprintf(message, sizeof(message), "%u log messages dropped", dropped);
+		g_config.sink(RVC_LOG_LEVEL_WARN, _now_ns(), message, g_config.sink_data);
+	}
+
+	return count;
+}
+
+static void *
+_log_thread(void *data)
+{
+	struct timespec ts = { g_config.poll_ms / 1000, (g_config.poll_ms % 1000) * 1000000L };
+
+	for (;;)
+	{
+		int stop = __atomic_load_n(&g_stop, __ATOMIC_ACQUIRE);
+		log_ring_s *ring;
+		int count = 0;
+
+		for (ring = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+			count += _drain(ring);
+
+		// Rings are drained once more after the stop request, so nothing logged before it is lost.
+		if (stop)
+			break;
+		if (!count)
+			nanosleep(&ts, NULL);
+	}
+
+	return NULL;
+}
+
+int rvc_log_init(const rvc_log_config_s *config)
+{
+	rvc_log_config_s defaults;
+
+	if (__atomic_load_n(&g_running, __ATOMIC_ACQUIRE))
+		return RVC_LOG_ERROR_ALREADY_RUNNING;
+
+	if (!config)
+	{
+		rvc_log_config_default(&defaults);
+		config = &defaults;
+	}
+	if (config->ring_size < 1024 || (config->ring_size & (config->ring_size - 1)))
+		return RVC_LOG_ERROR_INVALID_PARAMETER;
+
+	g_config = *config;
+	if (!g_config.sink)
+		g_config.sink = rvc_log_sink_stream;
+	if (!g_config.poll_ms)
+		g_config.poll_ms = 1;
+
+	if (pthread_key_create(&g_ring_key, _release_ring) != 0)
+		return RVC_LOG_ERROR_THREAD;
+
+	g_stop = 0;
+	if (pthread_create(&g_thread, NULL, _log_thread, NULL) != 0)
+	{
+		pthread_key_delete(g_ring_key);
+		return RVC_LOG_ERROR_THREAD;
+	}
+
+	__atomic_store_n(&g_running, 1, __ATOMIC_RELEASE);
+
+	return RVC_LOG_ERROR_NONE;
+}
+
+void rvc_log_flush(void)
+{
+	struct timespec ts = { 0, 1000000L };
+	log_ring_s *ring;
+
+	if (!__atomic_load_n(&g_running, __ATOMIC_ACQUIRE))
+		return;
+
+	for (ring = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+	{
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < head)
+			nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * Threads still logging during shutdown lose their messages but never touch
+ * freed memory: the rings stay allocated and are reused by the next rvc_log_init().
+ */
+void rvc_log_shutdown(void)
+{
+	if (!__atomic_load_n(&g_running, __ATOMIC_ACQUIRE))
+		return;
+
+	__atomic_store_n(&g_running, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&g_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(g_thread, NULL);
+
+	pthread_key_delete(g_ring_key);
+}
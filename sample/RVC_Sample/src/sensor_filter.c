@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pthread.h"
+
+#include "sensor_filter.h"
+
+#define SENSOR_COUNT	3	// left, center, right
+
+typedef struct {
+	bool raw;
+	bool active;					// Reported state
+	bool storm;
+	unsigned long long raw_clear_ms;	// When the raw signal last went clear
+	unsigned long long active_ms;		// When the sensor was last reported active
+	unsigned long long rises[SENSOR_FILTER_MAX_RATE];	// Latest reported activations, ring
+	unsigned int rise_next;
+	unsigned int rise_count;
+} sensor_channel_s;
+
+typedef struct {
+	sensor_channel_s channels[SENSOR_COUNT];
+	unsigned char active;
+	sensor_filter_stats_s stats;
+} sensor_type_s;
+
+struct sensor_filter_s {
+	sensor_filter_config_s config;
+	sensor_type_s types[SENSOR_FILTER_TYPE_MAX];
+	sensor_filter_cb callback;
+	void *user_data;
+	pthread_mutex_t lock;
+};
+
+void sensor_filter_config_default(sensor_filter_config_s *config)
+{
+	static const sensor_filter_params_s defaults[SENSOR_FILTER_TYPE_MAX] = {
+		// release, min active, rate cap, window, storm release
+		{ 60, 100, 4, 2000, 500 },		// Bumper: switch bounce, then chatter along a wall
+		{ 100, 150, 4, 2000, 1000 },	// Cliff: dark carpet and edges flicker
+		{ 150, 300, 3, 3000, 1000 },	// Lift: thick carpet bounces the wheels
+		{ 100, 150, 4, 2000, 1000 },	// Magnet strip
+	};
+
+	memcpy(config->params, defaults, sizeof(defaults));
+}
+
+int sensor_filter_create(const sensor_filter_config_s *config, sensor_filter_cb callback, void *user_data, sensor_filter_h *filter)
+{
+	struct sensor_filter_s *f;
+	int t;
+
+	if (!config || !callback || !filter)
+		return SENSOR_FILTER_ERROR_INVALID_PARAMETER;
+
+	for (t = 0; t < SENSOR_FILTER_TYPE_MAX; t++)
+	{
+		if (config->params[t].rate_cap > SENSOR_FILTER_MAX_RATE)
+			return SENSOR_FILTER_ERROR_INVALID_PARAMETER;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return SENSOR_FILTER_ERROR_OUT_OF_MEMORY;
+
+	f->config = *config;
+	f->callback = callback;
+	f->user_data = user_data;
+	pthread_mutex_init(&f->lock, NULL);
+
+	*filter = f;
+
+	return SENSOR_FILTER_ERROR_NONE;
+}
+
+void sensor_filter_destroy(sensor_filter_h filter)
+{
+	if (!filter)
+		return;
+
+	pthread_mutex_destroy(&filter->lock);
+	free(filter);
+}
+
+/* Records a reported activation and updates the storm state. */
+static void
+_note_rise(const sensor_filter_params_s *p, sensor_channel_s *ch, sensor_type_s *st, unsigned long long now_ms)
+{
+	bool storm;
+
+	if (p->rate_cap == 0)
+		return;
+
+	ch->rises[ch->rise_next] = now_ms;
+	ch->rise_next = (ch->rise_next + 1) % p->rate_cap;
+	if (ch->rise_count < p->rate_cap)
+		ch->rise_count++;
+
+	// rise_next now points at the oldest of the last rate_cap activations.
+	storm = ch->rise_count == p->rate_cap && now_ms - ch->rises[ch->rise_next] < p->rate_window_ms;
+	if (storm && !ch->storm)
+		st->stats.storms++;
+	ch->storm = storm;
+}
+
+/* Releases the sensors whose quiet and dwell periods are over. Returns the new reported mask. */
+static unsigned char
+_update_releases(const sensor_filter_params_s *p, sensor_type_s *st, unsigned long long now_ms)
+{
+	unsigned char active = 0;
+	int i;
+
+	for (i = 0; i < SENSOR_COUNT; i++)
+	{
+		sensor_channel_s *ch = &st->channels[i];
+
+		if (ch->active && !ch->raw)
+		{
+			unsigned long long quiet = ch->raw_clear_ms + (ch->storm ? p->storm_release_ms : p->release_ms);
+			unsigned long long dwell = ch->active_ms + p->min_active_ms;
+
+			if (now_ms >= quiet && now_ms >= dwell)
+				ch->active = false;
+		}
+
+		if (ch->active)
+			active |= 1 << i;
+	}
+
+	return active;
+}
+
+int sensor_filter_input(sensor_filter_h filter, sensor_filter_type_e type, unsigned char raw, unsigned long long now_ms)
+{
+	struct sensor_filter_s *f = filter;
+	const sensor_filter_params_s *p;
+	sensor_type_s *st;
+	unsigned char active, rising = 0;
+	int i;
+
+	if (!f || type < 0 || type >= SENSOR_FILTER_TYPE_MAX)
+		return SENSOR_FILTER_ERROR_INVALID_PARAMETER;
+
+	p = &f->config.params[type];
+
+	pthread_mutex_lock(&f->lock);
+
+	st = &f->types[type];
+	st->stats.events++;
+
+	for (i = 0; i < SENSOR_COUNT; i++)
+	{
+		sensor_channel_s *ch = &st->channels[i];
+		bool on = raw & (1 << i);
+
+		if (on && !ch->raw)
+		{
+			// The first edge of a hazard goes through without any delay.
+			if (!ch->active)
+			{
+				ch->active = true;
+				ch->active_ms = now_ms;
+				rising |= 1 << i;
+				_note_rise(p, ch, st, now_ms);
+			}
+		}
+		else if (!on && ch->raw)
+		{
+			ch->raw_clear_ms = now_ms;
+		}
+		ch->raw = on;
+	}
+
+	active = _update_releases(p, st, now_ms);
+	if (active != st->active)
+	{
+		st->active = active;
+		st->stats.reported++;
+		f->callback(type, active, rising, f->user_data);
+	}
+	else
+	{
+		st->stats.absorbed++;
+	}
+
+	pthread_mutex_unlock(&f->lock);
+
+	return SENSOR_FILTER_ERROR_NONE;
+}
+
+int sensor_filter_tick(sensor_filter_h filter, unsigned long long now_ms)
+{
+	struct sensor_filter_s *f = filter;
+	int t;
+
+	if (!f)
+		return SENSOR_FILTER_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&f->lock);
+
+	for (t = 0; t < SENSOR_FILTER_TYPE_MAX; t++)
+	{
+		sensor_type_s *st = &f->types[t];
+		unsigned char active;
+
+		if (!st->active)
+			continue;
+
+		active = _update_releases(&f->config.params[t], st, now_ms);
+		if (active != st->active)
+		{
+			st->active = active;
+			st->stats.reported++;
+			f->callback(t, active, 0, f->user_data);
+		}
+	}
+
+	pthread_mutex_unlock(&f->lock);
+
+	return SENSOR_FILTER_ERROR_NONE;
+}
+
+int sensor_filter_get_stats(sensor_filter_h filter, sensor_filter_type_e type, sensor_filter_stats_s *stats)
+{
+	if (!filter || type < 0 || type >= SENSOR_FILTER_TYPE_MAX || !stats)
+		return SENSOR_FILTER_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&filter->lock);
+	*stats = filter->types[type].stats;
+	pthread_mutex_unlock(&filter->lock);
+
+	return SENSOR_FILTER_ERROR_NONE;
+}
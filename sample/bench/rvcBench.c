@@ -0,0 +1,634 @@
+/**
+ * @file	rvcBench.c
+ * @brief	Headless golden-trajectory regression benchmark for RVC control code
+ *
+ * Runs a catalogue of scenarios against the simulated RVC (sim/rvc_sim.c),
+ * samples the robot pose on the simulator clock and compares the trajectory
+ * and scenario timings with golden runs stored in golden/<scenario>.csv.
+ * One JSON object per scenario is written to stdout; the exit status is
+ * non-zero if any scenario regressed.
+ *
+ * The scenarios run the control code itself: the planning test modes of
+ * userApp.c through plan_bench.c, and the service's lane follower, room
+ * segmentation and job queue through RVC_Sample/src/clean_runner.c, all on the
+ * simulator clock.
+ *
+ * Build on a desktop:
+ *   S=../RVC_Sample/src
+ *   cc -I. -I.. -I../sim -I../RVC_Sample/inc -I<dir of rvc_api.h> rvcBench.c ../plan_bench.c ../sim/rvc_sim.c \
+ *     $S/clean_runner.c $S/clean_jobs.c $S/room_map.c $S/motion_planner.c $S/energy_planner.c \
+ *     $S/occupancy_grid.c $S/hazard_index.c $S/file_util.c $S/rvc_log.c -lm -lpthread
+ *
+ * Usage: rvcBench [--golden DIR] [--record] [scenario ...]
+ *   --record	rewrite the golden files from this run instead of comparing
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "rvc_api.h"	// RVC API
+#include "rvc_sim.h"
+#include "plan_bench.h"
+#include "occupancy_grid.h"
+#include "motion_planner.h"
+#include "energy_planner.h"
+#include "clean_jobs.h"
+#include "clean_runner.h"
+
+#define BENCH_STEP_MS		10		// Simulator resolution
+#define BENCH_TICK_MS		50		// Control tick of the scenarios
+#define BENCH_SAMPLE_MS		500		// Trajectory sampling period
+#define BENCH_MAX_SAMPLES	4096
+#define BENCH_SEED			20161	// Fixed seed so bounces in auto cleaning repeat
+#define BENCH_GRID_SIZE		200		// Cells per side of the scenario maps
+#define BENCH_GRID_RESOLUTION	50.f	// 5 cm cells like the service, 10 m square map
+#define BENCH_PLAN_BUDGET_US	1000000	// Enough for every motion candidate, so plans do not depend on CPU speed
+#define BENCH_SERVICE_LIMIT_MS	3600000	// Simulated time after which the service is stopped
+
+typedef struct {
+	unsigned long long t_ms;
+	float x, y, q;
+} bench_sample_s;
+
+typedef struct {
+	bench_sample_s samples[BENCH_MAX_SAMPLES];
+	int count;
+	unsigned long long next_ms;
+	unsigned long long duration_ms;	// Scenario specific completion time
+} bench_run_s;
+
+typedef struct {
+	const char *name;
+	void (*run)(bench_run_s *run);
+	float pos_tolerance;		// Max position error per sample, mm
+	float q_tolerance;			// Max heading error per sample, rad
+	unsigned int time_tolerance_ms;	// Max difference of the completion time
+	void (*configure)(rvc_sim_config_s *config);	// Adjusts the simulated world, may be NULL
+} bench_scenario_s;
+
+/* The service's cleaning logic with the handles it works on. */
+typedef struct {
+	occupancy_grid_h grid;
+	motion_planner_h planner;
+	energy_planner_h energy;
+	clean_jobs_h jobs;
+	clean_runner_h runner;
+	unsigned long long home_at_ms;	// Sends the robot home at this time, 0 for never
+} bench_service_s;
+
+static bench_run_s g_run;
+static bench_service_s g_service;
+
+static void
+_sample(bench_run_s *run)
+{
+	unsigned long long now = rvc_sim_now_ms();
+
+	while (now >= run->next_ms && run->count < BENCH_MAX_SAMPLES)
+	{
+		bench_sample_s *s = &run->samples[run->count++];
+
+		s->t_ms = run->next_ms;
+		rvc_get_pose(&s->x, &s->y, &s->q);
+		run->next_ms += BENCH_SAMPLE_MS;
+	}
+}
+
+/* Advances the simulator by @a ms, sampling the trajectory on the way. */
+static void
+_advance(bench_run_s *run, unsigned int ms)
+{
+	unsigned int t;
+
+	for (t = 0; t < ms; t += BENCH_STEP_MS)
+	{
+		rvc_sim_step(BENCH_STEP_MS);
+		_sample(run);
+	}
+}
+
+static unsigned long long
+_sim_now_us(void *data)
+{
+	return rvc_sim_now_ms() * 1000ULL;
+}
+
+static void
+_sim_sleep_until_us(unsigned long long deadline_us, void *data)
+{
+	while (rvc_sim_now_ms() * 1000ULL < deadline_us)
+		_advance(data, BENCH_STEP_MS);
+}
+
+/*
+ * Scenarios
+ */
+
+static void
+_run_plan(bench_run_s *run, const plan_script_s *script)
+{
+	plan_clock_s clock = { _sim_now_us, _sim_sleep_until_us, run };
+	plan_result_s result;
+
+	plan_bench_run(script, &clock, &result);
+	rvc_set_mode(RVC_MODE_SET_PAUSE);
+	run->duration_ms = rvc_sim_now_ms();
+	_advance(run, 1000);
+}
+
+/* Test planning mode 'e' of userApp.c */
+static void
+_scenario_plan_lin_ang(bench_run_s *run)
+{
+	_run_plan(run, &plan_script_lin_ang);
+}
+
+/* Test planning mode 'f' of userApp.c */
+static void
+_scenario_plan_wheel_vel(bench_run_s *run)
+{
+	_run_plan(run, &plan_script_wheel_vel);
+}
+
+/*
+ * Service scenarios: the callbacks report to the runner the way rvc.c does, and
+ * the runner sleeps by stepping the simulator.
+ */
+
+static unsigned long long
+_service_now_us(void *data)
+{
+	return rvc_sim_now_ms() * 1000ULL;
+}
+
+static void
+_service_sleep_us(unsigned int us, void *data)
+{
+	_advance(data, us / 1000);
+
+	// A runner that never finishes would hang the bench; a stopped one fails the comparison instead.
+	if (rvc_sim_now_ms() >= BENCH_SERVICE_LIMIT_MS)
+		clean_runner_stop(g_service.runner);
+	if (g_service.home_at_ms && rvc_sim_now_ms() >= g_service.home_at_ms)
+	{
+		g_service.home_at_ms = 0;
+		clean_runner_send_home(g_service.runner);
+	}
+}
+
+static void
+_service_get_pose(float *x, float *y, float *q, void *data)
+{
+	rvc_get_pose(x, y, q);
+}
+
+static void
+_service_mode_cb(rvc_mode_type_get_e mode, void *data)
+{
+	if (mode != RVC_MODE_GET_DOCKING)
+		clean_runner_arrived(g_service.runner);
+}
+
+static void
+_service_bumper_cb(unsigned char left, unsigned char right, void *data)
+{
+	if (left || right)
+		clean_runner_contact(g_service.runner);
+}
+
+static void
+_service_cliff_cb(unsigned char left, unsigned char center, unsigned char right, void *data)
+{
+	if (left || center || right)
+		clean_runner_contact(g_service.runner);
+}
+
+static void
+_service_batt_cb(rvc_batt_level_e level, void *data)
+{
+	static int last_level = -1;
+
+	if ((int)level > last_level)
+		clean_runner_charging(g_service.runner);
+	last_level = level;
+
+	energy_planner_observe_level(g_service.energy, level);
+}
+
+/* Marks the walls of a room and its free floor, as the service maps them. */
+static void
+_map_room(float min_x, float min_y, float max_x, float max_y)
+{
+	float x, y, step = BENCH_GRID_RESOLUTION;
+
+	for (x = min_x - step; x <= max_x + step; x += step)
+	{
+		occupancy_grid_mark_occupied(g_service.grid, x, min_y - 0.5f * step);
+		occupancy_grid_mark_occupied(g_service.grid, x, max_y + 0.5f * step);
+	}
+	for (y = min_y - step; y <= max_y + step; y += step)
+	{
+		occupancy_grid_mark_occupied(g_service.grid, min_x - 0.5f * step, y);
+		occupancy_grid_mark_occupied(g_service.grid, max_x + 0.5f * step, y);
+	}
+}
+
+/* Marks an obstacle the simulator does not know about, like a remembered hazard. */
+static void
+_map_block(float min_x, float min_y, float max_x, float max_y)
+{
+	float x, y, step = BENCH_GRID_RESOLUTION;
+
+	for (x = min_x; x <= max_x; x += step)
+	{
+		for (y = min_y; y <= max_y; y += step)
+			occupancy_grid_mark_occupied(g_service.grid, x, y);
+	}
+}
+
+static void
+_map_floor(float min_x, float min_y, float max_x, float max_y)
+{
+	float x, y, step = BENCH_GRID_RESOLUTION;
+
+	for (x = min_x + 0.5f * step; x < max_x; x += step)
+	{
+		for (y = min_y + 0.5f * step; y < max_y; y += step)
+			occupancy_grid_mark_free(g_service.grid, x, y, 0.5f * step);
+	}
+}
+
+static bool
+_service_start(bench_run_s *run)
+{
+	motion_planner_config_s planner_config;
+	energy_planner_config_s energy_config;
+	clean_runner_config_s runner_config;
+	clean_runner_env_s env = { .dock_x = 0.f, .dock_y = 0.f };
+	clean_runner_ops_s ops = { _service_now_us, _service_sleep_us, _service_get_pose, run };
+	rvc_batt_level_e level;
+
+	memset(&g_service, 0, sizeof(g_service));
+
+	// Single threaded planning with a budget it never reaches: the same candidates every run.
+	motion_planner_config_default(&planner_config);
+	planner_config.threads = 0;
+	energy_planner_config_default(&energy_config);
+	clean_runner_config_default(&runner_config);
+	runner_config.plan_budget_us = BENCH_PLAN_BUDGET_US;
+
+	if (occupancy_grid_create(BENCH_GRID_SIZE, BENCH_GRID_SIZE, BENCH_GRID_RESOLUTION, &g_service.grid) != OCCUPANCY_GRID_ERROR_NONE
+			|| motion_planner_create(&planner_config, &g_service.planner) != MOTION_PLANNER_ERROR_NONE
+			|| energy_planner_create(&energy_config, &g_service.energy) != ENERGY_PLANNER_ERROR_NONE
+			|| clean_jobs_create(&g_service.jobs) != CLEAN_JOBS_ERROR_NONE)
+		return false;
+
+	env.grid = g_service.grid;
+	env.planner = g_service.planner;
+	env.energy = g_service.energy;
+	env.jobs = g_service.jobs;
+	if (clean_runner_create(&runner_config, &env, &ops, &g_service.runner) != CLEAN_RUNNER_ERROR_NONE)
+		return false;
+
+	if (rvc_get_battery_level(&level) == RVC_USER_ERROR_NONE)
+		_service_batt_cb(level, NULL);
+	rvc_set_mode_evt_cb(_service_mode_cb, NULL);
+	rvc_set_bumper_evt_cb(_service_bumper_cb, NULL);
+	rvc_set_cliff_evt_cb(_service_cliff_cb, NULL);
+	rvc_set_batt_evt_cb(_service_batt_cb, NULL);
+
+	return true;
+}
+
+static void
+_service_stop(void)
+{
+	rvc_unset_mode_evt_cb();
+	rvc_unset_bumper_evt_cb();
+	rvc_unset_cliff_evt_cb();
+	rvc_unset_batt_evt_cb();
+
+	clean_runner_destroy(g_service.runner);
+	clean_jobs_destroy(g_service.jobs);
+	energy_planner_destroy(g_service.energy);
+	motion_planner_destroy(g_service.planner);
+	occupancy_grid_destroy(g_service.grid);
+	memset(&g_service, 0, sizeof(g_service));
+}
+
+/* Waits up to two minutes for the robot to reach its dock. Returns the time it arrived, or 0. */
+static unsigned long long
+_wait_docked(bench_run_s *run)
+{
+	rvc_sim_state_s state;
+	unsigned long long start = rvc_sim_now_ms();
+
+	do
+	{
+		_advance(run, BENCH_TICK_MS);
+		rvc_sim_get_state(&state);
+	} while (!state.docked && rvc_sim_now_ms() - start < 120000);
+
+	return state.docked ? rvc_sim_now_ms() : 0;
+}
+
+/*
+ * The lane follower and motion planner: waypoints around a mapped block the
+ * straight line runs through. Duration is the time to the last waypoint.
+ */
+static void
+_scenario_drive(bench_run_s *run)
+{
+	static const float waypoints[][2] = { { 2500.f, 0.f }, { 2500.f, 1500.f }, { 0.f, 1500.f }, { 0.f, 0.f } };
+	rvc_sim_config_s config;
+	int i;
+
+	if (!_service_start(run))
+		return;
+
+	rvc_sim_config_default(&config);
+	_map_room(config.room_min_x, config.room_min_y, config.room_max_x, config.room_max_y);
+	_map_block(1000.f, 150.f, 1400.f, 450.f);
+	_map_floor(config.room_min_x, config.room_min_y, config.room_max_x, config.room_max_y);
+
+	for (i = 0; i < (int)(sizeof(waypoints) / sizeof(waypoints[0])); i++)
+	{
+		if (clean_runner_drive_to(g_service.runner, waypoints[i][0], waypoints[i][1], 250.f) != CLEAN_RUNNER_DRIVE_REACHED)
+			break;
+	}
+	run->duration_ms = i == (int)(sizeof(waypoints) / sizeof(waypoints[0])) ? rvc_sim_now_ms() : 0;
+	_advance(run, 1000);
+
+	_service_stop();
+}
+
+/* Two rooms, 1.5 x 3 m each, joined by a 60 cm door. */
+#define ROOMS_MIN_X		-500.f
+#define ROOMS_MIN_Y		-1500.f
+#define ROOMS_MAX_X		2500.f
+#define ROOMS_MAX_Y		1500.f
+#define ROOMS_WALL_X	1000.f
+#define ROOMS_DOOR		300.f	// Half width of the door
+
+static void
+_configure_rooms(rvc_sim_config_s *config)
+{
+	config->room_min_x = ROOMS_MIN_X;
+	config->room_min_y = ROOMS_MIN_Y;
+	config->room_max_x = ROOMS_MAX_X;
+	config->room_max_y = ROOMS_MAX_Y;
+}
+
+/*
+ * The dividing wall is only on the map; the simulator has one rectangular room,
+ * so the wall is kept by the motion planner alone.
+ */
+static void
+_map_rooms(void)
+{
+	_map_room(ROOMS_MIN_X, ROOMS_MIN_Y, ROOMS_MAX_X, ROOMS_MAX_Y);
+	_map_block(ROOMS_WALL_X, ROOMS_MIN_Y, ROOMS_WALL_X + BENCH_GRID_RESOLUTION, -ROOMS_DOOR);
+	_map_block(ROOMS_WALL_X, ROOMS_DOOR, ROOMS_WALL_X + BENCH_GRID_RESOLUTION, ROOMS_MAX_Y);
+	_map_floor(ROOMS_MIN_X, ROOMS_MIN_Y, ROOMS_MAX_X, ROOMS_MAX_Y);
+}
+
+/*
+ * Room segmentation, the job queue and the room sweeps from the dock. Duration is
+ * the time the robot is back on the dock.
+ */
+static void
+_scenario_rooms(bench_run_s *run)
+{
+	if (!_service_start(run))
+		return;
+
+	_map_rooms();
+	clean_runner_run(g_service.runner);
+	run->duration_ms = _wait_docked(run);
+	_advance(run, 1000);
+
+	_service_stop();
+}
+
+/*
+ * Same rooms, but the robot is sent home a minute in, as on low battery. The
+ * runner has to dock, wait for charge and resume the queue from the saved lane.
+ */
+static void
+_scenario_resume(bench_run_s *run)
+{
+	if (!_service_start(run))
+		return;
+
+	_map_rooms();
+	g_service.home_at_ms = 60000;
+	clean_runner_run(g_service.runner);
+	run->duration_ms = _wait_docked(run);
+	_advance(run, 1000);
+
+	_service_stop();
+}
+
+static const bench_scenario_s g_scenarios[] = {
+	{ "plan_lin_ang", _scenario_plan_lin_ang, 2.f, 0.002f, 0 },
+	{ "plan_wheel_vel", _scenario_plan_wheel_vel, 2.f, 0.002f, 0 },
+	{ "drive", _scenario_drive, 20.f, 0.02f, 500 },
+	{ "rooms", _scenario_rooms, 50.f, 0.05f, 2000, _configure_rooms },
+	{ "resume", _scenario_resume, 50.f, 0.05f, 2000, _configure_rooms },
+};
+
+#define BENCH_SCENARIO_COUNT	(int)(sizeof(g_scenarios) / sizeof(g_scenarios[0]))
+
+/*
+ * Golden files: one comment line with the completion time, then t_ms,x,y,q per sample.
+ */
+
+static int
+_write_golden(const char *dir, const char *name, const bench_run_s *run)
+{
+	char path[512];
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/%s.csv", dir, name);
+	fp = fopen(path, "w");
+	if (!fp)
+		return -1;
+
+	fprintf(fp, "# duration_ms %llu\n", run->duration_ms);
+	for (i = 0; i < run->count; i++)
+	{
+		const bench_sample_s *s = &run->samples[i];
+
+		fprintf(fp, "%llu,%.3f,%.3f,%.5f\n", s->t_ms, s->x, s->y, s->q);
+	}
+
+	return fclose(fp) == 0 ? 0 : -1;
+}
+
+static int
+_read_golden(const char *dir, const char *name, bench_run_s *golden)
+{
+	char path[512];
+	char line[128];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s.csv", dir, name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	golden->count = 0;
+	golden->duration_ms = 0;
+	while (fgets(line, sizeof(line), fp) && golden->count < BENCH_MAX_SAMPLES)
+	{
+		bench_sample_s *s = &golden->samples[golden->count];
+
+		if (line[0] == '#')
+			sscanf(line, "# duration_ms %llu", &golden->duration_ms);
+		else if (sscanf(line, "%llu,%f,%f,%f", &s->t_ms, &s->x, &s->y, &s->q) == 4)
+			golden->count++;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+static float
+_angle_diff(float a, float b)
+{
+	float d = fmodf(a - b, 2.f * (float)M_PI);
+
+	if (d > (float)M_PI)
+		d -= 2.f * (float)M_PI;
+	else if (d < -(float)M_PI)
+		d += 2.f * (float)M_PI;
+
+	return fabsf(d);
+}
+
+static double
+_wall_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int
+_run_scenario(const bench_scenario_s *scenario, const char *golden_dir, bool record)
+{
+	static bench_run_s golden;
+	rvc_sim_config_s config;
+	float max_pos = 0.f, max_q = 0.f;
+	long long time_diff = 0;
+	double wall;
+	const char *status = "pass";
+	int i, worst = -1;
+
+	rvc_sim_config_default(&config);
+	if (scenario->configure)
+		scenario->configure(&config);
+	rvc_sim_setup(&config);
+	rvc_sim_seed(BENCH_SEED);
+	rvc_initialize();
+
+	memset(&g_run, 0, sizeof(g_run));
+	_sample(&g_run);
+
+	wall = _wall_ms();
+	scenario->run(&g_run);
+	wall = _wall_ms() - wall;
+
+	rvc_deinitialize();
+
+	if (record)
+	{
+		status = _write_golden(golden_dir, scenario->name, &g_run) == 0 ? "recorded" : "error";
+	}
+	else if (_read_golden(golden_dir, scenario->name, &golden) != 0)
+	{
+		status = "missing_golden";
+	}
+	else
+	{
+		for (i = 0; i < g_run.count && i < golden.count; i++)
+		{
+			float dp = hypotf(g_run.samples[i].x - golden.samples[i].x, g_run.samples[i].y - golden.samples[i].y);
+			float dq = _angle_diff(g_run.samples[i].q, golden.samples[i].q);
+
+			if (dp > max_pos)
+			{
+				max_pos = dp;
+				worst = i;
+			}
+			if (dq > max_q)
+				max_q = dq;
+		}
+		time_diff = (long long)g_run.duration_ms - (long long)golden.duration_ms;
+
+		if (g_run.count != golden.count)
+			status = "fail_length";
+		else if (max_pos > scenario->pos_tolerance || max_q > scenario->q_tolerance)
+			status = "fail_trajectory";
+		else if (llabs(time_diff) > scenario->time_tolerance_ms)
+			status = "fail_timing";
+	}
+
+	printf("{\"scenario\":\"%s\",\"status\":\"%s\",\"samples\":%d,\"golden_samples\":%d,"
+		"\"max_pos_err\":%.3f,\"max_q_err\":%.5f,\"worst_t_ms\":%llu,"
+		"\"duration_ms\":%llu,\"duration_diff_ms\":%lld,\"wall_ms\":%.1f}\n",
+		scenario->name, status, g_run.count, record ? g_run.count : golden.count,
+		max_pos, max_q, worst >= 0 ? g_run.samples[worst].t_ms : 0ULL,
+		g_run.duration_ms, time_diff, wall);
+
+	return (!strcmp(status, "pass") || !strcmp(status, "recorded")) ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *golden_dir = "golden";
+	bool record = false;
+	bool selected[BENCH_SCENARIO_COUNT] = { false, };
+	bool any_selected = false;
+	int failures = 0;
+	int i, j;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--golden") && i + 1 < argc)
+		{
+			golden_dir = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--record"))
+		{
+			record = true;
+		}
+		else
+		{
+			for (j = 0; j < BENCH_SCENARIO_COUNT; j++)
+			{
+				if (!strcmp(argv[i], g_scenarios[j].name))
+					break;
+			}
+			if (j == BENCH_SCENARIO_COUNT)
+			{
+				fprintf(stderr, "unknown scenario: %s\n", argv[i]);
+				return 2;
+			}
+			selected[j] = any_selected = true;
+		}
+	}
+
+	for (i = 0; i < BENCH_SCENARIO_COUNT; i++)
+	{
+		if (!any_selected || selected[i])
+			failures += _run_scenario(&g_scenarios[i], golden_dir, record);
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file	plan_bench.c
+ * @brief	Timed segment benchmark for the RVC planning test modes
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "rvc_api.h"	// RVC API
+#include "plan_bench.h"
+
+const plan_script_s plan_script_lin_ang = {
+	"lin/ang", PLAN_CMD_LIN_ANG, 50, 3,
+	{
+		{ 40000, 10.f, 0.f },
+		{ 20000, -10.f, 0.f },
+		{ 20000, 50.f, 0.3f },
+	},
+};
+
+const plan_script_s plan_script_wheel_vel = {
+	"l/r wheel", PLAN_CMD_WHEEL_VEL, 50, 3,
+	{
+		{ 40000, 10.f, 10.f },
+		{ 20000, -10.f, -10.f },
+		{ 20000, 50.f, 20.f },
+	},
+};
+
+static unsigned long long
+_mono_now_us(void *data)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void
+_mono_sleep_until_us(unsigned long long deadline_us, void *data)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline_us / 1000000ULL;
+	ts.tv_nsec = (deadline_us % 1000000ULL) * 1000;
+	// clock_nanosleep() returns the error instead of setting errno; only a signal is worth a retry.
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static const plan_clock_s g_mono_clock = { _mono_now_us, _mono_sleep_until_us, NULL };
+
+static void
+_send(plan_cmd_type_e type, float a, float b)
+{
+	if (type == PLAN_CMD_LIN_ANG)
+		rvc_set_lin_ang(a, b);
+	else
+		rvc_set_wheel_vel((signed short)a, (signed short)b);
+}
+
+/* Reads back the velocity in the same terms as the command. */
+static void
+_measure(plan_cmd_type_e type, float *a, float *b)
+{
+	if (type == PLAN_CMD_LIN_ANG)
+	{
+		rvc_get_lin_ang_vel(a, b);
+	}
+	else
+	{
+		signed short left = 0, right = 0;
+
+		rvc_get_wheel_vel(&left, &right);
+		*a = left;
+		*b = right;
+	}
+}
+
+int plan_bench_run(const plan_script_s *script, const plan_clock_s *clock, plan_result_s *result)
+{
+	float px, py, pq;
+	int s;
+
+	if (!script || !result || script->period_ms == 0 || script->segment_count > PLAN_BENCH_MAX_SEGMENTS)
+		return -1;
+
+	if (!clock)
+		clock = &g_mono_clock;
+
+	result->script = script;
+	result->segment_count = script->segment_count;
+
+	rvc_get_pose(&px, &py, &pq);
+
+	for (s = 0; s < script->segment_count; s++)
+	{
+		const plan_segment_s *seg = &script->segments[s];
+		plan_segment_result_s *r = &result->segments[s];
+		unsigned long long period_us = script->period_ms * 1000ULL;
+		unsigned long long start_us = clock->now_us(clock->data);
+		unsigned long long end_us = start_us + seg->duration_ms * 1000ULL;
+		unsigned long long deadline_us = start_us;
+		unsigned long long prev_us = 0;
+		double jitter_sq = 0.0, err_a_sq = 0.0, err_b_sq = 0.0, period_sum = 0.0;
+
+		r->commands = 0;
+		r->jitter_max_ms = 0.0;
+		r->distance = 0.0;
+
+		// Ticks are scheduled on absolute deadlines so a late tick does not shift the rest.
+		while (deadline_us < end_us)
+		{
+			unsigned long long sent_us;
+			double late_ms;
+			float x, y, q, ma, mb;
+
+			clock->sleep_until_us(deadline_us, clock->data);
+
+			sent_us = clock->now_us(clock->data);
+			_send(script->type, seg->a, seg->b);
+
+			late_ms = ((double)sent_us - (double)deadline_us) / 1000.0;
+			jitter_sq += late_ms * late_ms;
+			if (fabs(late_ms) > r->jitter_max_ms)
+				r->jitter_max_ms = fabs(late_ms);
+
+			if (r->commands > 0)
+				period_sum += (sent_us - prev_us) / 1000.0;
+			prev_us = sent_us;
+
+			// The reply reflects earlier commands, so the first tick of a segment is not scored.
+			_measure(script->type, &ma, &mb);
+			if (r->commands > 0)
+			{
+				err_a_sq += (ma - seg->a) * (ma - seg->a);
+				err_b_sq += (mb - seg->b) * (mb - seg->b);
+			}
+
+			rvc_get_pose(&x, &y, &q);
+			r->distance += hypot(x - px, y - py);
+			px = x;
+			py = y;
+
+			r->commands++;
+			deadline_us += period_us;
+		}
+
+		clock->sleep_until_us(end_us, clock->data);
+
+		r->elapsed_ms = (clock->now_us(clock->data) - start_us) / 1000.0;
+		r->rate_hz = r->elapsed_ms > 0.0 ? r->commands * 1000.0 / r->elapsed_ms : 0.0;
+		r->period_avg_ms = r->commands > 1 ? period_sum / (r->commands - 1) : 0.0;
+		r->jitter_rms_ms = r->commands ? sqrt(jitter_sq / r->commands) : 0.0;
+		r->track_rms_a = r->commands > 1 ? sqrt(err_a_sq / (r->commands - 1)) : 0.0;
+		r->track_rms_b = r->commands > 1 ? sqrt(err_b_sq / (r->commands - 1)) : 0.0;
+	}
+
+	return 0;
+}
+
+void plan_bench_print(const plan_result_s *result, FILE *out)
+{
+	const char *unit_b = result->script->type == PLAN_CMD_LIN_ANG ? "ang" : "right";
+	const char *unit_a = result->script->type == PLAN_CMD_LIN_ANG ? "lin" : "left";
+	int s;
+
+	fprintf(out, "planning test '%s', period %u ms\n", result->script->name, result->script->period_ms);
+	fprintf(out, "seg  cmd(a, b)        time_ms  cmds  rate_hz  period_ms  jitter_rms  jitter_max  distance  err_%s  err_%s\n", unit_a, unit_b);
+
+	for (s = 0; s < result->segment_count; s++)
+	{
+		const plan_segment_s *seg = &result->script->segments[s];
+		const plan_segment_result_s *r = &result->segments[s];
+
+		fprintf(out, "%3d  (%6.2f, %6.2f) %8.0f %5u %8.2f %10.2f %11.3f %11.3f %9.1f %8.3f %8.3f\n",
+			s, seg->a, seg->b, r->elapsed_ms, r->commands, r->rate_hz, r->period_avg_ms,
+			r->jitter_rms_ms, r->jitter_max_ms, r->distance, r->track_rms_a, r->track_rms_b);
+	}
+}
@@ -0,0 +1,82 @@
+/**
+ * @file	plan_bench.h
+ * @brief	Timed segment benchmark for the RVC planning test modes
+ *
+ * A script is a list of segments, each holding one motion command for a fixed
+ * wall clock duration. The command is re-sent every period on an absolute
+ * schedule, so segment length and command rate do not depend on CPU speed.
+ * Each segment reports the achieved command rate, period jitter, distance
+ * travelled according to rvc_get_pose() and the error between the commanded
+ * and measured velocity.
+ */
+
+#ifndef __plan_bench_H__
+#define __plan_bench_H__
+
+#include <stdio.h>
+
+#define PLAN_BENCH_MAX_SEGMENTS	16
+
+typedef enum {
+	PLAN_CMD_LIN_ANG,		// rvc_set_lin_ang(a, b)
+	PLAN_CMD_WHEEL_VEL,		// rvc_set_wheel_vel(a, b)
+} plan_cmd_type_e;
+
+typedef struct {
+	unsigned int duration_ms;
+	float a;
+	float b;
+} plan_segment_s;
+
+typedef struct {
+	const char *name;
+	plan_cmd_type_e type;
+	unsigned int period_ms;
+	int segment_count;
+	plan_segment_s segments[PLAN_BENCH_MAX_SEGMENTS];
+} plan_script_s;
+
+typedef struct {
+	unsigned int commands;
+	double elapsed_ms;
+	double rate_hz;
+	double period_avg_ms;
+	double jitter_rms_ms;	// RMS deviation of the send time from its schedule
+	double jitter_max_ms;
+	double distance;		// Path length from rvc_get_pose(), in pose units
+	double track_rms_a;		// RMS of measured - commanded, first command argument
+	double track_rms_b;		// RMS of measured - commanded, second command argument
+} plan_segment_result_s;
+
+typedef struct {
+	const plan_script_s *script;
+	int segment_count;
+	plan_segment_result_s segments[PLAN_BENCH_MAX_SEGMENTS];
+} plan_result_s;
+
+/**
+ * @brief Time source for the benchmark.
+ * @details The default clock is CLOCK_MONOTONIC with clock_nanosleep(). A simulator
+ * can supply its own virtual clock to run the same script without waiting.
+ */
+typedef struct {
+	unsigned long long (*now_us)(void *data);
+	void (*sleep_until_us)(unsigned long long deadline_us, void *data);
+	void *data;
+} plan_clock_s;
+
+/** Test planning mode 'e': forward, reverse, then an arc with rvc_set_lin_ang(). */
+extern const plan_script_s plan_script_lin_ang;
+
+/** Test planning mode 'f': the same pattern with rvc_set_wheel_vel(). */
+extern const plan_script_s plan_script_wheel_vel;
+
+/**
+ * @brief Runs @a script and fills @a result.
+ * @param[in] clock Time source, or NULL for the wall clock
+ */
+int plan_bench_run(const plan_script_s *script, const plan_clock_s *clock, plan_result_s *result);
+
+void plan_bench_print(const plan_result_s *result, FILE *out);
+
+#endif /* __plan_bench_H__ */
@@ -0,0 +1,134 @@
+/**
+ * @file	faultTestApp.c
+ * @brief	Runs a fault script against the simulated RVC and reports time to recover
+ *
+ * Build on a desktop with the simulator in place of librvc:
+ *   cc -I. -I<dir of rvc_api.h> faultTestApp.c rvc_sim.c rvc_fault.c -lm -lpthread
+ *
+ * Usage: faultTestApp <script> [duration_ms] [tick_ms]
+ *
+ * The controller below is a minimal reactive driver standing in for the
+ * application: it drives forward, stops on an error, lift, cliff or bumper,
+ * backs off and turns, then resumes. Replace it with the control code under
+ * test to measure that instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rvc_api.h"
+#include "rvc_sim.h"
+#include "rvc_fault.h"
+
+#define BACKOFF_TICKS	10
+#define TURN_TICKS		15
+
+static volatile int g_error;
+static volatile int g_hazard;
+
+void __fault_error_evt_callback(rvc_device_error_type_e error, void* user_data)
+{
+	g_error = error;
+}
+
+void __fault_lift_evt_callback(unsigned char lift_left, unsigned char lift_right, void* user_data)
+{
+	if (lift_left || lift_right)
+		g_hazard = 1;
+}
+
+void __fault_cliff_evt_callback(unsigned char cliff_left, unsigned char cliff_center, unsigned char cliff_right, void* user_data)
+{
+	if (cliff_left || cliff_center || cliff_right)
+		g_hazard = 1;
+}
+
+void __fault_bumper_evt_callback(unsigned char bumper_left, unsigned char bumper_right, void* user_data)
+{
+	if (bumper_left || bumper_right)
+		g_hazard = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	rvc_fault_h fault;
+	unsigned int duration_ms = 60000, tick_ms = 50;
+	unsigned long long t;
+	int line = 0;
+	int backoff = 0, turn = 0, stopped = 0;
+
+	if (argc < 2)
+	{
+		printf("usage: %s <script> [duration_ms] [tick_ms]\n", argv[0]);
+		return -1;
+	}
+	if (argc > 2)
+		duration_ms = (unsigned int)atoi(argv[2]);
+	if (argc > 3)
+		tick_ms = (unsigned int)atoi(argv[3]);
+
+	if (rvc_initialize() < 0)
+	{
+		printf("rvc_initialize() failed.\n");
+		return -1;
+	}
+
+	rvc_fault_create(&fault);
+	if (rvc_fault_load_file(fault, argv[1], &line) != RVC_FAULT_ERROR_NONE)
+	{
+		printf("failed to load %s (line %d)\n", argv[1], line);
+		rvc_fault_destroy(fault);
+		return -1;
+	}
+
+	rvc_set_error_evt_cb(__fault_error_evt_callback, NULL);
+	rvc_set_lift_evt_cb(__fault_lift_evt_callback, NULL);
+	rvc_set_cliff_evt_cb(__fault_cliff_evt_callback, NULL);
+	rvc_set_bumper_evt_cb(__fault_bumper_evt_callback, NULL);
+
+	for (t = 0; t < duration_ms; t += tick_ms)
+	{
+		if (g_error)
+		{
+			// Hold still until the device clears its error.
+			rvc_device_error_type_e error;
+
+			if (!stopped)
+				rvc_set_lin_ang(0.f, 0.f);
+			stopped = 1;
+			rvc_get_error(&error);
+			g_error = error;
+		}
+		else if (g_hazard)
+		{
+			g_hazard = 0;
+			backoff = BACKOFF_TICKS;
+			turn = TURN_TICKS;
+		}
+		else if (backoff > 0)
+		{
+			rvc_set_lin_ang(-100.f, 0.f);
+			backoff--;
+			stopped = 0;
+		}
+		else if (turn > 0)
+		{
+			rvc_set_lin_ang(0.f, 1.f);
+			turn--;
+		}
+		else
+		{
+			rvc_set_lin_ang(150.f, 0.f);
+			stopped = 0;
+		}
+
+		rvc_fault_step(fault, tick_ms);
+	}
+
+	rvc_fault_report(fault, stdout);
+
+	rvc_fault_destroy(fault);
+	rvc_deinitialize();
+
+	return 0;
+}
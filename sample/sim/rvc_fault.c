@@ -0,0 +1,545 @@
+/**
+ * @file	rvc_fault.c
+ * @brief	Deterministic fault injection for the simulated RVC device
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "rvc_sim.h"
+#include "rvc_fault.h"
+
+#define FAULT_LINE_MAX	256
+#define FAULT_DETECT_GRACE_MS	1000	// Commands this long after a fault clears still count as a reaction
+
+typedef struct {
+	rvc_fault_event_s event;
+	bool started;
+	rvc_sim_cmd_e baseline_cmd;	// Last command before the onset
+	float baseline_a, baseline_b;
+	bool has_baseline;
+} fault_entry_s;
+
+struct rvc_fault_s {
+	fault_entry_s *entries;
+	int count;
+	int capacity;
+	unsigned int rng;
+	bool hooked;
+	unsigned long long now_ms;
+
+	bool has_last_cmd;
+	rvc_sim_cmd_e last_cmd;
+	float last_a, last_b;
+
+	// Values last pushed to the simulator
+	unsigned int applied[RVC_FAULT_MAX];
+};
+
+static const char *g_type_names[RVC_FAULT_MAX] = {
+	"error", "lift", "cliff", "bumper", "drop_callbacks", "delay_callbacks", "drop_commands",
+};
+
+const char *rvc_fault_type_to_string(rvc_fault_type_e type)
+{
+	return (type >= 0 && type < RVC_FAULT_MAX) ? g_type_names[type] : "unknown";
+}
+
+int rvc_fault_create(rvc_fault_h *fault)
+{
+	struct rvc_fault_s *f;
+
+	if (!fault)
+		return RVC_FAULT_ERROR_INVALID_PARAMETER;
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return RVC_FAULT_ERROR_OUT_OF_MEMORY;
+
+	f->rng = 1;
+	*fault = f;
+
+	return RVC_FAULT_ERROR_NONE;
+}
+
+void rvc_fault_destroy(rvc_fault_h fault)
+{
+	if (!fault)
+		return;
+
+	if (fault->hooked)
+		rvc_sim_set_cmd_hook(NULL, NULL);
+	free(fault->entries);
+	free(fault);
+}
+
+static unsigned int
+_rand(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x ? x : 1;
+
+	return *state;
+}
+
+int rvc_fault_add(rvc_fault_h fault, rvc_fault_type_e type, unsigned long long at_ms, unsigned int arg, unsigned int duration_ms)
+{
+	fault_entry_s *entry;
+	int i;
+
+	if (!fault || type < 0 || type >= RVC_FAULT_MAX)
+		return RVC_FAULT_ERROR_INVALID_PARAMETER;
+
+	if (fault->count == fault->capacity)
+	{
+		int capacity = fault->capacity ? fault->capacity * 2 : 32;
+		fault_entry_s *entries = realloc(fault->entries, capacity * sizeof(*entries));
+
+		if (!entries)
+			return RVC_FAULT_ERROR_OUT_OF_MEMORY;
+		fault->entries = entries;
+		fault->capacity = capacity;
+	}
+
+	// Keep the schedule ordered by onset; equal onsets keep script order.
+	for (i = fault->count; i > 0 && fault->entries[i - 1].event.at_ms > at_ms; i--)
+		fault->entries[i] = fault->entries[i - 1];
+
+	entry = &fault->entries[i];
+	memset(entry, 0, sizeof(*entry));
+	entry->event.type = type;
+	entry->event.at_ms = at_ms;
+	entry->event.duration_ms = duration_ms;
+	entry->event.arg = arg;
+	fault->count++;
+
+	return RVC_FAULT_ERROR_NONE;
+}
+
+static int
+_parse_type(const char *name, rvc_fault_type_e *type)
+{
+	int i;
+
+	for (i = 0; i < RVC_FAULT_MAX; i++)
+	{
+		if (!strcmp(name, g_type_names[i]))
+		{
+			*type = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Parses the argument of a fault: a side name for sensor faults, a number otherwise. */
+static int
+_parse_arg(rvc_fault_type_e type, const char *text, unsigned int *arg)
+{
+	char *end;
+
+	if (type == RVC_FAULT_LIFT || type == RVC_FAULT_CLIFF || type == RVC_FAULT_BUMPER)
+	{
+		if (!strcmp(text, "left"))
+			*arg = 0x1;
+		else if (!strcmp(text, "center"))
+			*arg = 0x2;
+		else if (!strcmp(text, "right"))
+			*arg = 0x4;
+		else if (!strcmp(text, "both"))
+			*arg = 0x5;
+		else if (!strcmp(text, "all"))
+			*arg = 0x7;
+		else
+			return -1;
+
+		return 0;
+	}
+
+	*arg = (unsigned int)strtoul(text, &end, 0);
+
+	return (*end == '\0') ? 0 : -1;
+}
+
+static int
+_parse_line(rvc_fault_h fault, char *line)
+{
+	char *tok[8];
+	char *save = NULL;
+	char *p;
+	int n = 0;
+	rvc_fault_type_e type;
+	unsigned int arg;
+
+	p = strchr(line, '#');
+	if (p)
+		*p = '\0';
+
+	for (p = strtok_r(line, " \t\r\n", &save); p && n < 8; p = strtok_r(NULL, " \t\r\n", &save))
+		tok[n++] = p;
+
+	if (n == 0)
+		return 0;
+
+	if (!strcmp(tok[0], "seed") && n == 2)
+	{
+		unsigned int seed = (unsigned int)strtoul(tok[1], NULL, 0);
+
+		fault->rng = seed ? seed : 1;
+		rvc_sim_seed(seed);
+		return 0;
+	}
+
+	if (!strcmp(tok[0], "sweep_errors") && n == 6)
+	{
+		unsigned int first = strtoul(tok[1], NULL, 0);
+		unsigned int last = strtoul(tok[2], NULL, 0);
+		unsigned long long at = strtoull(tok[3], NULL, 0);
+		unsigned int duration = strtoul(tok[4], NULL, 0);
+		unsigned int gap = strtoul(tok[5], NULL, 0);
+		unsigned int code;
+
+		for (code = first; code <= last; code++, at += gap)
+		{
+			if (rvc_fault_add(fault, RVC_FAULT_ERROR, at, code, duration) != RVC_FAULT_ERROR_NONE)
+				return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(tok[0], "random") && n == 7)
+	{
+		unsigned int count = strtoul(tok[1], NULL, 0);
+		unsigned int duration = strtoul(tok[4], NULL, 0);
+		unsigned long long from = strtoull(tok[5], NULL, 0);
+		unsigned long long to = strtoull(tok[6], NULL, 0);
+		unsigned int i;
+
+		if (_parse_type(tok[2], &type) != 0 || _parse_arg(type, tok[3], &arg) != 0 || to <= from)
+			return -1;
+
+		for (i = 0; i < count; i++)
+		{
+			unsigned long long at = from + _rand(&fault->rng) % (to - from);
+
+			if (rvc_fault_add(fault, type, at, arg, duration) != RVC_FAULT_ERROR_NONE)
+				return -1;
+		}
+		return 0;
+	}
+
+	if (n == 4 && _parse_type(tok[1], &type) == 0 && _parse_arg(type, tok[2], &arg) == 0)
+		return rvc_fault_add(fault, type, strtoull(tok[0], NULL, 0), arg, strtoul(tok[3], NULL, 0)) == RVC_FAULT_ERROR_NONE ? 0 : -1;
+
+	return -1;
+}
+
+int rvc_fault_load_script(rvc_fault_h fault, const char *script, int *line)
+{
+	char buf[FAULT_LINE_MAX];
+	const char *p = script;
+	int n = 0;
+
+	if (!fault || !script)
+		return RVC_FAULT_ERROR_INVALID_PARAMETER;
+
+	while (*p)
+	{
+		const char *eol = strchr(p, '\n');
+		size_t len = eol ? (size_t)(eol - p) : strlen(p);
+
+		n++;
+		if (len >= sizeof(buf))
+			len = sizeof(buf) - 1;
+		memcpy(buf, p, len);
+		buf[len] = '\0';
+
+		if (_parse_line(fault, buf) != 0)
+		{
+			if (line)
+				*line = n;
+			return RVC_FAULT_ERROR_PARSE;
+		}
+
+		if (!eol)
+			break;
+		p = eol + 1;
+	}
+
+	return RVC_FAULT_ERROR_NONE;
+}
+
+int rvc_fault_load_file(rvc_fault_h fault, const char *path, int *line)
+{
+	FILE *fp;
+	char *text;
+	long size;
+	int ret;
+
+	if (!fault || !path)
+		return RVC_FAULT_ERROR_INVALID_PARAMETER;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return RVC_FAULT_ERROR_IO;
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	text = malloc(size + 1);
+	if (!text)
+	{
+		fclose(fp);
+		return RVC_FAULT_ERROR_OUT_OF_MEMORY;
+	}
+
+	size = fread(text, 1, size, fp);
+	text[size] = '\0';
+	fclose(fp);
+
+	ret = rvc_fault_load_script(fault, text, line);
+	free(text);
+
+	return ret;
+}
+
+/* Called by the simulator with its lock held; only touches fault layer state. */
+static void
+_cmd_hook(rvc_sim_cmd_e cmd, bool dropped, float a, float b, void *user_data)
+{
+	struct rvc_fault_s *fault = user_data;
+	int i;
+
+	for (i = 0; i < fault->count; i++)
+	{
+		fault_entry_s *entry = &fault->entries[i];
+
+		if (!entry->started || entry->event.detect_ms)
+			continue;
+
+		// Comms faults are invisible to the application, so a changed command says nothing.
+		if (entry->event.type == RVC_FAULT_DROP_CALLBACKS || entry->event.type == RVC_FAULT_DELAY_CALLBACKS
+				|| entry->event.type == RVC_FAULT_DROP_COMMANDS)
+			continue;
+
+		// Later commands react to something else, typically the next fault.
+		if (fault->now_ms > entry->event.at_ms + entry->event.duration_ms + FAULT_DETECT_GRACE_MS)
+			continue;
+
+		// A command repeating what the application did before the fault is not a reaction.
+		if (entry->has_baseline && cmd != RVC_SIM_CMD_MODE && cmd == entry->baseline_cmd
+				&& a == entry->baseline_a && b == entry->baseline_b)
+			continue;
+
+		entry->event.detect_ms = fault->now_ms;
+	}
+
+	fault->has_last_cmd = true;
+	fault->last_cmd = cmd;
+	fault->last_a = a;
+	fault->last_b = b;
+}
+
+/* Pushes the combined effect of all active faults to the simulator. */
+static void
+_apply(rvc_fault_h fault)
+{
+	unsigned int want[RVC_FAULT_MAX] = { 0, };
+	int i;
+
+	for (i = 0; i < fault->count; i++)
+	{
+		fault_entry_s *entry = &fault->entries[i];
+		rvc_fault_event_s *evt = &entry->event;
+
+		if (evt->at_ms > fault->now_ms)
+			break;
+
+		if (!entry->started)
+		{
+			entry->started = true;
+			entry->has_baseline = fault->has_last_cmd;
+			entry->baseline_cmd = fault->last_cmd;
+			entry->baseline_a = fault->last_a;
+			entry->baseline_b = fault->last_b;
+		}
+
+		if (fault->now_ms >= evt->at_ms + evt->duration_ms)
+			continue;
+
+		switch (evt->type)
+		{
+		case RVC_FAULT_ERROR:
+			want[evt->type] = evt->arg;		// Latest onset wins
+			break;
+		case RVC_FAULT_LIFT:
+		case RVC_FAULT_CLIFF:
+		case RVC_FAULT_BUMPER:
+			want[evt->type] |= evt->arg;
+			break;
+		default:
+			if (evt->arg > want[evt->type])
+				want[evt->type] = evt->arg;
+			break;
+		}
+	}
+
+	for (i = 0; i < RVC_FAULT_MAX; i++)
+	{
+		if (want[i] == fault->applied[i])
+			continue;
+
+		fault->applied[i] = want[i];
+		switch (i)
+		{
+		case RVC_FAULT_ERROR:
+			rvc_sim_force_error((rvc_device_error_type_e)want[i]);
+			break;
+		case RVC_FAULT_LIFT:
+			rvc_sim_force_lift(want[i]);
+			break;
+		case RVC_FAULT_CLIFF:
+			rvc_sim_force_cliff(want[i]);
+			break;
+		case RVC_FAULT_BUMPER:
+			rvc_sim_force_bumper(want[i]);
+			break;
+		case RVC_FAULT_DROP_CALLBACKS:
+			rvc_sim_set_callback_drop(want[i]);
+			break;
+		case RVC_FAULT_DELAY_CALLBACKS:
+			rvc_sim_set_callback_delay(want[i]);
+			break;
+		case RVC_FAULT_DROP_COMMANDS:
+			rvc_sim_set_command_drop(want[i]);
+			break;
+		}
+	}
+}
+
+void rvc_fault_step(rvc_fault_h fault, unsigned int dt_ms)
+{
+	rvc_sim_state_s state;
+	int i;
+
+	if (!fault)
+		return;
+
+	if (!fault->hooked)
+	{
+		rvc_sim_set_cmd_hook(_cmd_hook, fault);
+		fault->hooked = true;
+	}
+
+	fault->now_ms = rvc_sim_now_ms();
+	_apply(fault);
+
+	rvc_sim_step(dt_ms);
+
+	rvc_sim_get_state(&state);
+	fault->now_ms = state.time_ms;
+
+	if (state.lin == 0.f && state.ang == 0.f)
+		return;
+
+	for (i = 0; i < fault->count; i++)
+	{
+		rvc_fault_event_s *evt = &fault->entries[i].event;
+
+		if (evt->at_ms > fault->now_ms)
+			break;
+		if (!evt->recover_ms && fault->now_ms >= evt->at_ms + evt->duration_ms)
+			evt->recover_ms = fault->now_ms;
+	}
+}
+
+int rvc_fault_get_count(rvc_fault_h fault)
+{
+	return fault ? fault->count : 0;
+}
+
+int rvc_fault_get_event(rvc_fault_h fault, int index, rvc_fault_event_s *event)
+{
+	if (!fault || !event || index < 0 || index >= fault->count)
+		return RVC_FAULT_ERROR_INVALID_PARAMETER;
+
+	*event = fault->entries[index].event;
+
+	return RVC_FAULT_ERROR_NONE;
+}
+
+void rvc_fault_report(rvc_fault_h fault, FILE *out)
+{
+	unsigned long long detect_sum[RVC_FAULT_MAX] = { 0, }, detect_max[RVC_FAULT_MAX] = { 0, };
+	unsigned long long recover_sum[RVC_FAULT_MAX] = { 0, }, recover_max[RVC_FAULT_MAX] = { 0, };
+	int detected[RVC_FAULT_MAX] = { 0, }, recovered[RVC_FAULT_MAX] = { 0, }, total[RVC_FAULT_MAX] = { 0, };
+	int i;
+
+	if (!fault || !out)
+		return;
+
+	fprintf(out, "%-16s %10s %8s %6s %10s %10s\n", "fault", "at_ms", "dur_ms", "arg", "detect_ms", "recover_ms");
+
+	for (i = 0; i < fault->count; i++)
+	{
+		const rvc_fault_event_s *evt = &fault->entries[i].event;
+		unsigned long long clear = evt->at_ms + evt->duration_ms;
+
+		fprintf(out, "%-16s %10llu %8u %6u ", rvc_fault_type_to_string(evt->type), evt->at_ms, evt->duration_ms, evt->arg);
+
+		total[evt->type]++;
+		if (evt->detect_ms)
+		{
+			unsigned long long d = evt->detect_ms - evt->at_ms;
+
+			fprintf(out, "%10llu ", d);
+			detected[evt->type]++;
+			detect_sum[evt->type] += d;
+			if (d > detect_max[evt->type])
+				detect_max[evt->type] = d;
+		}
+		else
+		{
+			fprintf(out, "%10s ", "-");
+		}
+
+		if (evt->recover_ms)
+		{
+			unsigned long long r = evt->recover_ms - clear;
+
+			fprintf(out, "%10llu\n", r);
+			recovered[evt->type]++;
+			recover_sum[evt->type] += r;
+			if (r > recover_max[evt->type])
+				recover_max[evt->type] = r;
+		}
+		else
+		{
+			fprintf(out, "%10s\n", "-");
+		}
+	}
+
+	fprintf(out, "\n%-16s %6s %9s %11s %11s %12s %12s\n", "summary", "count", "detected", "detect_avg", "detect_max", "recover_avg", "recover_max");
+	for (i = 0; i < RVC_FAULT_MAX; i++)
+	{
+		if (!total[i])
+			continue;
+
+		fprintf(out, "%-16s %6d %9d ", g_type_names[i], total[i], detected[i]);
+		if (detected[i])
+			fprintf(out, "%11llu %11llu ", detect_sum[i] / detected[i], detect_max[i]);
+		else
+			fprintf(out, "%11s %11s ", "-", "-");
+		if (recovered[i])
+			fprintf(out, "%12llu %12llu\n", recover_sum[i] / recovered[i], recover_max[i]);
+		else
+			fprintf(out, "%12s %12s\n", "-", "-");
+	}
+}
@@ -0,0 +1,102 @@
+/**
+ * @file	rvc_fault.h
+ * @brief	Deterministic fault injection for the simulated RVC device
+ *
+ * Faults are scheduled on the simulator clock from a script and applied as
+ * rvc_fault_step() advances the simulator, so the same script and seed always
+ * produce the same run.
+ *
+ * Script syntax, one directive per line, '#' starts a comment:
+ * @code
+ * seed 1234
+ * # <at_ms> <fault> <argument> <duration_ms>
+ * 2000  error    3      1500	# device error code 3 (rvc_device_error_type_e)
+ * 5000  lift     both   800
+ * 8000  cliff    center 300
+ * 9000  bumper   left   2000	# stuck bumper
+ * 12000 drop_callbacks  50  3000	# percent of callbacks lost
+ * 16000 delay_callbacks 400 3000	# ms added to every callback
+ * 20000 drop_commands   30  3000	# percent of commands lost
+ * # Every error code in [first, last], starting at at_ms, gap_ms apart
+ * sweep_errors 1 8 30000 1000 4000
+ * # <count> random faults of one kind in [from_ms, to_ms)
+ * random 5 cliff left 200 40000 60000
+ * @endcode
+ * Side arguments are left, center, right, both or all.
+ */
+
+#ifndef __rvc_fault_H__
+#define __rvc_fault_H__
+
+#include <stdio.h>
+
+typedef enum {
+	RVC_FAULT_ERROR,
+	RVC_FAULT_LIFT,
+	RVC_FAULT_CLIFF,
+	RVC_FAULT_BUMPER,
+	RVC_FAULT_DROP_CALLBACKS,
+	RVC_FAULT_DELAY_CALLBACKS,
+	RVC_FAULT_DROP_COMMANDS,
+	RVC_FAULT_MAX,
+} rvc_fault_type_e;
+
+typedef enum {
+	RVC_FAULT_ERROR_NONE = 0,
+	RVC_FAULT_ERROR_INVALID_PARAMETER = -1,
+	RVC_FAULT_ERROR_OUT_OF_MEMORY = -2,
+	RVC_FAULT_ERROR_PARSE = -3,
+	RVC_FAULT_ERROR_IO = -4,
+} rvc_fault_error_e;
+
+/**
+ * @brief One scheduled fault and what the application did about it.
+ * @details @a detect_ms is the first application command after the onset, i.e. the
+ * first sign that the application noticed. Only commands until one second after
+ * the fault cleared count, and never for the comms faults, which the application
+ * cannot see. @a recover_ms is the first step after the fault cleared where the
+ * robot was moving again. Both are 0 if not observed.
+ */
+typedef struct {
+	rvc_fault_type_e type;
+	unsigned long long at_ms;
+	unsigned int duration_ms;
+	unsigned int arg;			// Error code, sensor mask, percent or delay
+	unsigned long long detect_ms;
+	unsigned long long recover_ms;
+} rvc_fault_event_s;
+
+typedef struct rvc_fault_s *rvc_fault_h;
+
+int rvc_fault_create(rvc_fault_h *fault);
+
+void rvc_fault_destroy(rvc_fault_h fault);
+
+/**
+ * @brief Adds the directives in @a script to the schedule.
+ * @param[out] line Line of the first error, if any
+ */
+int rvc_fault_load_script(rvc_fault_h fault, const char *script, int *line);
+
+int rvc_fault_load_file(rvc_fault_h fault, const char *path, int *line);
+
+int rvc_fault_add(rvc_fault_h fault, rvc_fault_type_e type, unsigned long long at_ms, unsigned int arg, unsigned int duration_ms);
+
+/**
+ * @brief Applies due faults and advances the simulator by @a dt_ms.
+ * @details Installs the fault layer as the simulator's command hook on first use.
+ */
+void rvc_fault_step(rvc_fault_h fault, unsigned int dt_ms);
+
+int rvc_fault_get_count(rvc_fault_h fault);
+
+int rvc_fault_get_event(rvc_fault_h fault, int index, rvc_fault_event_s *event);
+
+/**
+ * @brief Prints one line per fault and a detect/recover latency summary.
+ */
+void rvc_fault_report(rvc_fault_h fault, FILE *out);
+
+const char *rvc_fault_type_to_string(rvc_fault_type_e type);
+
+#endif /* __rvc_fault_H__ */
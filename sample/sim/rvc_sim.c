@@ -0,0 +1,1103 @@
+/**
+ * @file	rvc_sim.c
+ * @brief	Simulated RVC device implementing the rvc_api.h interface
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rvc_sim.h"
+
+#define SIM_EVENT_QUEUE		256
+#define SIM_SENSOR_ANGLE	0.7854f		// Left/right bumper and cliff sensors, from the heading
+#define SIM_DOCK_TOLERANCE	20.f
+#define SIM_MODE_MANUAL		(-1)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef enum {
+	EVT_MODE,
+	EVT_ERROR,
+	EVT_WHEEL_VEL,
+	EVT_POSE,
+	EVT_BUMPER,
+	EVT_CLIFF,
+	EVT_LIFT,
+	EVT_MAGNET,
+	EVT_SUCTION,
+	EVT_BATT,
+	EVT_VOICE,
+	EVT_BATT_LOW,
+	EVT_RESERVATION,
+	EVT_LIN_ANG,
+	EVT_MAX,
+} sim_event_e;
+
+typedef struct {
+	unsigned long long due_ms;
+	sim_event_e type;
+	int i[4];
+	float f[3];
+} sim_event_s;
+
+typedef struct {
+	void *cb;
+	void *user_data;
+} sim_callback_s;
+
+typedef struct {
+	float min_x, min_y, max_x, max_y;
+} sim_zone_s;
+
+static struct {
+	pthread_mutex_t lock;
+	rvc_sim_config_s config;
+	bool initialized;
+
+	sim_zone_s cliffs[RVC_SIM_MAX_ZONES];
+	int cliff_count;
+	sim_zone_s magnets[RVC_SIM_MAX_ZONES];
+	int magnet_count;
+
+	unsigned long long now_ms;
+	unsigned long long next_pose_ms;
+	unsigned long long last_cmd_ms;
+	unsigned int rng;
+	unsigned int fault_rng;
+
+	float x, y, q;
+	float lin, ang;
+	float cmd_lin, cmd_ang;
+	float distance;
+	float charge;
+	int mode;
+	bool docked;
+	bool batt_low_sent;
+	int batt_level;
+	unsigned int turn_ms;		// Remaining turn of the auto cleaning bounce
+	float turn_dir;
+	unsigned long long spot_start_ms;
+
+	rvc_device_error_type_e error;
+	rvc_suction_state_e suction;
+	rvc_voice_type_e voice;
+	unsigned char reserve[2][3];	// is_on, hour, minute
+	unsigned char bumper, cliff, lift, magnet;	// Reported sensor masks
+	unsigned char forced_bumper, forced_cliff, forced_lift;
+
+	unsigned int cb_drop_percent;
+	unsigned int cb_delay_ms;
+	unsigned int cmd_drop_percent;
+
+	sim_callback_s callbacks[EVT_MAX];
+	sim_event_s events[SIM_EVENT_QUEUE];
+	int event_count;
+
+	rvc_sim_cmd_hook cmd_hook;
+	void *cmd_hook_data;
+
+	pthread_t thread;
+	bool running;
+} g_sim = { .lock = PTHREAD_MUTEX_INITIALIZER, .rng = 1, .fault_rng = 1 };
+
+void rvc_sim_config_default(rvc_sim_config_s *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->room_min_x = -1000.f;
+	config->room_min_y = -2500.f;
+	config->room_max_x = 4000.f;
+	config->room_max_y = 2500.f;
+	config->wheel_base = 230.f;
+	config->body_radius = 170.f;
+	config->max_lin_vel = 300.f;
+	config->max_ang_vel = 2.f;
+	config->control_lin_vel = 150.f;
+	config->control_ang_vel = 1.f;
+	config->cmd_timeout_ms = 300;
+	config->pose_period_ms = 100;
+	config->batt_levels = 4;
+	config->batt_drain_idle = 1.f / 36000.f;
+	config->batt_drain_suction[RVC_SUCTION_SLIENT] = 1.f / 14400.f;
+	config->batt_drain_suction[RVC_SUCTION_NORMAL] = 1.f / 9000.f;
+	config->batt_drain_suction[RVC_SUCTION_TURBO] = 1.f / 4800.f;
+	config->batt_drain_motion = 1.f / (300.f * 10800.f);
+	config->batt_charge_rate = 1.f / 7200.f;
+	config->batt_low_threshold = 0.15f;
+}
+
+/* xorshift32; deterministic for a given seed. */
+static unsigned int
+_rand(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x ? x : 1;
+
+	return *state;
+}
+
+static void
+_reset_world(void)
+{
+	g_sim.now_ms = 0;
+	g_sim.next_pose_ms = 0;
+	g_sim.last_cmd_ms = 0;
+	g_sim.x = g_sim.y = g_sim.q = 0.f;
+	g_sim.lin = g_sim.ang = 0.f;
+	g_sim.cmd_lin = g_sim.cmd_ang = 0.f;
+	g_sim.distance = 0.f;
+	g_sim.charge = 1.f;
+	g_sim.mode = RVC_MODE_SET_PAUSE;
+	g_sim.docked = true;
+	g_sim.batt_low_sent = false;
+	g_sim.batt_level = g_sim.config.batt_levels - 1;
+	g_sim.turn_ms = 0;
+	g_sim.error = (rvc_device_error_type_e)0;
+	g_sim.suction = RVC_SUCTION_NORMAL;
+	g_sim.bumper = g_sim.cliff = g_sim.lift = g_sim.magnet = 0;
+	g_sim.forced_bumper = g_sim.forced_cliff = g_sim.forced_lift = 0;
+	g_sim.cb_drop_percent = g_sim.cb_delay_ms = g_sim.cmd_drop_percent = 0;
+	g_sim.event_count = 0;
+}
+
+int rvc_sim_setup(const rvc_sim_config_s *config)
+{
+	if (!config || config->batt_levels <= 0)
+		return -1;
+
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.config = *config;
+	g_sim.cliff_count = 0;
+	g_sim.magnet_count = 0;
+	_reset_world();
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+static int
+_add_zone(sim_zone_s *zones, int *count, float min_x, float min_y, float max_x, float max_y)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&g_sim.lock);
+	if (*count < RVC_SIM_MAX_ZONES)
+	{
+		sim_zone_s zone = { min_x, min_y, max_x, max_y };
+
+		zones[(*count)++] = zone;
+		ret = RVC_USER_ERROR_NONE;
+	}
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return ret;
+}
+
+int rvc_sim_add_cliff(float min_x, float min_y, float max_x, float max_y)
+{
+	return _add_zone(g_sim.cliffs, &g_sim.cliff_count, min_x, min_y, max_x, max_y);
+}
+
+int rvc_sim_add_magnet(float min_x, float min_y, float max_x, float max_y)
+{
+	return _add_zone(g_sim.magnets, &g_sim.magnet_count, min_x, min_y, max_x, max_y);
+}
+
+void rvc_sim_seed(unsigned int seed)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.rng = seed ? seed : 1;
+	g_sim.fault_rng = (seed ^ 0x9e3779b9u) ? (seed ^ 0x9e3779b9u) : 1;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+/*
+ * Reports a mode the way the device does, in its own rvc_mode_type_get_e codes
+ * rather than the rvc_mode_type_set_e ones it was set with. Manual driving reads
+ * as paused.
+ */
+static rvc_mode_type_get_e
+_get_mode(int mode)
+{
+	switch (mode)
+	{
+	case RVC_MODE_SET_DOCKING:
+		return RVC_MODE_GET_DOCKING;
+	case RVC_MODE_SET_CLEANING_AUTO:
+		return RVC_MODE_GET_CLEANING_AUTO;
+	case RVC_MODE_SET_CLEANING_SPOT:
+		return RVC_MODE_GET_CLEANING_SPOT;
+	default:
+		return RVC_MODE_GET_PAUSE;
+	}
+}
+
+/* Queues an event for dispatch, applying the callback drop and delay faults. Caller holds the lock. */
+static void
+_post(sim_event_e type, int i0, int i1, int i2, int i3, float f0, float f1, float f2)
+{
+	sim_event_s *evt;
+
+	if (!g_sim.callbacks[type].cb)
+		return;
+
+	if (g_sim.cb_drop_percent && _rand(&g_sim.fault_rng) % 100 < g_sim.cb_drop_percent)
+		return;
+
+	if (g_sim.event_count == SIM_EVENT_QUEUE)
+		return;
+
+	evt = &g_sim.events[g_sim.event_count++];
+	evt->due_ms = g_sim.now_ms + g_sim.cb_delay_ms;
+	evt->type = type;
+	evt->i[0] = i0;
+	evt->i[1] = i1;
+	evt->i[2] = i2;
+	evt->i[3] = i3;
+	evt->f[0] = f0;
+	evt->f[1] = f1;
+	evt->f[2] = f2;
+}
+
+static void
+_dispatch(const sim_event_s *evt, const sim_callback_s *cb)
+{
+	switch (evt->type)
+	{
+	case EVT_MODE:
+		((rvc_mode_evt_cb)cb->cb)((rvc_mode_type_get_e)evt->i[0], cb->user_data);
+		break;
+	case EVT_ERROR:
+		((rvc_error_evt_cb)cb->cb)((rvc_device_error_type_e)evt->i[0], cb->user_data);
+		break;
+	case EVT_WHEEL_VEL:
+		((rvc_wheel_vel_evt_cb)cb->cb)((signed short)evt->i[0], (signed short)evt->i[1], cb->user_data);
+		break;
+	case EVT_POSE:
+		((rvc_pose_evt_cb)cb->cb)(evt->f[0], evt->f[1], evt->f[2], cb->user_data);
+		break;
+	case EVT_BUMPER:
+		((rvc_bumper_evt_cb)cb->cb)(evt->i[0], evt->i[1], cb->user_data);
+		break;
+	case EVT_CLIFF:
+		((rvc_cliff_evt_cb)cb->cb)(evt->i[0], evt->i[1], evt->i[2], cb->user_data);
+		break;
+	case EVT_LIFT:
+		((rvc_lift_evt_cb)cb->cb)(evt->i[0], evt->i[1], cb->user_data);
+		break;
+	case EVT_MAGNET:
+		((rvc_magnet_evt_cb)cb->cb)(evt->i[0], cb->user_data);
+		break;
+	case EVT_SUCTION:
+		((rvc_suction_evt_cb)cb->cb)((rvc_suction_state_e)evt->i[0], cb->user_data);
+		break;
+	case EVT_BATT:
+		((rvc_batt_evt_cb)cb->cb)((rvc_batt_level_e)evt->i[0], cb->user_data);
+		break;
+	case EVT_VOICE:
+		((rvc_voice_evt_cb)cb->cb)((rvc_voice_type_e)evt->i[0], cb->user_data);
+		break;
+	case EVT_BATT_LOW:
+		((rvc_batt_low_evt_cb)cb->cb)(cb->user_data);
+		break;
+	case EVT_RESERVATION:
+		((rvc_reservation_evt_cb)cb->cb)((rvc_reserve_type_e)evt->i[0], evt->i[1], evt->i[2], evt->i[3], cb->user_data);
+		break;
+	case EVT_LIN_ANG:
+		((rvc_lin_ang_evt_cb)cb->cb)(evt->f[0], evt->f[1], cb->user_data);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Removes due events from the queue, keeping the order of the rest. Caller holds the lock. */
+static int
+_take_due(sim_event_s *out, sim_callback_s *cbs)
+{
+	int i, n = 0, kept = 0;
+
+	for (i = 0; i < g_sim.event_count; i++)
+	{
+		sim_event_s *evt = &g_sim.events[i];
+
+		if (evt->due_ms <= g_sim.now_ms && g_sim.callbacks[evt->type].cb)
+		{
+			out[n] = *evt;
+			cbs[n] = g_sim.callbacks[evt->type];
+			n++;
+		}
+		else if (evt->due_ms > g_sim.now_ms)
+		{
+			g_sim.events[kept++] = *evt;
+		}
+	}
+	g_sim.event_count = kept;
+
+	return n;
+}
+
+static float
+_wrap(float a)
+{
+	while (a > M_PI)
+		a -= 2.f * M_PI;
+	while (a < -M_PI)
+		a += 2.f * M_PI;
+
+	return a;
+}
+
+static bool
+_in_zone(const sim_zone_s *zones, int count, float x, float y)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (x >= zones[i].min_x && x <= zones[i].max_x && y >= zones[i].min_y && y <= zones[i].max_y)
+			return true;
+	}
+
+	return false;
+}
+
+/* Bit mask of the cliff sensors over a drop-off with the robot at (x, y, q). */
+static unsigned char
+_cliff_mask(float x, float y, float q)
+{
+	unsigned char mask = 0;
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		float a = q + (1 - i) * SIM_SENSOR_ANGLE;
+
+		if (_in_zone(g_sim.cliffs, g_sim.cliff_count, x + g_sim.config.body_radius * cosf(a), y + g_sim.config.body_radius * sinf(a)))
+			mask |= 1 << i;
+	}
+
+	return mask;
+}
+
+/* Bumper mask for a contact in direction @a bearing (world frame), or 0 if it is behind the robot. */
+static unsigned char
+_bumper_mask(float bearing)
+{
+	float rel = _wrap(bearing - g_sim.q);
+
+	if (fabsf(rel) > M_PI / 2)
+		return 0;
+	if (rel > 0.2f)
+		return 0x1;
+	if (rel < -0.2f)
+		return 0x4;
+
+	return 0x5;
+}
+
+static void
+_start_bounce(void)
+{
+	g_sim.turn_ms = 300 + _rand(&g_sim.rng) % 1200;
+	g_sim.turn_dir = (_rand(&g_sim.rng) & 1) ? 1.f : -1.f;
+}
+
+/* Chooses the velocity for this step from the mode and the latest command. Caller holds the lock. */
+static void
+_control(unsigned int dt_ms)
+{
+	const rvc_sim_config_s *c = &g_sim.config;
+	float lin = 0.f, ang = 0.f;
+
+	switch (g_sim.mode)
+	{
+	case SIM_MODE_MANUAL:
+		if (g_sim.now_ms - g_sim.last_cmd_ms <= c->cmd_timeout_ms)
+		{
+			lin = g_sim.cmd_lin;
+			ang = g_sim.cmd_ang;
+		}
+		break;
+
+	case RVC_MODE_SET_CLEANING_AUTO:
+		if (g_sim.turn_ms > 0)
+		{
+			ang = g_sim.turn_dir * c->control_ang_vel;
+			g_sim.turn_ms = g_sim.turn_ms > dt_ms ? g_sim.turn_ms - dt_ms : 0;
+		}
+		else
+		{
+			lin = c->control_lin_vel;
+		}
+		break;
+
+	case RVC_MODE_SET_CLEANING_SPOT:
+	{
+		// Outward spiral with a radius growing 40 mm per second, up to one meter.
+		float radius = 100.f + 0.04f * (g_sim.now_ms - g_sim.spot_start_ms);
+
+		if (radius > 1000.f)
+		{
+			g_sim.mode = RVC_MODE_SET_PAUSE;
+			_post(EVT_MODE, _get_mode(g_sim.mode), 0, 0, 0, 0, 0, 0);
+		}
+		else
+		{
+			lin = c->control_lin_vel;
+			ang = lin / radius;
+		}
+		break;
+	}
+
+	case RVC_MODE_SET_DOCKING:
+	{
+		float dist = hypotf(g_sim.x, g_sim.y);
+		float err = _wrap(atan2f(-g_sim.y, -g_sim.x) - g_sim.q);
+
+		if (dist < SIM_DOCK_TOLERANCE)
+		{
+			g_sim.docked = true;
+			g_sim.mode = RVC_MODE_SET_PAUSE;
+			_post(EVT_MODE, _get_mode(g_sim.mode), 0, 0, 0, 0, 0, 0);
+		}
+		else if (fabsf(err) > 0.3f)
+		{
+			ang = err > 0.f ? c->control_ang_vel : -c->control_ang_vel;
+		}
+		else
+		{
+			lin = fminf(c->max_lin_vel, 2.f * dist);
+			ang = 2.f * err;
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	if (g_sim.error || g_sim.lift)
+		lin = ang = 0.f;
+
+	// A stuck bumper or an active cliff sensor keeps the robot from moving forward.
+	if (lin > 0.f && (g_sim.forced_bumper || g_sim.cliff))
+		lin = 0.f;
+
+	g_sim.lin = fmaxf(-c->max_lin_vel, fminf(c->max_lin_vel, lin));
+	g_sim.ang = fmaxf(-c->max_ang_vel, fminf(c->max_ang_vel, ang));
+}
+
+/* Integrates motion and updates sensors. Caller holds the lock. */
+static void
+_physics(unsigned int dt_ms)
+{
+	const rvc_sim_config_s *c = &g_sim.config;
+	float dt = dt_ms / 1000.f;
+	float q = _wrap(g_sim.q + g_sim.ang * dt);
+	float mid = _wrap(g_sim.q + 0.5f * g_sim.ang * dt);
+	float nx = g_sim.x + g_sim.lin * cosf(mid) * dt;
+	float ny = g_sim.y + g_sim.lin * sinf(mid) * dt;
+	unsigned char bumper = 0, cliff, lift, magnet;
+	bool blocked = false;
+	int level;
+
+	// Walls stop the translation and press the bumper on the side of contact.
+	if (nx - c->body_radius < c->room_min_x && nx < g_sim.x)
+	{
+		blocked = true;
+		bumper |= _bumper_mask(M_PI);
+	}
+	if (nx + c->body_radius > c->room_max_x && nx > g_sim.x)
+	{
+		blocked = true;
+		bumper |= _bumper_mask(0.f);
+	}
+	if (ny - c->body_radius < c->room_min_y && ny < g_sim.y)
+	{
+		blocked = true;
+		bumper |= _bumper_mask(-M_PI / 2);
+	}
+	if (ny + c->body_radius > c->room_max_y && ny > g_sim.y)
+	{
+		blocked = true;
+		bumper |= _bumper_mask(M_PI / 2);
+	}
+
+	cliff = _cliff_mask(nx, ny, q);
+
+	g_sim.q = q;
+	if (!blocked && !(cliff && g_sim.lin > 0.f))
+	{
+		g_sim.distance += hypotf(nx - g_sim.x, ny - g_sim.y);
+		g_sim.x = nx;
+		g_sim.y = ny;
+		if (g_sim.docked && g_sim.lin != 0.f)
+			g_sim.docked = false;
+	}
+	else
+	{
+		cliff = _cliff_mask(g_sim.x, g_sim.y, q);
+		if (g_sim.mode == RVC_MODE_SET_CLEANING_AUTO && g_sim.turn_ms == 0)
+			_start_bounce();
+	}
+
+	bumper |= g_sim.forced_bumper;
+	cliff |= g_sim.forced_cliff;
+	lift = g_sim.forced_lift;
+	magnet = _in_zone(g_sim.magnets, g_sim.magnet_count, g_sim.x, g_sim.y);
+
+	if (bumper != g_sim.bumper)
+		_post(EVT_BUMPER, !!(bumper & 0x1), !!(bumper & 0x4), 0, 0, 0, 0, 0);
+	if (cliff != g_sim.cliff)
+		_post(EVT_CLIFF, !!(cliff & 0x1), !!(cliff & 0x2), !!(cliff & 0x4), 0, 0, 0, 0);
+	if (lift != g_sim.lift)
+		_post(EVT_LIFT, !!(lift & 0x1), !!(lift & 0x4), 0, 0, 0, 0, 0);
+	if (magnet != g_sim.magnet)
+		_post(EVT_MAGNET, magnet, 0, 0, 0, 0, 0, 0);
+
+	g_sim.bumper = bumper;
+	g_sim.cliff = cliff;
+	g_sim.lift = lift;
+	g_sim.magnet = magnet;
+
+	// Battery
+	if (g_sim.docked)
+	{
+		g_sim.charge = fminf(1.f, g_sim.charge + c->batt_charge_rate * dt);
+	}
+	else
+	{
+		float drain = c->batt_drain_idle + c->batt_drain_motion * fabsf(g_sim.lin);
+
+		if (g_sim.mode == RVC_MODE_SET_CLEANING_AUTO || g_sim.mode == RVC_MODE_SET_CLEANING_SPOT || g_sim.mode == SIM_MODE_MANUAL)
+			drain += c->batt_drain_suction[g_sim.suction & 3];
+		g_sim.charge = fmaxf(0.f, g_sim.charge - drain * dt);
+	}
+
+	level = (int)(g_sim.charge * c->batt_levels);
+	if (level >= c->batt_levels)
+		level = c->batt_levels - 1;
+	if (level != g_sim.batt_level)
+	{
+		g_sim.batt_level = level;
+		_post(EVT_BATT, level, 0, 0, 0, 0, 0, 0);
+	}
+	if (!g_sim.batt_low_sent && g_sim.charge < c->batt_low_threshold)
+	{
+		g_sim.batt_low_sent = true;
+		_post(EVT_BATT_LOW, 0, 0, 0, 0, 0, 0, 0);
+	}
+	else if (g_sim.batt_low_sent && g_sim.charge >= c->batt_low_threshold)
+	{
+		g_sim.batt_low_sent = false;
+	}
+
+	if (g_sim.now_ms >= g_sim.next_pose_ms)
+	{
+		float half = 0.5f * c->wheel_base * g_sim.ang;
+
+		g_sim.next_pose_ms = g_sim.now_ms + c->pose_period_ms;
+		_post(EVT_POSE, 0, 0, 0, 0, g_sim.x, g_sim.y, g_sim.q);
+		_post(EVT_WHEEL_VEL, (int)lroundf(g_sim.lin - half), (int)lroundf(g_sim.lin + half), 0, 0, 0, 0, 0);
+		_post(EVT_LIN_ANG, 0, 0, 0, 0, g_sim.lin, g_sim.ang, 0);
+	}
+}
+
+void rvc_sim_step(unsigned int dt_ms)
+{
+	sim_event_s due[SIM_EVENT_QUEUE];
+	sim_callback_s cbs[SIM_EVENT_QUEUE];
+	int i, n;
+
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.now_ms += dt_ms;
+	if (g_sim.initialized)
+	{
+		_control(dt_ms);
+		_physics(dt_ms);
+	}
+	n = _take_due(due, cbs);
+	pthread_mutex_unlock(&g_sim.lock);
+
+	for (i = 0; i < n; i++)
+		_dispatch(&due[i], &cbs[i]);
+}
+
+static void *
+_sim_thread(void *data)
+{
+	unsigned int period_ms = (unsigned int)(size_t)data;
+	struct timespec next;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (;;)
+	{
+		bool running;
+
+		next.tv_nsec += (long)period_ms * 1000000L;
+		while (next.tv_nsec >= 1000000000L)
+		{
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		pthread_mutex_lock(&g_sim.lock);
+		running = g_sim.running;
+		pthread_mutex_unlock(&g_sim.lock);
+		if (!running)
+			break;
+
+		rvc_sim_step(period_ms);
+	}
+
+	return NULL;
+}
+
+int rvc_sim_start(unsigned int period_ms)
+{
+	int ret;
+
+	if (period_ms == 0)
+		return -1;
+
+	pthread_mutex_lock(&g_sim.lock);
+	if (g_sim.running)
+	{
+		pthread_mutex_unlock(&g_sim.lock);
+		return -1;
+	}
+	g_sim.running = true;
+	pthread_mutex_unlock(&g_sim.lock);
+
+	ret = pthread_create(&g_sim.thread, NULL, _sim_thread, (void *)(size_t)period_ms);
+	if (ret != 0)
+	{
+		pthread_mutex_lock(&g_sim.lock);
+		g_sim.running = false;
+		pthread_mutex_unlock(&g_sim.lock);
+		return -1;
+	}
+
+	return RVC_USER_ERROR_NONE;
+}
+
+void rvc_sim_stop(void)
+{
+	bool running;
+
+	pthread_mutex_lock(&g_sim.lock);
+	running = g_sim.running;
+	g_sim.running = false;
+	pthread_mutex_unlock(&g_sim.lock);
+
+	if (running)
+		pthread_join(g_sim.thread, NULL);
+}
+
+unsigned long long rvc_sim_now_ms(void)
+{
+	unsigned long long now;
+
+	pthread_mutex_lock(&g_sim.lock);
+	now = g_sim.now_ms;
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return now;
+}
+
+void rvc_sim_get_state(rvc_sim_state_s *state)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	state->time_ms = g_sim.now_ms;
+	state->x = g_sim.x;
+	state->y = g_sim.y;
+	state->q = g_sim.q;
+	state->lin = g_sim.lin;
+	state->ang = g_sim.ang;
+	state->cmd_lin = g_sim.cmd_lin;
+	state->cmd_ang = g_sim.cmd_ang;
+	state->charge = g_sim.charge;
+	state->distance = g_sim.distance;
+	state->mode = g_sim.mode;
+	state->docked = g_sim.docked;
+	state->error = g_sim.error;
+	state->suction = g_sim.suction;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+void rvc_sim_set_cmd_hook(rvc_sim_cmd_hook hook, void *user_data)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.cmd_hook = hook;
+	g_sim.cmd_hook_data = user_data;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+void rvc_sim_force_error(rvc_device_error_type_e error)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	if (error != g_sim.error)
+	{
+		g_sim.error = error;
+		_post(EVT_ERROR, error, 0, 0, 0, 0, 0, 0);
+	}
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+void rvc_sim_force_lift(unsigned char mask)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.forced_lift = mask & 0x5;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+void rvc_sim_force_cliff(unsigned char mask)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.forced_cliff = mask & 0x7;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+void rvc_sim_force_bumper(unsigned char mask)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.forced_bumper = mask & 0x5;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+void rvc_sim_set_callback_drop(unsigned int percent)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.cb_drop_percent = percent > 100 ? 100 : percent;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+void rvc_sim_set_callback_delay(unsigned int delay_ms)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.cb_delay_ms = delay_ms;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+void rvc_sim_set_command_drop(unsigned int percent)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.cmd_drop_percent = percent > 100 ? 100 : percent;
+	pthread_mutex_unlock(&g_sim.lock);
+}
+
+/*
+ * rvc_api.h
+ */
+
+int rvc_initialize(void)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	if (g_sim.config.batt_levels <= 0)
+		rvc_sim_config_default(&g_sim.config);
+	_reset_world();
+	g_sim.initialized = true;
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+int rvc_deinitialize(void)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.initialized = false;
+	memset(g_sim.callbacks, 0, sizeof(g_sim.callbacks));
+	g_sim.event_count = 0;
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+static int
+_set_cb(sim_event_e type, void *cb, void *user_data)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.callbacks[type].cb = cb;
+	g_sim.callbacks[type].user_data = user_data;
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+#define SIM_CALLBACK(name, type, evt) \
+	int rvc_set_##name##_evt_cb(type cb, void* user_data) { return _set_cb(evt, (void *)cb, user_data); } \
+	int rvc_unset_##name##_evt_cb(void) { return _set_cb(evt, NULL, NULL); }
+
+SIM_CALLBACK(mode, rvc_mode_evt_cb, EVT_MODE)
+SIM_CALLBACK(error, rvc_error_evt_cb, EVT_ERROR)
+SIM_CALLBACK(wheel_vel, rvc_wheel_vel_evt_cb, EVT_WHEEL_VEL)
+SIM_CALLBACK(pose, rvc_pose_evt_cb, EVT_POSE)
+SIM_CALLBACK(bumper, rvc_bumper_evt_cb, EVT_BUMPER)
+SIM_CALLBACK(cliff, rvc_cliff_evt_cb, EVT_CLIFF)
+SIM_CALLBACK(lift, rvc_lift_evt_cb, EVT_LIFT)
+SIM_CALLBACK(magnet, rvc_magnet_evt_cb, EVT_MAGNET)
+SIM_CALLBACK(suction, rvc_suction_evt_cb, EVT_SUCTION)
+SIM_CALLBACK(batt, rvc_batt_evt_cb, EVT_BATT)
+SIM_CALLBACK(voice, rvc_voice_evt_cb, EVT_VOICE)
+SIM_CALLBACK(batt_low, rvc_batt_low_evt_cb, EVT_BATT_LOW)
+SIM_CALLBACK(reservation, rvc_reservation_evt_cb, EVT_RESERVATION)
+SIM_CALLBACK(lin_ang, rvc_lin_ang_evt_cb, EVT_LIN_ANG)
+
+/*
+ * Reports a command to the hook and decides whether it is lost. The hook is
+ * called with the lock held and must not call back into the simulator.
+ */
+static bool
+_accept_cmd(rvc_sim_cmd_e cmd, float a, float b)
+{
+	bool dropped = g_sim.cmd_drop_percent && _rand(&g_sim.fault_rng) % 100 < g_sim.cmd_drop_percent;
+
+	if (g_sim.cmd_hook)
+		g_sim.cmd_hook(cmd, dropped, a, b, g_sim.cmd_hook_data);
+
+	return !dropped;
+}
+
+static int
+_set_motion(rvc_sim_cmd_e cmd, float lin, float ang, float a, float b)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	if (!g_sim.initialized)
+	{
+		pthread_mutex_unlock(&g_sim.lock);
+		return -1;
+	}
+	if (_accept_cmd(cmd, a, b))
+	{
+		g_sim.mode = SIM_MODE_MANUAL;
+		g_sim.cmd_lin = lin;
+		g_sim.cmd_ang = ang;
+		g_sim.last_cmd_ms = g_sim.now_ms;
+	}
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+int rvc_set_lin_ang(float lin, float ang)
+{
+	return _set_motion(RVC_SIM_CMD_LIN_ANG, lin, ang, lin, ang);
+}
+
+int rvc_set_wheel_vel(signed short wheel_vel_left, signed short wheel_vel_right)
+{
+	// wheel_vel_left = v - 0.5 * wheel_base * w, wheel_vel_right = v + 0.5 * wheel_base * w
+	float lin = 0.5f * (wheel_vel_left + wheel_vel_right);
+	float ang = (wheel_vel_right - wheel_vel_left) / g_sim.config.wheel_base;
+
+	return _set_motion(RVC_SIM_CMD_WHEEL_VEL, lin, ang, wheel_vel_left, wheel_vel_right);
+}
+
+int rvc_set_control(rvc_control_dir_e dir)
+{
+	float lin = 0.f, ang = 0.f;
+
+	if (dir == RVC_CONTROL_DIR_FORWARD)
+		lin = g_sim.config.control_lin_vel;
+	else if (dir == RVC_CONTROL_DIR_LEFT)
+		ang = g_sim.config.control_ang_vel;
+	else if (dir == RVC_CONTROL_DIR_RIGHT)
+		ang = -g_sim.config.control_ang_vel;
+
+	return _set_motion(RVC_SIM_CMD_CONTROL, lin, ang, dir, 0);
+}
+
+int rvc_set_mode(rvc_mode_type_set_e mode)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	if (!g_sim.initialized)
+	{
+		pthread_mutex_unlock(&g_sim.lock);
+		return -1;
+	}
+	if (_accept_cmd(RVC_SIM_CMD_MODE, mode, 0))
+	{
+		g_sim.mode = mode;
+		g_sim.cmd_lin = g_sim.cmd_ang = 0.f;
+		g_sim.turn_ms = 0;
+		if (mode == RVC_MODE_SET_CLEANING_SPOT)
+			g_sim.spot_start_ms = g_sim.now_ms;
+		_post(EVT_MODE, _get_mode(mode), 0, 0, 0, 0, 0, 0);
+	}
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+int rvc_set_suction_state(rvc_suction_state_e state)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	if (_accept_cmd(RVC_SIM_CMD_SUCTION, state, 0) && state != g_sim.suction)
+	{
+		g_sim.suction = state;
+		_post(EVT_SUCTION, state, 0, 0, 0, 0, 0, 0);
+	}
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+int rvc_set_time(unsigned char hour, unsigned char minute)
+{
+	return RVC_USER_ERROR_NONE;
+}
+
+int rvc_set_voice(rvc_voice_type_e type)
+{
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.voice = type;
+	_post(EVT_VOICE, type, 0, 0, 0, 0, 0, 0);
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+static int
+_set_reserve(rvc_reserve_type_e type, unsigned char is_on, unsigned char hour, unsigned char minute)
+{
+	if ((int)type < 0 || (int)type > 1)
+		return -1;
+
+	pthread_mutex_lock(&g_sim.lock);
+	g_sim.reserve[type][0] = is_on;
+	g_sim.reserve[type][1] = hour;
+	g_sim.reserve[type][2] = minute;
+	_post(EVT_RESERVATION, type, is_on, hour, minute, 0, 0, 0);
+	pthread_mutex_unlock(&g_sim.lock);
+
+	return RVC_USER_ERROR_NONE;
+}
+
+int rvc_set_reserve(rvc_reserve_type_e type, unsigned char hour, unsigned char minute)
+{
+	return _set_reserve(type, 1, hour, minute);
+}
+
+int rvc_set_reserve_cancel(rvc_reserve_type_e type)
+{
+	return _set_reserve(type, 0, 0, 0);
+}
+
+#define SIM_GET_BEGIN	pthread_mutex_lock(&g_sim.lock)
+#define SIM_GET_END		pthread_mutex_unlock(&g_sim.lock); return RVC_USER_ERROR_NONE
+
+int rvc_get_mode(rvc_mode_type_get_e* mode)
+{
+	SIM_GET_BEGIN;
+	*mode = _get_mode(g_sim.mode);
+	SIM_GET_END;
+}
+
+int rvc_get_error(rvc_device_error_type_e* error)
+{
+	SIM_GET_BEGIN;
+	*error = g_sim.error;
+	SIM_GET_END;
+}
+
+int rvc_get_wheel_vel(signed short* wheel_vel_left, signed short* wheel_vel_right)
+{
+	SIM_GET_BEGIN;
+	*wheel_vel_left = (signed short)lroundf(g_sim.lin - 0.5f * g_sim.config.wheel_base * g_sim.ang);
+	*wheel_vel_right = (signed short)lroundf(g_sim.lin + 0.5f * g_sim.config.wheel_base * g_sim.ang);
+	SIM_GET_END;
+}
+
+int rvc_get_bumper(unsigned char* bumper_left, unsigned char* bumper_right)
+{
+	SIM_GET_BEGIN;
+	*bumper_left = !!(g_sim.bumper & 0x1);
+	*bumper_right = !!(g_sim.bumper & 0x4);
+	SIM_GET_END;
+}
+
+int rvc_get_pose(float* pose_x, float* pose_y, float* pose_q)
+{
+	SIM_GET_BEGIN;
+	*pose_x = g_sim.x;
+	*pose_y = g_sim.y;
+	*pose_q = g_sim.q;
+	SIM_GET_END;
+}
+
+int rvc_get_cliff(unsigned char* cliff_left, unsigned char* cliff_center, unsigned char* cliff_right)
+{
+	SIM_GET_BEGIN;
+	*cliff_left = !!(g_sim.cliff & 0x1);
+	*cliff_center = !!(g_sim.cliff & 0x2);
+	*cliff_right = !!(g_sim.cliff & 0x4);
+	SIM_GET_END;
+}
+
+int rvc_get_lift(unsigned char* lift_left, unsigned char* lift_right)
+{
+	SIM_GET_BEGIN;
+	*lift_left = !!(g_sim.lift & 0x1);
+	*lift_right = !!(g_sim.lift & 0x4);
+	SIM_GET_END;
+}
+
+int rvc_get_magnet(unsigned char* magnet)
+{
+	SIM_GET_BEGIN;
+	*magnet = g_sim.magnet;
+	SIM_GET_END;
+}
+
+int rvc_get_suction_state(rvc_suction_state_e* state)
+{
+	SIM_GET_BEGIN;
+	*state = g_sim.suction;
+	SIM_GET_END;
+}
+
+int rvc_get_reserve(rvc_reserve_type_e type, unsigned char* is_on, unsigned char* hour, unsigned char* minute)
+{
+	if ((int)type < 0 || (int)type > 1)
+		return -1;
+
+	SIM_GET_BEGIN;
+	*is_on = g_sim.reserve[type][0];
+	*hour = g_sim.reserve[type][1];
+	*minute = g_sim.reserve[type][2];
+	SIM_GET_END;
+}
+
+int rvc_get_lin_ang_vel(float* lin_vel, float* ang_vel)
+{
+	SIM_GET_BEGIN;
+	*lin_vel = g_sim.lin;
+	*ang_vel = g_sim.ang;
+	SIM_GET_END;
+}
+
+int rvc_get_battery_level(rvc_batt_level_e* level)
+{
+	SIM_GET_BEGIN;
+	*level = (rvc_batt_level_e)g_sim.batt_level;
+	SIM_GET_END;
+}
+
+int rvc_get_voice_type(rvc_voice_type_e* type)
+{
+	SIM_GET_BEGIN;
+	*type = g_sim.voice;
+	SIM_GET_END;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file	rvc_sim.h
+ * @brief	Simulated RVC device implementing the rvc_api.h interface
+ *
+ * Link rvc_sim.c in place of librvc to run RVC applications on a desktop.
+ * The device is stepped on a virtual clock, either explicitly with
+ * rvc_sim_step() for deterministic runs or from a real time thread started
+ * with rvc_sim_start(). Event callbacks are dispatched from the stepping
+ * thread with no simulator lock held, so they may call the rvc_get_*() API.
+ *
+ * Units follow the device: positions in mm, angles in rad, velocities in
+ * mm/s and rad/s.
+ */
+
+#ifndef __rvc_sim_H__
+#define __rvc_sim_H__
+
+#include <stdbool.h>
+
+#include "rvc_api.h"
+
+#define RVC_SIM_MAX_ZONES	16
+
+/**
+ * @brief Static description of the robot and its world.
+ * @details The room is an axis aligned rectangle. The robot starts on its dock at the
+ * origin, facing +x.
+ */
+typedef struct {
+	float room_min_x, room_min_y;
+	float room_max_x, room_max_y;
+	float wheel_base;			// Distance between the wheels
+	float body_radius;
+	float max_lin_vel;
+	float max_ang_vel;
+	float control_lin_vel;		// Speed used by rvc_set_control(RVC_CONTROL_DIR_FORWARD)
+	float control_ang_vel;		// Turn rate used by rvc_set_control(LEFT/RIGHT)
+	unsigned int cmd_timeout_ms;	// Motion stops if no command arrives for this long
+	unsigned int pose_period_ms;	// Period of pose, wheel and lin/ang callbacks
+	int batt_levels;			// Number of rvc_batt_level_e steps reported, lowest first
+	float batt_drain_idle;		// Charge fraction per second with motors and suction off
+	float batt_drain_suction[4];	// Extra drain per rvc_suction_state_e
+	float batt_drain_motion;	// Extra drain per mm/s of linear speed
+	float batt_charge_rate;		// Charge fraction per second on the dock
+	float batt_low_threshold;
+} rvc_sim_config_s;
+
+/**
+ * @brief Ground truth of the simulated robot.
+ */
+typedef struct {
+	unsigned long long time_ms;
+	float x, y, q;
+	float lin, ang;				// Velocity actually applied this step
+	float cmd_lin, cmd_ang;		// Velocity last commanded by the application
+	float charge;				// Battery charge fraction, 0..1
+	float distance;				// Total distance driven
+	int mode;					// Last rvc_mode_type_set_e accepted, or -1 for manual
+	bool docked;
+	rvc_device_error_type_e error;
+	rvc_suction_state_e suction;
+} rvc_sim_state_s;
+
+/**
+ * @brief Application requests seen by the simulator, reported to the command hook.
+ */
+typedef enum {
+	RVC_SIM_CMD_MODE,
+	RVC_SIM_CMD_CONTROL,
+	RVC_SIM_CMD_WHEEL_VEL,
+	RVC_SIM_CMD_LIN_ANG,
+	RVC_SIM_CMD_SUCTION,
+} rvc_sim_cmd_e;
+
+typedef void (*rvc_sim_cmd_hook)(rvc_sim_cmd_e cmd, bool dropped, float a, float b, void *user_data);
+
+void rvc_sim_config_default(rvc_sim_config_s *config);
+
+/**
+ * @brief Replaces the configuration and resets the world. Call before rvc_initialize().
+ */
+int rvc_sim_setup(const rvc_sim_config_s *config);
+
+/**
+ * @brief Adds a drop-off region. The cliff sensors fire when they pass over it.
+ */
+int rvc_sim_add_cliff(float min_x, float min_y, float max_x, float max_y);
+
+/**
+ * @brief Adds a magnetic strip region. The magnet sensor fires while the robot is on it.
+ */
+int rvc_sim_add_magnet(float min_x, float min_y, float max_x, float max_y);
+
+/**
+ * @brief Seeds the simulator's own random source (bounce angles in auto cleaning).
+ */
+void rvc_sim_seed(unsigned int seed);
+
+/**
+ * @brief Advances the virtual clock by @a dt_ms and dispatches due callbacks.
+ */
+void rvc_sim_step(unsigned int dt_ms);
+
+/**
+ * @brief Steps the simulator from a background thread, tracking the wall clock.
+ */
+int rvc_sim_start(unsigned int period_ms);
+
+void rvc_sim_stop(void);
+
+unsigned long long rvc_sim_now_ms(void);
+
+void rvc_sim_get_state(rvc_sim_state_s *state);
+
+/**
+ * @brief Registers a hook that observes every motion, mode and suction request.
+ */
+void rvc_sim_set_cmd_hook(rvc_sim_cmd_hook hook, void *user_data);
+
+/*
+ * Fault controls, used by rvc_fault.c. Masks use bit 0 for left, bit 1 for
+ * center and bit 2 for right. Percentages are 0..100.
+ */
+void rvc_sim_force_error(rvc_device_error_type_e error);
+void rvc_sim_force_lift(unsigned char mask);
+void rvc_sim_force_cliff(unsigned char mask);
+void rvc_sim_force_bumper(unsigned char mask);
+void rvc_sim_set_callback_drop(unsigned int percent);
+void rvc_sim_set_callback_delay(unsigned int delay_ms);
+void rvc_sim_set_command_drop(unsigned int percent);
+
+#endif /* __rvc_sim_H__ */
@@ -0,0 +1,190 @@
+/**
+ * @file	tlmQuery.c
+ * @brief	Range queries over RVC telemetry archives (tlm_archive.h)
+ *
+ * Build on a desktop:
+ *   cc -I. tlmQuery.c tlm_archive.c -lm -lpthread
+ *
+ * Usage: tlmQuery [-s STREAMS] [-f T1] [-t T2] [-e EVENT] [-q] FILE...
+ *   -s	comma separated streams: pose, wheel, lin_ang, event (default all)
+ *   -f	start time, seconds since the epoch (default: beginning)
+ *   -t	end time, exclusive (default: end)
+ *   -e	only events of this kind: bumper, cliff, lift, magnet, mode, error, suction, battery
+ *   -q	print only the statistics
+ *
+ * Example, all bumper hits and the pose between two times:
+ *   tlmQuery -s pose,event -e bumper -f 1477900800 -t 1477904400 rvc_*.tlm
+ *
+ * Records are printed as CSV (file, stream, t_us, values...), in time order per
+ * stream and file. Block statistics go to stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "tlm_archive.h"
+
+static const char *g_event_names[] = {
+	NULL, "bumper", "cliff", "lift", "magnet", "mode", "error", "suction", "battery",
+};
+
+#define EVENT_NAME_COUNT	(int)(sizeof(g_event_names) / sizeof(g_event_names[0]))
+
+typedef struct {
+	const char *file;
+	bool quiet;
+} query_ctx_s;
+
+static bool
+_print_record(tlm_stream_e stream, uint64_t t_us, const double *values, int count, void *user_data)
+{
+	query_ctx_s *ctx = user_data;
+	int c;
+
+	if (ctx->quiet)
+		return true;
+
+	printf("%s,%s,%llu", ctx->file, tlm_stream_name(stream), (unsigned long long)t_us);
+	if (stream == TLM_STREAM_EVENT && values[0] > 0 && values[0] < EVENT_NAME_COUNT)
+	{
+		printf(",%s,%d\n", g_event_names[(int)values[0]], (int)values[1]);
+		return true;
+	}
+
+	for (c = 0; c < count; c++)
+		printf(",%.4f", values[c]);
+	printf("\n");
+
+	return true;
+}
+
+static int
+_parse_streams(const char *arg, unsigned int *streams)
+{
+	char buf[128];
+	char *tok, *save = NULL;
+	int s;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	*streams = 0;
+
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+	{
+		for (s = 0; s < TLM_STREAM_MAX; s++)
+		{
+			if (!strcmp(tok, tlm_stream_name(s)))
+				break;
+		}
+		if (s == TLM_STREAM_MAX)
+			return -1;
+		*streams |= TLM_STREAM_MASK(s);
+	}
+
+	return *streams ? 0 : -1;
+}
+
+static void
+_usage(void)
+{
+	fprintf(stderr, "usage: tlmQuery [-s pose,wheel,lin_ang,event] [-f T1] [-t T2] [-e EVENT] [-q] FILE...\n");
+}
+
+int main(int argc, char *argv[])
+{
+	tlm_query_s query = { TLM_STREAM_ALL, 0, UINT64_MAX, -1, 0, 0.0, 0.0 };
+	tlm_query_stats_s stats;
+	query_ctx_s ctx = { NULL, false };
+	int files = 0, errors = 0;
+	int i, e;
+
+	memset(&stats, 0, sizeof(stats));
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-s") && i + 1 < argc)
+		{
+			if (_parse_streams(argv[++i], &query.streams) != 0)
+			{
+				fprintf(stderr, "unknown stream in: %s\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+		{
+			query.t_from = (uint64_t)(strtod(argv[++i], NULL) * 1e6);
+		}
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+		{
+			query.t_to = (uint64_t)(strtod(argv[++i], NULL) * 1e6);
+		}
+		else if (!strcmp(argv[i], "-e") && i + 1 < argc)
+		{
+			i++;
+			for (e = 1; e < EVENT_NAME_COUNT; e++)
+			{
+				if (!strcmp(argv[i], g_event_names[e]))
+					break;
+			}
+			if (e == EVENT_NAME_COUNT)
+			{
+				fprintf(stderr, "unknown event: %s\n", argv[i]);
+				return 2;
+			}
+			query.filter_stream = TLM_STREAM_EVENT;
+			query.filter_column = 0;
+			query.filter_min = query.filter_max = e;
+		}
+		else if (!strcmp(argv[i], "-q"))
+		{
+			ctx.quiet = true;
+		}
+		else if (argv[i][0] == '-')
+		{
+			_usage();
+			return 2;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (i == argc)
+	{
+		_usage();
+		return 2;
+	}
+
+	for (; i < argc; i++)
+	{
+		tlm_reader_h reader;
+		int ret;
+
+		ret = tlm_reader_open(argv[i], &reader);
+		if (ret != TLM_ARCHIVE_ERROR_NONE)
+		{
+			fprintf(stderr, "%s: cannot open archive (%d)\n", argv[i], ret);
+			errors++;
+			continue;
+		}
+
+		files++;
+		ctx.file = argv[i];
+		ret = tlm_reader_query(reader, &query, _print_record, &ctx, &stats);
+		if (ret != TLM_ARCHIVE_ERROR_NONE)
+		{
+			fprintf(stderr, "%s: query failed (%d)\n", argv[i], ret);
+			errors++;
+		}
+
+		tlm_reader_close(reader);
+	}
+
+	fprintf(stderr, "files %d, blocks read %u of %u, %llu bytes, %llu records\n",
+		files, stats.blocks_read, stats.blocks_total,
+		(unsigned long long)stats.bytes_read, (unsigned long long)stats.records);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,860 @@
+/**
+ * @file	tlm_archive.c
+ * @brief	Columnar, time-indexed archive of RVC telemetry
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "tlm_archive.h"
+
+#define TLM_FILE_MAGIC		"RVCTLM\0\1"
+#define TLM_FILE_VERSION	2
+#define TLM_BLOCK_MAGIC		0x424d4c54u	// "TLMB"
+#define TLM_INDEX_MAGIC		0x494d4c54u	// "TLMI"
+#define TLM_VARINT_MAX		10
+#define TLM_PAYLOAD_MAX		((TLM_MAX_COLUMNS + 1) * TLM_BLOCK_RECORDS * TLM_VARINT_MAX)
+
+/*
+ * Record times are microseconds on the monotonic clock since the writer was
+ * opened, so stepping the wall clock cannot reorder them. The wall clock at that
+ * moment is kept once, here, and readers report wall_base_us + t.
+ */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t wall_base_us;
+} tlm_file_header_s;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t stream;
+	uint16_t columns;
+	uint32_t count;
+	uint32_t size;							// Payload bytes following the header
+	uint64_t t_min;
+	uint64_t t_max;
+	int32_t min[TLM_MAX_COLUMNS];
+	int32_t max[TLM_MAX_COLUMNS];
+	uint32_t col_size[TLM_MAX_COLUMNS + 1];	// Time column first
+	uint32_t payload_crc;
+	uint32_t crc;							// CRC32 of all preceding fields
+} tlm_block_header_s;
+
+typedef struct {
+	uint64_t offset;
+	tlm_block_header_s header;
+} tlm_index_entry_s;
+
+typedef struct {
+	uint64_t index_offset;
+	uint32_t block_count;
+	uint32_t index_crc;
+	uint32_t magic;
+	uint32_t reserved;
+} tlm_trailer_s;
+
+typedef struct {
+	uint64_t t[TLM_BLOCK_RECORDS];
+	int32_t v[TLM_MAX_COLUMNS][TLM_BLOCK_RECORDS];
+	int count;
+	uint64_t last_t;
+} tlm_stream_buffer_s;
+
+struct tlm_writer_s {
+	int fd;
+	uint64_t offset;
+	uint64_t mono_base_us;
+	bool failed;
+	tlm_stream_buffer_s streams[TLM_STREAM_MAX];
+	tlm_index_entry_s *index;
+	uint32_t index_count;
+	uint32_t index_capacity;
+	unsigned char payload[TLM_PAYLOAD_MAX];
+	pthread_mutex_t lock;
+};
+
+struct tlm_reader_s {
+	int fd;
+	uint64_t data_offset;					// First block
+	uint64_t wall_base_us;
+	tlm_index_entry_s *index;
+	uint32_t index_count;
+	uint32_t *by_stream[TLM_STREAM_MAX];	// Index entries of each stream, in time order
+	uint32_t stream_count[TLM_STREAM_MAX];
+	unsigned char payload[TLM_PAYLOAD_MAX];
+	uint64_t t[TLM_BLOCK_RECORDS];				// Decoded block
+	int32_t v[TLM_MAX_COLUMNS][TLM_BLOCK_RECORDS];
+};
+
+static const int g_column_count[TLM_STREAM_MAX] = { 3, 2, 2, 2 };
+
+static const double g_column_scale[TLM_STREAM_MAX][TLM_MAX_COLUMNS] = {
+	{ 10.0, 10.0, 10000.0 },	// 0.1 mm, 0.1 mrad
+	{ 1.0, 1.0 },
+	{ 100.0, 10000.0 },
+	{ 1.0, 1.0 },
+};
+
+static const char *g_stream_name[TLM_STREAM_MAX] = { "pose", "wheel", "lin_ang", "event" };
+
+static uint32_t
+_crc32(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t crc = 0xffffffffu;
+	int k;
+
+	while (len--)
+	{
+		crc ^= *p++;
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+int tlm_column_count(tlm_stream_e stream)
+{
+	return (stream >= 0 && stream < TLM_STREAM_MAX) ? g_column_count[stream] : 0;
+}
+
+double tlm_column_scale(tlm_stream_e stream, int column)
+{
+	if (column < 0 || column >= tlm_column_count(stream))
+		return 1.0;
+
+	return g_column_scale[stream][column];
+}
+
+const char *tlm_stream_name(tlm_stream_e stream)
+{
+	return (stream >= 0 && stream < TLM_STREAM_MAX) ? g_stream_name[stream] : "unknown";
+}
+
+/*
+ * Varint coding
+ */
+
+static inline uint64_t
+_zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t
+_unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline unsigned char *
+_put_varint(unsigned char *p, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+
+	return p;
+}
+
+/* Returns NULL if the varint runs past @a end. */
+static inline const unsigned char *
+_get_varint(const unsigned char *p, const unsigned char *end, uint64_t *v)
+{
+	uint64_t r = 0;
+	int shift = 0;
+
+	while (p < end && shift < 64)
+	{
+		unsigned char b = *p++;
+
+		r |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+		{
+			*v = r;
+			return p;
+		}
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+/*
+ * Writer
+ */
+
+static int
+_write_all(int fd, const void *data, size_t len, uint64_t offset)
+{
+	const char *p = data;
+
+	while (len > 0)
+	{
+		ssize_t n = pwrite(fd, p, len, (off_t)offset);
+
+		if (n <= 0)
+			return TLM_ARCHIVE_ERROR_IO;
+		p += n;
+		len -= n;
+		offset += n;
+	}
+
+	return TLM_ARCHIVE_ERROR_NONE;
+}
+
+/* Encodes and writes the buffered records of @a stream. Caller holds the lock. */
+static int
+_flush_stream(struct tlm_writer_s *w, tlm_stream_e stream)
+{
+	tlm_stream_buffer_s *b = &w->streams[stream];
+	tlm_block_header_s header;
+	unsigned char *p = w->payload, *col;
+	int64_t prev_delta = 0;
+	int i, c, ret;
+
+	if (b->count == 0)
+		return TLM_ARCHIVE_ERROR_NONE;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = TLM_BLOCK_MAGIC;
+	header.stream = stream;
+	header.columns = g_column_count[stream];
+	header.count = b->count;
+	header.t_min = b->t[0];
+	header.t_max = b->t[b->count - 1];
+
+	// Time: first value raw, then delta of deltas, which is 0 for evenly spaced samples.
+	col = p;
+	p = _put_varint(p, b->t[0]);
+	for (i = 1; i < b->count; i++)
+	{
+		int64_t delta = (int64_t)(b->t[i] - b->t[i - 1]);
+
+		p = _put_varint(p, _zigzag(delta - prev_delta));
+		prev_delta = delta;
+	}
+	header.col_size[0] = p - col;
+
+	for (c = 0; c < header.columns; c++)
+	{
+		int32_t prev = 0;
+
+		header.min[c] = header.max[c] = b->v[c][0];
+
+		col = p;
+		for (i = 0; i < b->count; i++)
+		{
+			int32_t v = b->v[c][i];
+
+			p = _put_varint(p, _zigzag((int64_t)v - prev));
+			prev = v;
+
+			if (v < header.min[c])
+				header.min[c] = v;
+			if (v > header.max[c])
+				header.max[c] = v;
+		}
+		header.col_size[c + 1] = p - col;
+	}
+
+	header.size = p - w->payload;
+	header.payload_crc = _crc32(w->payload, header.size);
+	header.crc = _crc32(&header, offsetof(tlm_block_header_s, crc));
+
+	if (w->index_count == w->index_capacity)
+	{
+		uint32_t capacity = w->index_capacity ? w->index_capacity * 2 : 64;
+		tlm_index_entry_s *index = realloc(w->index, capacity * sizeof(*index));
+
+		if (!index)
+			return TLM_ARCHIVE_ERROR_OUT_OF_MEMORY;
+		w->index = index;
+		w->index_capacity = capacity;
+	}
+
+	ret = _write_all(w->fd, &header, sizeof(header), w->offset);
+	if (ret == TLM_ARCHIVE_ERROR_NONE)
+		ret = _write_all(w->fd, w->payload, header.size, w->offset + sizeof(header));
+	if (ret != TLM_ARCHIVE_ERROR_NONE)
+		return ret;
+
+	w->index[w->index_count].offset = w->offset;
+	w->index[w->index_count].header = header;
+	w->index_count++;
+	w->offset += sizeof(header) + header.size;
+	b->count = 0;
+
+	return TLM_ARCHIVE_ERROR_NONE;
+}
+
+static uint64_t
+_clock_us(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int tlm_writer_open(const char *path, tlm_writer_h *writer)
+{
+	struct tlm_writer_s *w;
+	tlm_file_header_s header;
+
+	if (!path || !writer)
+		return TLM_ARCHIVE_ERROR_INVALID_PARAMETER;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return TLM_ARCHIVE_ERROR_OUT_OF_MEMORY;
+
+	w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0)
+	{
+		free(w);
+		return TLM_ARCHIVE_ERROR_IO;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TLM_FILE_MAGIC, sizeof(header.magic));
+	header.version = TLM_FILE_VERSION;
+	header.wall_base_us = _clock_us(CLOCK_REALTIME);
+	w->mono_base_us = _clock_us(CLOCK_MONOTONIC);
+	if (_write_all(w->fd, &header, sizeof(header), 0) != TLM_ARCHIVE_ERROR_NONE)
+	{
+		close(w->fd);
+		free(w);
+		return TLM_ARCHIVE_ERROR_IO;
+	}
+	w->offset = sizeof(header);
+
+	pthread_mutex_init(&w->lock, NULL);
+	*writer = w;
+
+	return TLM_ARCHIVE_ERROR_NONE;
+}
+
+uint64_t tlm_writer_now_us(tlm_writer_h writer)
+{
+	return writer ? _clock_us(CLOCK_MONOTONIC) - writer->mono_base_us : 0;
+}
+
+int tlm_writer_close(tlm_writer_h writer)
+{
+	struct tlm_writer_s *w = writer;
+	tlm_trailer_s trailer;
+	int s, ret = TLM_ARCHIVE_ERROR_NONE;
+
+	if (!w)
+		return TLM_ARCHIVE_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&w->lock);
+
+	for (s = 0; s < TLM_STREAM_MAX && ret == TLM_ARCHIVE_ERROR_NONE; s++)
+		ret = _flush_stream(w, s);
+
+	if (ret == TLM_ARCHIVE_ERROR_NONE && !w->failed)
+	{
+		size_t index_size = w->index_count * sizeof(tlm_index_entry_s);
+
+		memset(&trailer, 0, sizeof(trailer));
+		trailer.index_offset = w->offset;
+		trailer.block_count = w->index_count;
+		trailer.index_crc = _crc32(w->index, index_size);
+		trailer.magic = TLM_INDEX_MAGIC;
+
+		ret = _write_all(w->fd, w->index, index_size, w->offset);
+		if (ret == TLM_ARCHIVE_ERROR_NONE)
+			ret = _write_all(w->fd, &trailer, sizeof(trailer), w->offset + index_size);
+	}
+	if (ret == TLM_ARCHIVE_ERROR_NONE && w->failed)
+		ret = TLM_ARCHIVE_ERROR_IO;
+
+	if (fsync(w->fd) != 0 && ret == TLM_ARCHIVE_ERROR_NONE)
+		ret = TLM_ARCHIVE_ERROR_IO;
+	close(w->fd);
+
+	pthread_mutex_unlock(&w->lock);
+	pthread_mutex_destroy(&w->lock);
+	free(w->index);
+	free(w);
+
+	return ret;
+}
+
+static int32_t
+_to_fixed(double value, double scale)
+{
+	double v = round(value * scale);
+
+	if (v > INT32_MAX)
+		return INT32_MAX;
+	if (v < INT32_MIN)
+		return INT32_MIN;
+
+	return (int32_t)v;
+}
+
+int tlm_writer_append(tlm_writer_h writer, tlm_stream_e stream, uint64_t t_us, const double *values)
+{
+	struct tlm_writer_s *w = writer;
+	tlm_stream_buffer_s *b;
+	int c, ret = TLM_ARCHIVE_ERROR_NONE;
+
+	if (!w || stream < 0 || stream >= TLM_STREAM_MAX || !values)
+		return TLM_ARCHIVE_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&w->lock);
+
+	b = &w->streams[stream];
+	// Blocks of a stream must stay in time order for the reader's binary search.
+	if (t_us < b->last_t)
+	{
+		pthread_mutex_unlock(&w->lock);
+		return TLM_ARCHIVE_ERROR_INVALID_PARAMETER;
+	}
+	b->last_t = t_us;
+
+	b->t[b->count] = t_us;
+	for (c = 0; c < g_column_count[stream]; c++)
+		b->v[c][b->count] = _to_fixed(values[c], g_column_scale[stream][c]);
+	b->count++;
+
+	if (b->count == TLM_BLOCK_RECORDS)
+	{
+		ret = _flush_stream(w, stream);
+		if (ret != TLM_ARCHIVE_ERROR_NONE)
+		{
+			// Records are dropped rather than buffered without bound; close reports the failure.
+			w->failed = true;
+			b->count = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&w->lock);
+
+	return ret;
+}
+
+int tlm_writer_pose(tlm_writer_h writer, uint64_t t_us, float x, float y, float q)
+{
+	double values[3] = { x, y, q };
+
+	return tlm_writer_append(writer, TLM_STREAM_POSE, t_us, values);
+}
+
+int tlm_writer_wheel(tlm_writer_h writer, uint64_t t_us, signed short left, signed short right)
+{
+	double values[2] = { left, right };
+
+	return tlm_writer_append(writer, TLM_STREAM_WHEEL, t_us, values);
+}
+
+int tlm_writer_lin_ang(tlm_writer_h writer, uint64_t t_us, float lin, float ang)
+{
+	double values[2] = { lin, ang };
+
+	return tlm_writer_append(writer, TLM_STREAM_LIN_ANG, t_us, values);
+}
+
+int tlm_writer_event(tlm_writer_h writer, uint64_t t_us, tlm_event_e event, int value)
+{
+	double values[2] = { event, value };
+
+	return tlm_writer_append(writer, TLM_STREAM_EVENT, t_us, values);
+}
+
+/*
+ * Reader
+ */
+
+static int
+_read_all(int fd, void *data, size_t len, uint64_t offset)
+{
+	char *p = data;
+
+	while (len > 0)
+	{
+		ssize_t n = pread(fd, p, len, (off_t)offset);
+
+		if (n <= 0)
+			return TLM_ARCHIVE_ERROR_IO;
+		p += n;
+		len -= n;
+		offset += n;
+	}
+
+	return TLM_ARCHIVE_ERROR_NONE;
+}
+
+static bool
+_header_valid(const tlm_block_header_s *h)
+{
+	uint32_t sum = 0;
+	int c;
+
+	if (h->magic != TLM_BLOCK_MAGIC || h->crc != _crc32(h, offsetof(tlm_block_header_s, crc)))
+		return false;
+	if (h->stream >= TLM_STREAM_MAX || h->columns != g_column_count[h->stream]
+			|| h->count == 0 || h->count > TLM_BLOCK_RECORDS || h->size > TLM_PAYLOAD_MAX)
+		return false;
+
+	for (c = 0; c <= h->columns; c++)
+		sum += h->col_size[c];
+
+	return sum == h->size;
+}
+
+/* Loads the index written on close. */
+static int
+_load_index(struct tlm_reader_s *r, uint64_t file_size)
+{
+	tlm_trailer_s trailer;
+	size_t index_size;
+	uint32_t i;
+
+	if (file_size < r->data_offset + sizeof(trailer)
+			|| _read_all(r->fd, &trailer, sizeof(trailer), file_size - sizeof(trailer)) != TLM_ARCHIVE_ERROR_NONE
+			|| trailer.magic != TLM_INDEX_MAGIC)
+		return TLM_ARCHIVE_ERROR_CORRUPT;
+
+	index_size = (size_t)trailer.block_count * sizeof(tlm_index_entry_s);
+	if (trailer.index_offset + index_size + sizeof(trailer) != file_size)
+		return TLM_ARCHIVE_ERROR_CORRUPT;
+
+	r->index = malloc(index_size ? index_size : 1);
+	if (!r->index)
+		return TLM_ARCHIVE_ERROR_OUT_OF_MEMORY;
+
+	if (_read_all(r->fd, r->index, index_size, trailer.index_offset) != TLM_ARCHIVE_ERROR_NONE
+			|| _crc32(r->index, index_size) != trailer.index_crc)
+		goto corrupt;
+
+	for (i = 0; i < trailer.block_count; i++)
+	{
+		if (!_header_valid(&r->index[i].header))
+			goto corrupt;
+	}
+	r->index_count = trailer.block_count;
+
+	return TLM_ARCHIVE_ERROR_NONE;
+
+corrupt:
+	free(r->index);
+	r->index = NULL;
+
+	return TLM_ARCHIVE_ERROR_CORRUPT;
+}
+
+/* Rebuilds the index of an archive that was not closed, up to the first torn block. */
+static int
+_scan_index(struct tlm_reader_s *r, uint64_t file_size)
+{
+	uint64_t offset = r->data_offset;
+	uint32_t capacity = 0;
+	tlm_block_header_s header;
+
+	while (offset + sizeof(header) <= file_size
+			&& _read_all(r->fd, &header, sizeof(header), offset) == TLM_ARCHIVE_ERROR_NONE
+			&& _header_valid(&header)
+			&& offset + sizeof(header) + header.size <= file_size)
+	{
+		if (r->index_count == capacity)
+		{
+			tlm_index_entry_s *index;
+
+			capacity = capacity ? capacity * 2 : 64;
+			index = realloc(r->index, capacity * sizeof(*index));
+			if (!index)
+				return TLM_ARCHIVE_ERROR_OUT_OF_MEMORY;
+			r->index = index;
+		}
+
+		r->index[r->index_count].offset = offset;
+		r->index[r->index_count].header = header;
+		r->index_count++;
+		offset += sizeof(header) + header.size;
+	}
+
+	return TLM_ARCHIVE_ERROR_NONE;
+}
+
+int tlm_reader_open(const char *path, tlm_reader_h *reader)
+{
+	struct tlm_reader_s *r;
+	tlm_file_header_s header;
+	struct stat st;
+	uint32_t i;
+	int s, ret;
+
+	if (!path || !reader)
+		return TLM_ARCHIVE_ERROR_INVALID_PARAMETER;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return TLM_ARCHIVE_ERROR_OUT_OF_MEMORY;
+
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0)
+	{
+		free(r);
+		return TLM_ARCHIVE_ERROR_IO;
+	}
+
+	if (fstat(r->fd, &st) != 0
+			|| _read_all(r->fd, &header, sizeof(header), 0) != TLM_ARCHIVE_ERROR_NONE
+			|| memcmp(header.magic, TLM_FILE_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != TLM_FILE_VERSION)
+	{
+		tlm_reader_close(r);
+		return TLM_ARCHIVE_ERROR_CORRUPT;
+	}
+	r->data_offset = sizeof(header);
+	r->wall_base_us = header.wall_base_us;
+
+	ret = _load_index(r, st.st_size);
+	if (ret == TLM_ARCHIVE_ERROR_CORRUPT)
+		ret = _scan_index(r, st.st_size);
+	if (ret != TLM_ARCHIVE_ERROR_NONE)
+	{
+		tlm_reader_close(r);
+		return ret;
+	}
+
+	for (s = 0; s < TLM_STREAM_MAX; s++)
+	{
+		r->by_stream[s] = malloc((r->index_count + 1) * sizeof(uint32_t));
+		if (!r->by_stream[s])
+		{
+			tlm_reader_close(r);
+			return TLM_ARCHIVE_ERROR_OUT_OF_MEMORY;
+		}
+	}
+
+	// Blocks are written in time order per stream, so file order is time order.
+	for (i = 0; i < r->index_count; i++)
+	{
+		s = r->index[i].header.stream;
+		r->by_stream[s][r->stream_count[s]++] = i;
+	}
+
+	*reader = r;
+
+	return TLM_ARCHIVE_ERROR_NONE;
+}
+
+void tlm_reader_close(tlm_reader_h reader)
+{
+	int s;
+
+	if (!reader)
+		return;
+
+	for (s = 0; s < TLM_STREAM_MAX; s++)
+		free(reader->by_stream[s]);
+	free(reader->index);
+	if (reader->fd >= 0)
+		close(reader->fd);
+	free(reader);
+}
+
+void tlm_reader_get_range(tlm_reader_h reader, uint64_t *t_min, uint64_t *t_max)
+{
+	uint64_t lo = 0, hi = 0;
+	uint32_t i;
+
+	for (i = 0; reader && i < reader->index_count; i++)
+	{
+		const tlm_block_header_s *h = &reader->index[i].header;
+
+		if (i == 0 || h->t_min < lo)
+			lo = h->t_min;
+		if (i == 0 || h->t_max > hi)
+			hi = h->t_max;
+	}
+
+	if (reader && reader->index_count)
+	{
+		lo += reader->wall_base_us;
+		hi += reader->wall_base_us;
+	}
+
+	if (t_min)
+		*t_min = lo;
+	if (t_max)
+		*t_max = hi;
+}
+
+/* Checks the block summary against the query; false means the block cannot match. */
+static bool
+_block_may_match(const tlm_block_header_s *h, const tlm_query_s *q)
+{
+	double scale;
+
+	if (h->t_max < q->t_from || h->t_min >= q->t_to)
+		return false;
+
+	if (q->filter_stream != h->stream)
+		return true;
+
+	scale = g_column_scale[h->stream][q->filter_column];
+
+	return h->max[q->filter_column] >= q->filter_min * scale - 0.5
+		&& h->min[q->filter_column] <= q->filter_max * scale + 0.5;
+}
+
+/* Decodes one block and reports its matches. Sets @a stop if the callback ended the query. */
+static int
+_query_block(struct tlm_reader_s *r, const tlm_index_entry_s *entry, const tlm_query_s *q,
+		tlm_record_cb callback, void *user_data, tlm_query_stats_s *stats, bool *stop)
+{
+	const tlm_block_header_s *h = &entry->header;
+	uint64_t *t = r->t;
+	const unsigned char *p = r->payload, *end;
+	int64_t delta = 0;
+	uint64_t raw;
+	uint32_t i;
+	int c;
+
+	if (_read_all(r->fd, r->payload, h->size, entry->offset + sizeof(*h)) != TLM_ARCHIVE_ERROR_NONE
+			|| _crc32(r->payload, h->size) != h->payload_crc)
+		return TLM_ARCHIVE_ERROR_CORRUPT;
+
+	stats->blocks_read++;
+	stats->bytes_read += sizeof(*h) + h->size;
+
+	end = p + h->col_size[0];
+	p = _get_varint(p, end, &raw);
+	if (!p)
+		return TLM_ARCHIVE_ERROR_CORRUPT;
+	t[0] = raw;
+	for (i = 1; i < h->count; i++)
+	{
+		p = _get_varint(p, end, &raw);
+		if (!p)
+			return TLM_ARCHIVE_ERROR_CORRUPT;
+		delta += _unzigzag(raw);
+		t[i] = t[i - 1] + delta;
+	}
+
+	for (c = 0; c < h->columns; c++)
+	{
+		int64_t prev = 0;
+
+		p = end;
+		end = p + h->col_size[c + 1];
+		for (i = 0; i < h->count; i++)
+		{
+			p = _get_varint(p, end, &raw);
+			if (!p)
+				return TLM_ARCHIVE_ERROR_CORRUPT;
+			prev += _unzigzag(raw);
+			r->v[c][i] = (int32_t)prev;
+		}
+	}
+
+	for (i = 0; i < h->count; i++)
+	{
+		double values[TLM_MAX_COLUMNS];
+
+		if (t[i] < q->t_from)
+			continue;
+		if (t[i] >= q->t_to)
+			break;
+
+		for (c = 0; c < h->columns; c++)
+			values[c] = r->v[c][i] / g_column_scale[h->stream][c];
+
+		if (q->filter_stream == h->stream
+				&& (values[q->filter_column] < q->filter_min || values[q->filter_column] > q->filter_max))
+			continue;
+
+		stats->records++;
+		if (!callback(h->stream, r->wall_base_us + t[i], values, h->columns, user_data))
+		{
+			*stop = true;
+			break;
+		}
+	}
+
+	return TLM_ARCHIVE_ERROR_NONE;
+}
+
+int tlm_reader_query(tlm_reader_h reader, const tlm_query_s *wall_query, tlm_record_cb callback, void *user_data, tlm_query_stats_s *stats)
+{
+	struct tlm_reader_s *r = reader;
+	tlm_query_stats_s local;
+	tlm_query_s stored;
+	const tlm_query_s *query = &stored;
+	bool stop = false;
+	int s;
+
+	if (!r || !wall_query || !callback)
+		return TLM_ARCHIVE_ERROR_INVALID_PARAMETER;
+	if (wall_query->filter_stream >= 0 && (wall_query->filter_stream >= TLM_STREAM_MAX
+			|| wall_query->filter_column < 0 || wall_query->filter_column >= g_column_count[wall_query->filter_stream]))
+		return TLM_ARCHIVE_ERROR_INVALID_PARAMETER;
+
+	// The range is in wall clock time; records are stored relative to the base.
+	stored = *wall_query;
+	stored.t_from = stored.t_from > r->wall_base_us ? stored.t_from - r->wall_base_us : 0;
+	if (stored.t_to != UINT64_MAX)
+		stored.t_to = stored.t_to > r->wall_base_us ? stored.t_to - r->wall_base_us : 0;
+
+	if (!stats)
+	{
+		memset(&local, 0, sizeof(local));
+		stats = &local;
+	}
+	stats->blocks_total += r->index_count;
+
+	for (s = 0; s < TLM_STREAM_MAX && !stop; s++)
+	{
+		uint32_t lo = 0, hi = r->stream_count[s];
+
+		if (!(query->streams & TLM_STREAM_MASK(s)))
+			continue;
+
+		// First block that ends at or after t_from.
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+
+			if (r->index[r->by_stream[s][mid]].header.t_max < query->t_from)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (; lo < r->stream_count[s] && !stop; lo++)
+		{
+			const tlm_index_entry_s *entry = &r->index[r->by_stream[s][lo]];
+			int ret;
+
+			if (entry->header.t_min >= query->t_to)
+				break;
+			if (!_block_may_match(&entry->header, query))
+				continue;
+
+			ret = _query_block(r, entry, query, callback, user_data, stats, &stop);
+			if (ret != TLM_ARCHIVE_ERROR_NONE)
+				return ret;
+		}
+	}
+
+	return TLM_ARCHIVE_ERROR_NONE;
+}
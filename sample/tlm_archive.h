@@ -0,0 +1,150 @@
+/**
+ * @file	tlm_archive.h
+ * @brief	Columnar, time-indexed archive of RVC telemetry
+ *
+ * Each stream (pose, wheel velocity, lin/ang velocity, sensor events) is cut
+ * into blocks of up to TLM_BLOCK_RECORDS records. Within a block every column
+ * is stored separately: timestamps as zigzag varints of the delta of deltas,
+ * values as zigzag varints of the delta to the previous record. Values are
+ * fixed point, see tlm_column_scale().
+ *
+ * File layout:
+ * @code
+ * file header | block header, columns | block header, columns | ... | index | trailer
+ * @endcode
+ * Every block header carries the time range and the min/max of each column. The
+ * index at the end repeats the headers with their file offsets, so a query
+ * reads the index once and then only the blocks whose summaries can match.
+ * If the writer did not close the file the index is missing and the reader
+ * rebuilds it by hopping from block header to block header.
+ */
+
+#ifndef __tlm_archive_H__
+#define __tlm_archive_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TLM_BLOCK_RECORDS	1024
+#define TLM_MAX_COLUMNS		3
+
+typedef enum {
+	TLM_STREAM_POSE,		// x, y (mm), q (rad)
+	TLM_STREAM_WHEEL,		// left, right (mm/s)
+	TLM_STREAM_LIN_ANG,		// lin (mm/s), ang (rad/s)
+	TLM_STREAM_EVENT,		// tlm_event_e, value
+	TLM_STREAM_MAX,
+} tlm_stream_e;
+
+#define TLM_STREAM_MASK(stream)	(1u << (stream))
+#define TLM_STREAM_ALL			((1u << TLM_STREAM_MAX) - 1)
+
+/**
+ * @brief Discrete events. The value is the sensor bit mask (bit 0 left, bit 1
+ * center, bit 2 right) for bumper, cliff, lift and magnet, or the new state.
+ */
+typedef enum {
+	TLM_EVENT_BUMPER = 1,
+	TLM_EVENT_CLIFF,
+	TLM_EVENT_LIFT,
+	TLM_EVENT_MAGNET,
+	TLM_EVENT_MODE,
+	TLM_EVENT_ERROR,
+	TLM_EVENT_SUCTION,
+	TLM_EVENT_BATTERY,
+} tlm_event_e;
+
+typedef enum {
+	TLM_ARCHIVE_ERROR_NONE = 0,
+	TLM_ARCHIVE_ERROR_INVALID_PARAMETER = -1,
+	TLM_ARCHIVE_ERROR_OUT_OF_MEMORY = -2,
+	TLM_ARCHIVE_ERROR_IO = -3,
+	TLM_ARCHIVE_ERROR_CORRUPT = -4,
+} tlm_archive_error_e;
+
+typedef struct tlm_writer_s *tlm_writer_h;
+typedef struct tlm_reader_s *tlm_reader_h;
+
+/**
+ * @brief Query on an archive.
+ * @details Records of the streams in @a streams with @a t_from <= t_us < @a t_to are
+ * returned. If @a filter_stream is set, records of that stream must also have
+ * column @a filter_column within [@a filter_min, @a filter_max], in the units of
+ * tlm_stream_e. Blocks whose min/max summary is outside that range are not read.
+ */
+typedef struct {
+	unsigned int streams;		// TLM_STREAM_MASK() bits
+	uint64_t t_from;
+	uint64_t t_to;
+	int filter_stream;			// -1 for no filter
+	int filter_column;
+	double filter_min;
+	double filter_max;
+} tlm_query_s;
+
+typedef struct {
+	unsigned int blocks_total;
+	unsigned int blocks_read;
+	uint64_t bytes_read;
+	uint64_t records;
+} tlm_query_stats_s;
+
+/**
+ * @brief Called for every matching record, in time order within each stream.
+ * @return false to stop the query
+ */
+typedef bool (*tlm_record_cb)(tlm_stream_e stream, uint64_t t_us, const double *values, int count, void *user_data);
+
+/** Number of value columns of @a stream. */
+int tlm_column_count(tlm_stream_e stream);
+
+/** Fixed point scale of a column: stored value = round(value * scale). */
+double tlm_column_scale(tlm_stream_e stream, int column);
+
+const char *tlm_stream_name(tlm_stream_e stream);
+
+/**
+ * @brief Creates a new archive at @a path, replacing any existing file.
+ * @details The writer is thread safe, so it can be fed from the RVC callbacks directly.
+ */
+int tlm_writer_open(const char *path, tlm_writer_h *writer);
+
+/** Flushes the open blocks, writes the index and closes the file. */
+int tlm_writer_close(tlm_writer_h writer);
+
+/**
+ * @brief Timestamp for a record appended now: microseconds on the monotonic clock
+ * since the archive was opened. Readers add the wall clock time of the opening.
+ */
+uint64_t tlm_writer_now_us(tlm_writer_h writer);
+
+/**
+ * @brief Appends one record. Timestamps of a stream must not go backwards.
+ * @param[in] t_us Time from tlm_writer_now_us()
+ * @param[in] values tlm_column_count(stream) values in the units of tlm_stream_e
+ */
+int tlm_writer_append(tlm_writer_h writer, tlm_stream_e stream, uint64_t t_us, const double *values);
+
+int tlm_writer_pose(tlm_writer_h writer, uint64_t t_us, float x, float y, float q);
+
+int tlm_writer_wheel(tlm_writer_h writer, uint64_t t_us, signed short left, signed short right);
+
+int tlm_writer_lin_ang(tlm_writer_h writer, uint64_t t_us, float lin, float ang);
+
+int tlm_writer_event(tlm_writer_h writer, uint64_t t_us, tlm_event_e event, int value);
+
+int tlm_reader_open(const char *path, tlm_reader_h *reader);
+
+void tlm_reader_close(tlm_reader_h reader);
+
+/** Wall clock time range covered by the archive; both are 0 for an empty one. */
+void tlm_reader_get_range(tlm_reader_h reader, uint64_t *t_min, uint64_t *t_max);
+
+/**
+ * @brief Runs @a query, calling @a callback for each match.
+ * @details Query and record times are wall clock microseconds since the epoch.
+ * @param[in,out] stats Accumulates block and byte counts, may be NULL
+ */
+int tlm_reader_query(tlm_reader_h reader, const tlm_query_s *query, tlm_record_cb callback, void *user_data, tlm_query_stats_s *stats);
+
+#endif /* __tlm_archive_H__ */
@@ -16,8 +16,13 @@
 #include <termios.h>	// termios
 #include <unistd.h>		// tcgetattr(), usleep()
 #include <fcntl.h>		// fcntl()
+#include <time.h>		// clock_gettime()
+#include <pthread.h>	// pthread_rwlock_*()
 
 #include "rvc_api.h"	// RVC API
+#include "plan_bench.h"	// plan_bench_run()
+#include "tlm_archive.h"	// tlm_writer_*()
+#include "rvc_log.h"	// RVC_LOG_I()
 
 
 #define LOG_RED "\033[0;31m"
@@ -38,7 +43,7 @@
  */
 void __test_mode_evt_callback(unsigned char mode, void* user_data)
 {
-	printf("Mode event callback : %d\n", mode);
+	RVC_LOG_I("Mode event callback : %d", mode);
 }
 
 /**
@@ -53,7 +58,7 @@ void __test_mode_evt_callback(unsigned char mode, void* user_data)
  */
 void __test_error_evt_callback(unsigned char error_type, void* user_data)
 {
-	printf("Error event callback : %d\n", error_type);
+	RVC_LOG_I("Error event callback : %d", error_type);
 }
 
 /**
@@ -69,7 +74,7 @@ void __test_error_evt_callback(unsigned char error_type, void* user_data)
  */
 void __test_cliff_evt_callback(unsigned char cliff_left, unsigned char cliff_center, unsigned char cliff_right, void* user_data)
 {
-	printf("Cliff is changed : (left) %s, (center) %s, (right) %s\n",
+	RVC_LOG_I("Cliff is changed : (left) %s, (center) %s, (right) %s",
 		cliff_left   ? "true" : "false",
 		cliff_center ? "true" : "false",
 		cliff_right  ? "true" : "false");
@@ -88,7 +93,7 @@ void __test_cliff_evt_callback(unsigned char cliff_left, unsigned char cliff_cen
  */
 void __test_lift_evt_callback(unsigned char lift_left, unsigned char lift_right, void* user_data)
 {
-	printf("Lift is changed : (left) %s, (right) %s\n",
+	RVC_LOG_I("Lift is changed : (left) %s, (right) %s",
 		lift_left  ? "true" : "false",
 		lift_right ? "true" : "false");
 }
@@ -104,7 +109,7 @@ void __test_lift_evt_callback(unsigned char lift_left, unsigned char lift_right,
  */
 void __test_magnet_evt_callback(unsigned char magnet, void* user_data) 
 {
-	printf("Magnet event callback : %s\n", magnet ? "true" : "false");
+	RVC_LOG_I("Magnet event callback : %s", magnet ? "true" : "false");
 }
 
 /**
@@ -119,7 +124,7 @@ void __test_magnet_evt_callback(unsigned char magnet, void* user_data)
  */
 void __test_bumper_evt_callback(unsigned char bumper_left, unsigned char bumper_right, void* user_data)
 {
-	printf("Bumper event callback, bumper_left : %d, bumper_right : %d\n", bumper_left, bumper_right);
+	RVC_LOG_I("Bumper event callback, bumper_left : %d, bumper_right : %d", bumper_left, bumper_right);
 }
 
 /**
@@ -133,7 +138,7 @@ void __test_bumper_evt_callback(unsigned char bumper_left, unsigned char bumper_
  */
 void __test_suction_evt_callback(unsigned char suction, void* user_data)
 {
-	printf("Suction event callback, suction : %d\n", suction);
+	RVC_LOG_I("Suction event callback, suction : %d", suction);
 }
 
 /**
@@ -150,7 +155,7 @@ void __test_suction_evt_callback(unsigned char suction, void* user_data)
  */
 void __test_reservation_evt_callback(rvc_reserve_type_e reserve_type, unsigned char is_on, unsigned char reserve_hh, unsigned char reserve_mm, void* user_data)
 {
-	printf("reservation event callback, reserve_type : %d, is_on = %d, reserve_hh = %d, reserve_mm = %d\n", reserve_type, is_on, reserve_hh, reserve_mm);
+	RVC_LOG_I("reservation event callback, reserve_type : %d, is_on = %d, reserve_hh = %d, reserve_mm = %d", reserve_type, is_on, reserve_hh, reserve_mm);
 }
 
 /**
@@ -169,7 +174,7 @@ void __test_reservation_evt_callback(rvc_reserve_type_e reserve_type, unsigned c
  */
 void __test_wheel_vel_evt_callback(signed short wheel_vel_left, signed short wheel_vel_right, void* user_data)
 {
-	printf("wheel event callback, wheel_vel_left : %d, wheel_vel_right = %d\n", wheel_vel_left, wheel_vel_right);
+	RVC_LOG_I("wheel event callback, wheel_vel_left : %d, wheel_vel_right = %d", wheel_vel_left, wheel_vel_right);
 }
 
 /**
@@ -185,7 +190,188 @@ void __test_wheel_vel_evt_callback(signed short wheel_vel_left, signed short whe
  */
 void __test_lin_ang_evt_callback(float lin, float ang, void* user_data)
 {
-	printf("lin/ang event callback, lin : %.2f, ang = %.2f\n", lin, ang);
+	RVC_LOG_I("lin/ang event callback, lin : %.2f, ang = %.2f", lin, ang);
+}
+
+/*
+ * Telemetry recording: while on, the callbacks below replace the printing ones
+ * and append every event to an archive that tlmQuery can search. Callbacks hold
+ * g_tlm_lock for reading while they append, so __tlm_stop() can wait them out.
+ */
+static tlm_writer_h g_tlm;
+static pthread_rwlock_t g_tlm_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static tlm_writer_h
+__tlm_acquire(void)
+{
+	pthread_rwlock_rdlock(&g_tlm_lock);
+	return g_tlm;
+}
+
+static void
+__tlm_release(void)
+{
+	pthread_rwlock_unlock(&g_tlm_lock);
+}
+
+static void __tlm_mode_evt_callback(rvc_mode_type_get_e mode, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_event(tlm, tlm_writer_now_us(tlm), TLM_EVENT_MODE, mode);
+	__tlm_release();
+}
+
+static void __tlm_error_evt_callback(rvc_device_error_type_e error, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_event(tlm, tlm_writer_now_us(tlm), TLM_EVENT_ERROR, error);
+	__tlm_release();
+}
+
+static void __tlm_pose_evt_callback(float pose_x, float pose_y, float pose_q, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_pose(tlm, tlm_writer_now_us(tlm), pose_x, pose_y, pose_q);
+	__tlm_release();
+}
+
+static void __tlm_wheel_vel_evt_callback(signed short wheel_vel_left, signed short wheel_vel_right, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_wheel(tlm, tlm_writer_now_us(tlm), wheel_vel_left, wheel_vel_right);
+	__tlm_release();
+}
+
+static void __tlm_lin_ang_evt_callback(float lin, float ang, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_lin_ang(tlm, tlm_writer_now_us(tlm), lin, ang);
+	__tlm_release();
+}
+
+static void __tlm_bumper_evt_callback(unsigned char bumper_left, unsigned char bumper_right, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_event(tlm, tlm_writer_now_us(tlm), TLM_EVENT_BUMPER, (bumper_left ? 0x1 : 0) | (bumper_right ? 0x4 : 0));
+	__tlm_release();
+}
+
+static void __tlm_cliff_evt_callback(unsigned char cliff_left, unsigned char cliff_center, unsigned char cliff_right, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_event(tlm, tlm_writer_now_us(tlm), TLM_EVENT_CLIFF, (cliff_left ? 0x1 : 0) | (cliff_center ? 0x2 : 0) | (cliff_right ? 0x4 : 0));
+	__tlm_release();
+}
+
+static void __tlm_lift_evt_callback(unsigned char lift_left, unsigned char lift_right, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_event(tlm, tlm_writer_now_us(tlm), TLM_EVENT_LIFT, (lift_left ? 0x1 : 0) | (lift_right ? 0x4 : 0));
+	__tlm_release();
+}
+
+static void __tlm_magnet_evt_callback(unsigned char magnet, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_event(tlm, tlm_writer_now_us(tlm), TLM_EVENT_MAGNET, magnet);
+	__tlm_release();
+}
+
+static void __tlm_suction_evt_callback(rvc_suction_state_e state, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_event(tlm, tlm_writer_now_us(tlm), TLM_EVENT_SUCTION, state);
+	__tlm_release();
+}
+
+static void __tlm_batt_evt_callback(rvc_batt_level_e level, void* user_data)
+{
+	tlm_writer_h tlm = __tlm_acquire();
+
+	if (tlm)
+		tlm_writer_event(tlm, tlm_writer_now_us(tlm), TLM_EVENT_BATTERY, level);
+	__tlm_release();
+}
+
+static int __tlm_start(void)
+{
+	char path[64];
+	tlm_writer_h tlm;
+
+	snprintf(path, sizeof(path), "rvc_%ld.tlm", (long)time(NULL));
+	if (tlm_writer_open(path, &tlm) != TLM_ARCHIVE_ERROR_NONE)
+	{
+		printf("cannot create %s\n", path);
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&g_tlm_lock);
+	g_tlm = tlm;
+	pthread_rwlock_unlock(&g_tlm_lock);
+
+	rvc_set_mode_evt_cb(__tlm_mode_evt_callback, NULL);
+	rvc_set_error_evt_cb(__tlm_error_evt_callback, NULL);
+	rvc_set_pose_evt_cb(__tlm_pose_evt_callback, NULL);
+	rvc_set_wheel_vel_evt_cb(__tlm_wheel_vel_evt_callback, NULL);
+	rvc_set_lin_ang_evt_cb(__tlm_lin_ang_evt_callback, NULL);
+	rvc_set_bumper_evt_cb(__tlm_bumper_evt_callback, NULL);
+	rvc_set_cliff_evt_cb(__tlm_cliff_evt_callback, NULL);
+	rvc_set_lift_evt_cb(__tlm_lift_evt_callback, NULL);
+	rvc_set_magnet_evt_cb(__tlm_magnet_evt_callback, NULL);
+	rvc_set_suction_evt_cb(__tlm_suction_evt_callback, NULL);
+	rvc_set_batt_evt_cb(__tlm_batt_evt_callback, NULL);
+
+	printf("recording telemetry to %s\n", path);
+
+	return 0;
+}
+
+static void __tlm_stop(void)
+{
+	tlm_writer_h tlm;
+
+	rvc_unset_mode_evt_cb();
+	rvc_unset_error_evt_cb();
+	rvc_unset_pose_evt_cb();
+	rvc_unset_wheel_vel_evt_cb();
+	rvc_unset_lin_ang_evt_cb();
+	rvc_unset_bumper_evt_cb();
+	rvc_unset_cliff_evt_cb();
+	rvc_unset_lift_evt_cb();
+	rvc_unset_magnet_evt_cb();
+	rvc_unset_suction_evt_cb();
+	rvc_unset_batt_evt_cb();
+
+	// Waits for callbacks already running on the rvc thread to finish their append.
+	pthread_rwlock_wrlock(&g_tlm_lock);
+	tlm = g_tlm;
+	g_tlm = NULL;
+	pthread_rwlock_unlock(&g_tlm_lock);
+
+	if (tlm_writer_close(tlm) != TLM_ARCHIVE_ERROR_NONE)
+		printf("telemetry archive may be incomplete\n");
+
+	printf("telemetry recording stopped\n");
 }
 
 int main(int argc, char *argv[])
@@ -204,13 +390,17 @@ int main(int argc, char *argv[])
 	int ret_3 = 0;
 	signed short wheel_vel_left=0, wheel_vel_right=0;
 	float ang_vel=0.f, lin_vel=0.f;
-	int timer = 0;
+	plan_result_s plan_result;
     unsigned char is_on = 0;
 
+	// Callbacks log through the logger thread so they never block on the terminal.
+	rvc_log_init(NULL);
+
 	// initialize RVC API
 	if (rvc_initialize() < 0)
 	{
 		printf("rvc_initialize() failed.\n");
+		rvc_log_shutdown();
 		return -1;
 	}
 
@@ -238,6 +428,7 @@ int main(int argc, char *argv[])
 			printf("d	- set wheel left/right vel				\n");
 			printf("e	- excute test planning mode w/ lin/ang	\n");
 			printf("f	- excute test planning mode w/ l/r wheel\n");
+			printf("g	- start/stop telemetry recording		\n");
 			printf("q	- quit.									\n");
 
 		}
@@ -543,75 +734,31 @@ int main(int argc, char *argv[])
 
 		case 'e':
 			printf("execute test planning mode w/ lin/ang vel\n");
-			while(1)
-			{
-				if(timer < 800)
-				{
-					// Set the linear and angular velocity.
-					rvc_set_lin_ang(10.f, 0.f);
-				}
-				else if(timer < 1200)
-				{
-					rvc_set_lin_ang(-10.f, 0.f);
-				}
-				else if(timer < 1600)
-				{
-					rvc_set_lin_ang(50.f, 0.3f);
-				}
-				else
-				{
-					timer = 0;
-					printf("timer is over\n", timer);
 
-					// Sends a command to stop RVC
-					rvc_set_mode(RVC_MODE_SET_PAUSE);
-					break;
-				}
-				timer++;
+			// Runs each segment for its wall clock duration at a fixed command rate.
+			plan_bench_run(&plan_script_lin_ang, NULL, &plan_result);
 
-				if (timer % 100 == 0)
-				{
-					printf("timer = %d\n", timer);
-				}
-				//usleep(50000); // sleep for 50ms
-			}
+			// Sends a command to stop RVC
+			rvc_set_mode(RVC_MODE_SET_PAUSE);
+			plan_bench_print(&plan_result, stdout);
+			break;
 
 		case 'f':
 			printf("execute test planning mode w/ left/right wheel vel\n");
-			while(1)
-			{
-				if(timer < 800)
-				{
-					// Set the linear and angular velocity.
-					rvc_set_wheel_vel(10, 10);
-				}
-				else if(timer < 1200)
-				{
-					rvc_set_wheel_vel(-10, -10);
-				}
-				else if(timer < 1600)
-				{
-					rvc_set_wheel_vel(50, 20);
-				}
-				else
-				{
-					timer = 0;
-					printf("timer is over\n", timer);
 
-					// Sends a command to stop RVC
-					rvc_set_mode(RVC_MODE_SET_PAUSE);
-					break;
-				}
-				timer++;
+			// Runs each segment for its wall clock duration at a fixed command rate.
+			plan_bench_run(&plan_script_wheel_vel, NULL, &plan_result);
 
-				if (timer % 100 == 0)
-				{
-					printf("timer = %d\n", timer);
-				}
-				//usleep(50000); // sleep for 50ms
-			}
-			
+			// Sends a command to stop RVC
+			rvc_set_mode(RVC_MODE_SET_PAUSE);
+			plan_bench_print(&plan_result, stdout);
+			break;
 
+		case 'g':
+			if (g_tlm)
+				__tlm_stop();
+			else
+				__tlm_start();
 			break;
 
 		case 'q':
@@ -620,10 +767,15 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (g_tlm)
+		__tlm_stop();
+
 	// Deinitializes RVC API.
 	printf("Before RvcApiQuit()\n");
 	rvc_deinitialize();
 	printf("After  RvcApiQuit()\n");
 
+	rvc_log_shutdown();
+
 	return 0;
 }